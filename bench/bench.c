@@ -0,0 +1,473 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "codegen.h"
+#include "flat.h"
+#include "lex.h"
+#include "memo.h"
+#include "num.h"
+#include "parse.h"
+#include "prune.h"
+#include "reassoc.h"
+#include "resolve.h"
+
+static double
+now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Number literals: `lilc_strtod` against the C library's `strtod`, over
+ * corpora shaped like numeric code: small integers, short decimals and
+ * scientific constants, plus round-tripped doubles, which at 17 digits
+ * are too long for the fast path.
+ */
+#define LITERALS 1000000
+#define ROUNDS 5
+
+static const char *corpus_names[] = {"integers", "decimals", "scientific", "17 digits"};
+
+static char *
+literal_corpus(int kind, size_t *starts, size_t *lens, int count) {
+    char *buf = malloc((size_t)count * 32);
+    size_t n = 0;
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        starts[i] = n;
+        switch (kind) {
+            case 0: n += sprintf(buf + n, "%d", rand() % 1000); break;
+            case 1: n += sprintf(buf + n, "%d.%d", rand() % 100, rand() % 100000); break;
+            case 2: n += sprintf(buf + n, "%d.%de%d", rand() % 10, rand() % 1000, rand() % 40 - 20); break;
+            default: n += sprintf(buf + n, "%.17g", rand() / (double)RAND_MAX); break;
+        }
+        lens[i] = n - starts[i];
+        buf[n++] = ' ';
+    }
+    buf[n] = '\0';
+    return buf;
+}
+
+static void
+bench_strtod(int kind) {
+    size_t *starts = malloc(sizeof(size_t) * LITERALS);
+    size_t *lens = malloc(sizeof(size_t) * LITERALS);
+    char *corpus = literal_corpus(kind, starts, lens, LITERALS);
+
+    double sum_lilc = 0, sum_libc = 0, best_lilc = 1e9, best_libc = 1e9;
+    for (int r = 0; r < ROUNDS; r++) {
+        double t = now();
+        for (int i = 0; i < LITERALS; i++) {
+            sum_lilc += lilc_strtod(corpus + starts[i], lens[i]);
+        }
+        t = now() - t;
+        if (t < best_lilc) best_lilc = t;
+
+        // strtod stops at the separating space, so it needs no copy
+        t = now();
+        for (int i = 0; i < LITERALS; i++) {
+            sum_libc += strtod(corpus + starts[i], NULL);
+        }
+        t = now() - t;
+        if (t < best_libc) best_libc = t;
+    }
+
+    printf("strtod %-10s  lilc %6.1f ns  libc %6.1f ns  %.2fx%s\n",
+           corpus_names[kind], best_lilc * 1e9 / LITERALS, best_libc * 1e9 / LITERALS,
+           best_libc / best_lilc, sum_lilc == sum_libc ? "" : "  MISMATCH");
+
+    free(corpus);
+    free(starts);
+    free(lens);
+}
+
+/*
+ * AST cache: getting a flat tree for a large generated program by lexing
+ * and parsing it, against mapping it back from a cache file.
+ */
+#define CACHE_FUNCS 200000
+#define CACHE_PATH "bench_ast_cache.bin"
+
+static void
+bench_ast_cache(void) {
+    char *src = malloc((size_t)CACHE_FUNCS * 64);
+    size_t n = 0;
+    for (int i = 0; i < CACHE_FUNCS; i++) {
+        n += sprintf(src + n, "def f%d(a, b) { a * %d.5 + b / (a - %d); };\n", i, i, i);
+    }
+    unlink(CACHE_PATH);
+
+    struct flat_ast f;
+    double best_parse = 1e9, best_load = 1e9;
+    for (int r = 0; r < ROUNDS; r++) {
+        unlink(CACHE_PATH);
+        double t = now();
+        flat_ast_init(&f);
+        flat_ast_cached(&f, src, n, "bench", CACHE_PATH);
+        t = now() - t;
+        flat_ast_free(&f);
+        if (t < best_parse) best_parse = t;
+
+        t = now();
+        flat_ast_init(&f);
+        int hit = flat_ast_cached(&f, src, n, "bench", CACHE_PATH);
+        t = now() - t;
+        flat_ast_free(&f);
+        if (!hit) printf("ast cache: MISS\n");
+        if (t < best_load) best_load = t;
+    }
+
+    printf("ast cache %.1f MB  parse+write %6.1f ms  hit %6.1f ms  %.1fx\n",
+           n / 1e6, best_parse * 1e3, best_load * 1e3, best_parse / best_load);
+
+    unlink(CACHE_PATH);
+    free(src);
+}
+
+/*
+ * Front end: parsing with the whole input lexed up front, against with
+ * lexing on a thread of its own feeding the parser through a token ring,
+ * for programs from small to large.
+ */
+static double
+time_parse(const char *src, int pipelined) {
+    struct lexer l;
+    struct parser p;
+    struct arena a;
+    arena_init(&a);
+    lex_init(&l, src, "bench");
+    parser_init(&p, &l, &a);
+    p.pipelined = pipelined;
+    double t = now();
+    parse(&p);
+    t = now() - t;
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+    return t;
+}
+
+static void
+bench_pipeline(int funcs) {
+    char *src = malloc((size_t)funcs * 64);
+    size_t n = 0;
+    for (int i = 0; i < funcs; i++) {
+        n += sprintf(src + n, "def f%d(a, b) { a * %d.5 + b / (a - %d); };\n", i, i, i);
+    }
+
+    double best_seq = 1e9, best_pipe = 1e9;
+    for (int r = 0; r < ROUNDS; r++) {
+        double t = time_parse(src, 0);
+        if (t < best_seq) best_seq = t;
+        t = time_parse(src, 1);
+        if (t < best_pipe) best_pipe = t;
+    }
+
+    printf("parse %7d funcs %9.3f MB  sequential %6.1f MB/s  pipelined %6.1f MB/s  %.2fx\n",
+           funcs, n / 1e6, n / best_seq / 1e6, n / best_pipe / 1e6, best_seq / best_pipe);
+    free(src);
+}
+
+/*
+ * Parallel front end: the same programs parsed sequentially, against cut
+ * into top-level chunks lexed and parsed on 1 to 8 threads. The names are
+ * all distinct, too many for the threads' caches, so they contend for the
+ * intern table.
+ */
+static double
+time_parallel(const char *src, size_t len, int nthreads) {
+    struct arena a;
+    arena_init(&a);
+    double t = now();
+    parse_parallel(src, len, "bench", nthreads, &a);
+    t = now() - t;
+    arena_free(&a);
+    return t;
+}
+
+static void
+bench_parallel(int funcs) {
+    char *src = malloc((size_t)funcs * 64);
+    size_t n = 0;
+    for (int i = 0; i < funcs; i++) {
+        n += sprintf(src + n, "def g%d(a, b) { a * %d.5 + b / (a - %d); };\n", i, i, i);
+    }
+
+    double best_seq = 1e9;
+    for (int r = 0; r < ROUNDS; r++) {
+        double t = time_parse(src, 0);
+        if (t < best_seq) best_seq = t;
+    }
+    printf("parallel %7d funcs %9.3f MB  sequential %6.1f MB/s", funcs, n / 1e6, n / best_seq / 1e6);
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        double best = 1e9;
+        for (int r = 0; r < ROUNDS; r++) {
+            double t = time_parallel(src, n, threads);
+            if (t < best) best = t;
+        }
+        printf("  %d: %.2fx", threads, best_seq / best);
+    }
+    printf("\n");
+    free(src);
+}
+
+/*
+ * Algebraic rewriting: a polynomial kernel written out longhand, as
+ * parsed against rewritten into Horner form with relaxed floating point,
+ * timed as JIT compiled and run. Compiling is timed on its own, with the
+ * kernel left uncalled, and taken off.
+ */
+#define KERNEL_CALLS 1000  // Thousands of them
+
+static const char *kernel_src =
+    "def p(x) { 0.5 * x * x * x * x * x * x * x * x - 1.5 * x * x * x * x * x * x * x + 2 * x * x * x * x * x * x\n"
+    "    - 2.5 * x * x * x * x * x + 3 * x * x * x * x - 3.5 * x * x * x + 4 * x * x - 4.5 * x + 5; };\n"
+    "def loop(n, x, acc) { if (n < 1) { acc; } else { loop(n - 1, x + 0.001, acc + p(x)); }; };\n"
+    "def outer(m, acc) { if (m < 1) { acc; } else { outer(m - 1, acc + loop(1000, m / 1000, 0)); }; };\n"
+    "def main() { outer(%d, 0); };\n";
+
+// JIT and run a program, given `stats` adding what its caches did to it.
+// Codegen dumps each module it runs, so that's sent nowhere meanwhile.
+static double
+time_eval(struct lilc_node_t *node, double *result, memo_stats_t *stats) {
+    fflush(stderr);
+    int err = dup(STDERR_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDERR_FILENO);
+    double t = now();
+    *result = lilc_eval_stats(node, stats);
+    t = now() - t;
+    fflush(stderr);
+    dup2(err, STDERR_FILENO);
+    close(null);
+    close(err);
+    return t;
+}
+
+static double
+time_kernel(int thousands, enum fp_mode fp, double *result) {
+    char src[1024];
+    snprintf(src, sizeof(src), kernel_src, thousands);
+    struct lexer l;
+    struct parser p;
+    struct arena a;
+    arena_init(&a);
+    lex_init(&l, src, "bench");
+    parser_init(&p, &l, &a);
+    struct lilc_node_t *node = parse(&p);
+    resolve(node, &l);
+    node = reassoc(node, &a, fp);
+    double t = time_eval(node, result, NULL);
+
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+    return t;
+}
+
+static void
+bench_reassoc(void) {
+    double best[2] = {1e9, 1e9}, results[2];
+    for (int fp = LILC_FP_STRICT; fp <= LILC_FP_RELAXED; fp++) {
+        for (int r = 0; r < ROUNDS; r++) {
+            double compile = time_kernel(0, fp, &results[fp]);
+            double t = time_kernel(KERNEL_CALLS, fp, &results[fp]) - compile;
+            if (t < best[fp]) best[fp] = t;
+        }
+    }
+
+    double calls = KERNEL_CALLS * 1000.0;
+    printf("kernel %dk calls  strict %6.2f ns  relaxed %6.2f ns  %.2fx  results differ by %.1e\n",
+           KERNEL_CALLS, best[0] * 1e9 / calls, best[1] * 1e9 / calls, best[0] / best[1],
+           fabs(results[0] - results[1]) / fabs(results[0]));
+}
+
+/*
+ * Dead function elimination: JIT compiling and running a program of many
+ * small functions, only some of them ever called, as parsed against with
+ * the rest taken out.
+ */
+#define PRUNE_FUNCS 2000
+
+static double
+time_pruned(const char *src, int pruned, double *result) {
+    struct lexer l;
+    struct parser p;
+    struct arena a;
+    arena_init(&a);
+    lex_init(&l, src, "bench");
+    parser_init(&p, &l, &a);
+    struct lilc_node_t *node = parse(&p);
+    resolve(node, &l);
+    double t = now();
+    if (pruned) prune(node, NULL, 0);
+    t = time_eval(node, result, NULL) + now() - t;
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+    return t;
+}
+
+static void
+bench_prune(int live_every) {
+    char *src = malloc((size_t)PRUNE_FUNCS * 64);
+    size_t n = 0;
+    for (int i = 0; i < PRUNE_FUNCS; i++) {
+        n += sprintf(src + n, "def f%d(x) { x * %d + 1; };\n", i, i);
+    }
+    n += sprintf(src + n, "def main() { 0");
+    for (int i = 0; i < PRUNE_FUNCS; i += live_every) n += sprintf(src + n, " + f%d(1)", i);
+    sprintf(src + n, "; };\n");
+
+    double best[2] = {1e9, 1e9}, results[2];
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int pruned = 0; pruned < 2; pruned++) {
+            double t = time_pruned(src, pruned, &results[pruned]);
+            if (t < best[pruned]) best[pruned] = t;
+        }
+    }
+
+    printf("prune %d funcs, 1 in %2d live  all %7.1f ms  pruned %7.1f ms  %.2fx%s\n",
+           PRUNE_FUNCS, live_every, best[0] * 1e3, best[1] * 1e3, best[0] / best[1],
+           results[0] == results[1] ? "" : "  MISMATCH");
+    free(src);
+}
+
+/*
+ * Lazy parsing: the front end over a large library of functions, of which
+ * a run only calls a few, parsed in full against with only the bodies
+ * reached parsed. Includes lexing, which both do in full.
+ */
+#define LAZY_FUNCS 100000
+
+static double
+time_lazy(const char *src, int lazy, size_t *used) {
+    struct lexer l;
+    struct parser p;
+    struct arena a;
+    arena_init(&a);
+    lex_init(&l, src, "bench");
+    parser_init(&p, &l, &a);
+    p.lazy = lazy;
+    double t = now();
+    struct lilc_node_t *root = parse(&p);
+    if (lazy) parse_reachable(&p, root, NULL, 0);
+    t = now() - t;
+    *used = a.used;
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+    return t;
+}
+
+static void
+bench_lazy(int live_every) {
+    char *src = malloc((size_t)LAZY_FUNCS * 128);
+    size_t n = 0;
+    for (int i = 0; i < LAZY_FUNCS; i++) {
+        n += sprintf(src + n, "def f%d(a, b) { if (a < b) { a * %d.5 + b / (a - %d); } else { b - a; }; };\n",
+                     i, i, i);
+    }
+    n += sprintf(src + n, "def main() { 0");
+    for (int i = 0; i < LAZY_FUNCS; i += live_every) n += sprintf(src + n, " + f%d(1, 2)", i);
+    n += sprintf(src + n, "; };\n");
+
+    double best[2] = {1e9, 1e9};
+    size_t used[2];
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int lazy = 0; lazy < 2; lazy++) {
+            double t = time_lazy(src, lazy, &used[lazy]);
+            if (t < best[lazy]) best[lazy] = t;
+        }
+    }
+
+    printf("lazy %d funcs, 1 in %3d called  full %6.1f ms %6.1f MB  lazy %6.1f ms %6.1f MB  %.2fx\n",
+           LAZY_FUNCS, live_every, best[0] * 1e3, used[0] / 1e6, best[1] * 1e3, used[1] / 1e6,
+           best[0] / best[1]);
+    free(src);
+}
+
+/*
+ * Memoization: naive recursive functions, JIT compiled and run as written
+ * against with their results cached. The last recurses once a call, so
+ * its cache never hits, and only shows what caching costs. Times are end
+ * to end, JIT compiling included, so the smaller runs are mostly that.
+ */
+static const struct {
+    const char *name;
+    int n;
+    const char *src;  // Annotation, then `n`
+} memo_workloads[] = {
+    {"fib", 27, "%sdef fib(n) { if (n < 2) { n; } else { fib(n - 1) + fib(n - 2); }; };\n"
+                "def main() { fib(%d); };\n"},
+    {"fib", 32, "%sdef fib(n) { if (n < 2) { n; } else { fib(n - 1) + fib(n - 2); }; };\n"
+                "def main() { fib(%d); };\n"},
+    {"fib", 35, "%sdef fib(n) { if (n < 2) { n; } else { fib(n - 1) + fib(n - 2); }; };\n"
+                "def main() { fib(%d); };\n"},
+    {"choose", 26, "%sdef choose(n, k) { if (k < 1) { 1; } else { if (n < k + 1) { 1; } else {\n"
+                   "    choose(n - 1, k - 1) + choose(n - 1, k); }; }; };\n"
+                   "def main() { choose(%d, 13); };\n"},
+    {"count", 4000, "%sdef count(n) { if (n < 1) { 0; } else { count(n - 1) + 1; }; };\n"
+                    "def main() { count(%d); };\n"},
+};
+
+static double
+time_memo(int w, int memo, double *result, memo_stats_t *stats) {
+    char src[512];
+    snprintf(src, sizeof(src), memo_workloads[w].src, memo ? "@memo " : "", memo_workloads[w].n);
+    struct lexer l;
+    struct parser p;
+    struct arena a;
+    arena_init(&a);
+    lex_init(&l, src, "bench");
+    parser_init(&p, &l, &a);
+    struct lilc_node_t *node = parse(&p);
+    resolve(node, &l);
+    memoize(node, LILC_MEMO_ANNOTATED);
+    kv_size(*stats) = 0;
+    double t = time_eval(node, result, stats);
+
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+    return t;
+}
+
+static void
+bench_memo(int w) {
+    double best[2] = {1e9, 1e9}, results[2];
+    memo_stats_t stats;
+    kv_init(stats);
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int memo = 0; memo < 2; memo++) {
+            double t = time_memo(w, memo, &results[memo], &stats);
+            if (t < best[memo]) best[memo] = t;
+        }
+    }
+
+    struct memo_stats *s = &kv_A(stats, 0);
+    printf("memo %-6s %5d  plain %8.3f ms  @memo %6.3f ms  %9.2fx  %llu hits %llu misses %llu evictions%s\n",
+           memo_workloads[w].name, memo_workloads[w].n, best[0] * 1e3, best[1] * 1e3, best[0] / best[1],
+           (unsigned long long)s->hits, (unsigned long long)s->misses, (unsigned long long)s->evictions,
+           results[0] == results[1] ? "" : "  MISMATCH");
+    kv_destroy(stats);
+}
+
+int
+main() {
+    for (int kind = 0; kind < 4; kind++) bench_strtod(kind);
+    bench_ast_cache();
+    for (int funcs = 100; funcs <= 1000000; funcs *= 10) bench_pipeline(funcs);
+    for (int funcs = 1000; funcs <= 1000000; funcs *= 10) bench_parallel(funcs);
+    bench_reassoc();
+    for (int every = 1; every <= 100; every *= 10) bench_prune(every);
+    for (int every = 1; every <= 100; every *= 10) bench_lazy(every);
+    for (int w = 0; w < sizeof(memo_workloads) / sizeof(memo_workloads[0]); w++) bench_memo(w);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include <stdlib.h>
+
+#include "arena.h"
+
+void
+arena_init(struct arena *a) {
+    a->block = NULL;
+    a->next = NULL;
+    a->end = NULL;
+    a->used = 0;
+}
+
+// Free every block, and with them everything allocated from the arena
+void
+arena_free(struct arena *a) {
+    struct arena_block *b = a->block;
+    while (b) {
+        struct arena_block *prev = b->prev;
+        free(b);
+        b = prev;
+    }
+    arena_init(a);
+}
+
+// Slow path of `arena_alloc`: start a new block big enough for `size`
+// bytes (already rounded up) and allocate from it. Whatever was left of
+// the old block is abandoned.
+void *
+arena_grow(struct arena *a, size_t size) {
+    size_t cap = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    struct arena_block *b = malloc(sizeof(struct arena_block) + cap);
+    b->prev = a->block;
+    a->block = b;
+    a->next = b->data + size;
+    a->end = b->data + cap;
+    a->used += size;
+    return b->data;
+}
+
+// Take over all of `from`'s blocks, so they're freed along with `a`'s.
+// `from` is left empty.
+void
+arena_adopt(struct arena *a, struct arena *from) {
+    if (!from->block) return;
+    if (!a->block) {
+        *a = *from;
+        arena_init(from);
+        return;
+    }
+
+    // Slot them in behind the current block, which still has free space
+    struct arena_block *oldest = from->block;
+    while (oldest->prev) oldest = oldest->prev;
+    oldest->prev = a->block->prev;
+    a->block->prev = from->block;
+    a->used += from->used;
+    arena_init(from);
+}
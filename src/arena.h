@@ -0,0 +1,49 @@
+#ifndef LILC_ARENA_H
+#define LILC_ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Bump-pointer allocator. Allocations are carved out of large blocks and
+ * never freed one at a time: everything in an arena goes at once, when
+ * the arena is freed. Not thread-safe; give each thread its own and merge
+ * them with `arena_adopt`.
+ */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct arena_block {
+    struct arena_block *prev;
+    char data[];
+};
+
+struct arena {
+    struct arena_block *block;  // Block currently being carved up
+    char *next;                 // Free space left in it
+    char *end;
+    size_t used;                // Bytes handed out so far
+};
+
+void
+arena_init(struct arena *a);
+
+void
+arena_free(struct arena *a);
+
+void
+arena_adopt(struct arena *a, struct arena *from);
+
+void *
+arena_grow(struct arena *a, size_t size);
+
+// Allocate `size` bytes, aligned for any of the AST's member types
+static inline void *
+arena_alloc(struct arena *a, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    if (size > (size_t)(a->end - a->next)) return arena_grow(a, size);
+    void *p = a->next;
+    a->next += size;
+    a->used += size;
+    return p;
+}
+
+#endif
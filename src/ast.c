@@ -5,6 +5,7 @@
 #include "kvec.h"
 
 #include "ast.h"
+#include "intern.h"
 #include "lex.h"
 
 /*
@@ -16,41 +17,44 @@ char *lilc_node_str[] = {
   [LILC_NODE_IF] = "if",
 };
 
-lilc_node_vec_t *
-lilc_node_vec_new(void) {
-    lilc_node_vec_t *vec = (lilc_node_vec_t *)malloc(sizeof(lilc_node_vec_t));
-    kv_init(*vec);
-    return vec;
-}
-
 struct lilc_dbl_node_t *
-lilc_dbl_node_new(double val) {
-    struct lilc_dbl_node_t *node = malloc(sizeof(struct lilc_dbl_node_t));
+lilc_dbl_node_new(struct arena *a, double val) {
+    struct lilc_dbl_node_t *node = arena_alloc(a, sizeof(struct lilc_dbl_node_t));
     node->base.type = LILC_NODE_DBL;
+    node->base.offset = 0;
     node->val = val;
     return node;
 };
 
+// Copies `stmts` into the arena
 struct lilc_block_node_t *
-lilc_block_node_new(lilc_node_vec_t *stmts) {
-    struct lilc_block_node_t *node = malloc(sizeof(struct lilc_block_node_t));
+lilc_block_node_new(struct arena *a, struct lilc_node_t **stmts, unsigned int stmt_count) {
+    struct lilc_block_node_t *node = arena_alloc(a, sizeof(struct lilc_block_node_t));
     node->base.type = LILC_NODE_BLOCK;
-    node->stmts = stmts;
+    node->base.offset = 0;
+    node->stmts = arena_alloc(a, sizeof(struct lilc_node_t *) * stmt_count);
+    for(int i = 0; i < stmt_count; i++) {
+        node->stmts[i] = stmts[i];
+    }
+    node->stmt_count = stmt_count;
     return node;
 };
 
 struct lilc_var_node_t *
-lilc_var_node_new(char *name) {
-    struct lilc_var_node_t *node = malloc(sizeof(struct lilc_var_node_t));
+lilc_var_node_new(struct arena *a, lilc_sym_t name) {
+    struct lilc_var_node_t *node = arena_alloc(a, sizeof(struct lilc_var_node_t));
     node->base.type = LILC_NODE_VAR;
+    node->base.offset = 0;
     node->name = name;
+    node->slot = LILC_UNRESOLVED;
     return node;
 }
 
 struct lilc_bin_op_node_t *
-lilc_bin_op_node_new(struct lilc_node_t *left, struct lilc_node_t *right, enum tok_type op) {
-    struct lilc_bin_op_node_t *node = malloc(sizeof(struct lilc_bin_op_node_t));
+lilc_bin_op_node_new(struct arena *a, struct lilc_node_t *left, struct lilc_node_t *right, enum tok_type op) {
+    struct lilc_bin_op_node_t *node = arena_alloc(a, sizeof(struct lilc_bin_op_node_t));
     node->base.type = LILC_NODE_OP_BIN;
+    node->base.offset = 0;
     node->op = op;
     node->left = left;
     node->right = right;
@@ -59,14 +63,15 @@ lilc_bin_op_node_new(struct lilc_node_t *left, struct lilc_node_t *right, enum t
 
 // TODO add a types array arg
 struct lilc_proto_node_t *
-lilc_proto_node_new(char *name, char **params, unsigned int param_count) {
-    struct lilc_proto_node_t *node = malloc(sizeof(struct lilc_proto_node_t));
+lilc_proto_node_new(struct arena *a, lilc_sym_t name, lilc_sym_t *params, unsigned int param_count) {
+    struct lilc_proto_node_t *node = arena_alloc(a, sizeof(struct lilc_proto_node_t));
     node->base.type = LILC_NODE_PROTO;
+    node->base.offset = 0;
     node->name = name;
     node->param_count = param_count;
 
-    // Copy params pointer array to heap
-    node->params = malloc(sizeof(char*) * param_count);
+    // Copy params array into the arena
+    node->params = arena_alloc(a, sizeof(lilc_sym_t) * param_count);
     for(int i = 0; i < param_count; i++) {
         node->params[i] = params[i];
     }
@@ -75,45 +80,313 @@ lilc_proto_node_new(char *name, char **params, unsigned int param_count) {
 };
 
 struct lilc_funcdef_node_t *
-lilc_funcdef_node_new(struct lilc_proto_node_t *proto, struct lilc_node_t *body) {
-    struct lilc_funcdef_node_t *node = malloc(sizeof(struct lilc_funcdef_node_t));
+lilc_funcdef_node_new(struct arena *a, struct lilc_proto_node_t *proto, struct lilc_node_t *body) {
+    struct lilc_funcdef_node_t *node = arena_alloc(a, sizeof(struct lilc_funcdef_node_t));
     node->base.type = LILC_NODE_FUNCDEF;
+    node->base.offset = 0;
     node->proto = proto;
     node->body = body;
+    node->body_tok = 0;
+    node->memo = 0;
     return node;
 }
 
 struct lilc_funccall_node_t *
-lilc_funccall_node_new(char *name, struct lilc_node_t **args, unsigned int arg_count) {
-    struct lilc_funccall_node_t *node = malloc(sizeof(struct lilc_funccall_node_t));
+lilc_funccall_node_new(struct arena *a, lilc_sym_t name, struct lilc_node_t **args, unsigned int arg_count) {
+    struct lilc_funccall_node_t *node = arena_alloc(a, sizeof(struct lilc_funccall_node_t));
     node->base.type = LILC_NODE_FUNCCALL;
+    node->base.offset = 0;
     node->name = name;
 
-    // Copy args pointer array to heap
-    node->args = malloc(sizeof(union lilc_ast_union_t) * arg_count);
+    // Copy args pointer array into the arena
+    node->args = arena_alloc(a, sizeof(struct lilc_node_t *) * arg_count);
     for(int i = 0; i < arg_count; i++) {
         node->args[i] = args[i];
     }
 
     node->arg_count = arg_count;
+    node->func = LILC_UNRESOLVED;
     return node;
 }
 
 struct lilc_if_node_t *
-lilc_if_node_new(struct lilc_node_t *cond, struct lilc_block_node_t *then_block) {
-    struct lilc_if_node_t *node = malloc(sizeof(struct lilc_if_node_t));
+lilc_if_node_new(struct arena *a, struct lilc_node_t *cond, struct lilc_block_node_t *then_block) {
+    struct lilc_if_node_t *node = arena_alloc(a, sizeof(struct lilc_if_node_t));
     node->base.type = LILC_NODE_IF;
+    node->base.offset = 0;
     node->cond = cond;
     node->then_block = then_block;
     node->else_block = NULL;
     return node;
 }
 
-// Read a formatted version of an AST into a buffer, returning the number of
-// bytes written.
+#define NODE_TABLE_INIT 256
+
+void
+node_table_init(struct node_table *t, struct arena *a) {
+    t->arena = a;
+    t->cap = NODE_TABLE_INIT;
+    t->count = 0;
+    t->slots = calloc(t->cap, sizeof(struct lilc_node_t *));
+    kv_init(t->live);
+}
+
+// Frees the table only; the nodes live on in its arena
+void
+node_table_free(struct node_table *t) {
+    free(t->slots);
+    t->slots = NULL;
+    kv_destroy(t->live);
+}
+
+static uint64_t
+mix(uint64_t h, uint64_t v) {
+    h = (h ^ v) * 0x9e3779b97f4a7c15u;
+    return h ^ (h >> 32);
+}
+
+// Hash of a pure node's contents. Children are already shared, so they
+// hash by identity.
+static uint64_t
+node_hash(const struct lilc_node_t *node) {
+    uint64_t h = mix(0, node->type);
+    switch (node->type) {
+        case LILC_NODE_DBL: {
+            uint64_t bits;
+            memcpy(&bits, &((struct lilc_dbl_node_t *)node)->val, sizeof(bits));
+            return mix(h, bits);
+        }
+        case LILC_NODE_VAR:
+            return mix(h, ((struct lilc_var_node_t *)node)->name);
+        case LILC_NODE_OP_BIN: {
+            const struct lilc_bin_op_node_t *n = (struct lilc_bin_op_node_t *)node;
+            h = mix(h, n->op);
+            h = mix(h, (uintptr_t)n->left);
+            return mix(h, (uintptr_t)n->right);
+        }
+        default:
+            return h;
+    }
+}
+
+// Doubles compare bitwise, so 0.0 and -0.0 stay apart and a NaN matches
+// itself.
+static int
+node_equal(const struct lilc_node_t *x, const struct lilc_node_t *y) {
+    if (x->type != y->type) return 0;
+    switch (x->type) {
+        case LILC_NODE_DBL:
+            return memcmp(&((struct lilc_dbl_node_t *)x)->val,
+                          &((struct lilc_dbl_node_t *)y)->val, sizeof(double)) == 0;
+        case LILC_NODE_VAR:
+            return ((struct lilc_var_node_t *)x)->name == ((struct lilc_var_node_t *)y)->name;
+        case LILC_NODE_OP_BIN: {
+            const struct lilc_bin_op_node_t *a = (struct lilc_bin_op_node_t *)x;
+            const struct lilc_bin_op_node_t *b = (struct lilc_bin_op_node_t *)y;
+            return a->op == b->op && a->left == b->left && a->right == b->right;
+        }
+        default:
+            return 0;
+    }
+}
+
+// Slot holding the node equal to `key`, or the empty slot where it goes
+static struct lilc_node_t **
+node_slot(struct node_table *t, const struct lilc_node_t *key) {
+    size_t i = node_hash(key) & (t->cap - 1);
+    while (t->slots[i] && !node_equal(t->slots[i], key)) {
+        i = (i + 1) & (t->cap - 1);
+    }
+    return &t->slots[i];
+}
+
+// The shared node equal to the one at `key`, which lives on the stack.
+// If there's none yet, `key` is copied into the arena to become it.
+static void *
+node_cons(struct node_table *t, const struct lilc_node_t *key, size_t size) {
+    struct lilc_node_t **slot = node_slot(t, key);
+    if (*slot) return *slot;
+
+    struct lilc_node_t *node = arena_alloc(t->arena, size);
+    memcpy(node, key, size);
+    *slot = node;
+    lilc_node_vec_push(t->live, node);
+    t->count++;
+
+    // Keep the load under a half
+    if (kv_size(t->live) * 2 > t->cap) {
+        struct lilc_node_t **old = t->slots;
+        size_t old_cap = t->cap;
+        t->cap *= 2;
+        t->slots = calloc(t->cap, sizeof(struct lilc_node_t *));
+        for (size_t i = 0; i < old_cap; i++) {
+            if (old[i]) *node_slot(t, old[i]) = old[i];
+        }
+        free(old);
+    }
+    return node;
+}
+
+// Forget the nodes built so far: later ones are never shared with them.
+// Takes time in proportion to the nodes forgotten, not the table size.
+void
+node_table_clear(struct node_table *t) {
+    // Find every slot first, as emptying one can cut off the probe
+    // sequence leading to another
+    size_t n = kv_size(t->live);
+    struct lilc_node_t ***slots = malloc(sizeof(struct lilc_node_t **) * n);
+    for (size_t i = 0; i < n; i++) {
+        slots[i] = node_slot(t, kv_A(t->live, i));
+    }
+    for (size_t i = 0; i < n; i++) {
+        *slots[i] = NULL;
+    }
+    free(slots);
+    kv_size(t->live) = 0;
+}
+
+struct lilc_dbl_node_t *
+lilc_dbl_node_cons(struct node_table *t, double val, uint32_t offset) {
+    struct lilc_dbl_node_t key = {{LILC_NODE_DBL, offset}, val};
+    return node_cons(t, &key.base, sizeof(key));
+}
+
+struct lilc_var_node_t *
+lilc_var_node_cons(struct node_table *t, lilc_sym_t name, uint32_t offset) {
+    struct lilc_var_node_t key = {{LILC_NODE_VAR, offset}, name, LILC_UNRESOLVED};
+    return node_cons(t, &key.base, sizeof(key));
+}
+
+struct lilc_bin_op_node_t *
+lilc_bin_op_node_cons(struct node_table *t, struct lilc_node_t *left, struct lilc_node_t *right,
+                      enum tok_type op, uint32_t offset) {
+    struct lilc_bin_op_node_t key = {{LILC_NODE_OP_BIN, offset}, left, right, op};
+    return node_cons(t, &key.base, sizeof(key));
+}
+
+// Child `i` of `node`, in the order they're walked, or NULL past the last
+struct lilc_node_t *
+ast_child(struct lilc_node_t *node, unsigned int i) {
+    switch (node->type) {
+        case LILC_NODE_BLOCK: {
+            struct lilc_block_node_t *n = (struct lilc_block_node_t *)node;
+            return i < n->stmt_count ? n->stmts[i] : NULL;
+        }
+        case LILC_NODE_OP_BIN: {
+            struct lilc_bin_op_node_t *n = (struct lilc_bin_op_node_t *)node;
+            return i == 0 ? n->left : i == 1 ? n->right : NULL;
+        }
+        case LILC_NODE_FUNCDEF: {
+            struct lilc_funcdef_node_t *n = (struct lilc_funcdef_node_t *)node;
+            return i == 0 ? (struct lilc_node_t *)n->proto : i == 1 ? n->body : NULL;
+        }
+        case LILC_NODE_FUNCCALL: {
+            struct lilc_funccall_node_t *n = (struct lilc_funccall_node_t *)node;
+            return i < n->arg_count ? n->args[i] : NULL;
+        }
+        case LILC_NODE_IF: {
+            struct lilc_if_node_t *n = (struct lilc_if_node_t *)node;
+            if (i == 0) return n->cond;
+            if (i == 1) return (struct lilc_node_t *)n->then_block;
+            if (i == 2) return (struct lilc_node_t *)n->else_block;
+            return NULL;
+        }
+        default:
+            return NULL;
+    }
+}
+
+// Replace child `i` of `node`, as numbered by `ast_child`. The blocks of
+// an if/else must be replaced with blocks.
+void
+ast_set_child(struct lilc_node_t *node, unsigned int i, struct lilc_node_t *child) {
+    switch (node->type) {
+        case LILC_NODE_BLOCK:
+            ((struct lilc_block_node_t *)node)->stmts[i] = child;
+            break;
+        case LILC_NODE_OP_BIN: {
+            struct lilc_bin_op_node_t *n = (struct lilc_bin_op_node_t *)node;
+            if (i == 0) n->left = child;
+            else n->right = child;
+            break;
+        }
+        case LILC_NODE_FUNCDEF: {
+            struct lilc_funcdef_node_t *n = (struct lilc_funcdef_node_t *)node;
+            if (i == 0) n->proto = (struct lilc_proto_node_t *)child;
+            else n->body = child;
+            break;
+        }
+        case LILC_NODE_FUNCCALL:
+            ((struct lilc_funccall_node_t *)node)->args[i] = child;
+            break;
+        case LILC_NODE_IF: {
+            struct lilc_if_node_t *n = (struct lilc_if_node_t *)node;
+            if (i == 0) n->cond = child;
+            else if (i == 1) n->then_block = (struct lilc_block_node_t *)child;
+            else n->else_block = (struct lilc_block_node_t *)child;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+struct walk_frame {
+    struct lilc_node_t *node;
+    unsigned int next;  // Index of the next child to visit
+};
+
+// Walk the tree at `root` with visitor `v`. Returns 0 once the walk is
+// complete, or -1 if a callback stopped it.
 int
-ast_readf(char *buf, int i, int indent, struct lilc_node_t *node) {
-    i += sprintf(buf + i, "%*s(", indent, "");
+ast_walk(struct lilc_node_t *root, struct ast_visitor *v) {
+    enum ast_walk_action act = v->enter ? v->enter(v, root) : AST_DESCEND;
+    if (act != AST_DESCEND) return act == AST_STOP ? -1 : 0;
+
+    kvec_t(struct walk_frame) stack;
+    kv_init(stack);
+    struct walk_frame top = {root, 0};
+    kv_push(struct walk_frame, stack, top);
+
+    while (kv_size(stack)) {
+        struct walk_frame *f = &kv_A(stack, kv_size(stack) - 1);
+        struct lilc_node_t *node = f->node;
+        unsigned int i = f->next++;
+        struct lilc_node_t *child = ast_child(node, i);
+
+        if (!child) {
+            act = v->leave ? v->leave(v, node) : AST_DESCEND;
+            kv_size(stack)--;
+        } else {
+            act = v->child ? v->child(v, node, i) : AST_DESCEND;
+            if (act == AST_DESCEND) {
+                act = v->enter ? v->enter(v, child) : AST_DESCEND;
+                if (act == AST_DESCEND) {
+                    struct walk_frame c = {child, 0};
+                    kv_push(struct walk_frame, stack, c);
+                }
+            }
+        }
+        if (act == AST_STOP) break;
+    }
+
+    kv_destroy(stack);
+    return act == AST_STOP ? -1 : 0;
+}
+
+struct printer {
+    struct ast_visitor v;
+    char *buf;
+    int i;
+    int indent;
+};
+
+static enum ast_walk_action
+print_enter(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct printer *p = (struct printer *)v;
+    char *buf = p->buf;
+    int i = p->i;
+    i += sprintf(buf + i, "%*s(", p->indent, "");
     switch (node->type) {
         case LILC_NODE_DBL: {
             struct lilc_dbl_node_t *n = (struct lilc_dbl_node_t *)node;
@@ -121,47 +394,35 @@ ast_readf(char *buf, int i, int indent, struct lilc_node_t *node) {
             i += sprintf(buf + i, "%.1f", n->val);
             break;
         }
-        case LILC_NODE_BLOCK: {
-            struct lilc_block_node_t *n = (struct lilc_block_node_t *)node;
+        case LILC_NODE_BLOCK:
             i += sprintf(buf + i, "block");
-            for (int j = 0; j < kv_size(*n->stmts); j++) {
-                i += sprintf(buf + i, "\n");
-                i = ast_readf(buf, i, indent + 2, kv_A(*n->stmts, j));
-            }
             break;
-        }
         case LILC_NODE_VAR: {
             struct lilc_var_node_t *n = (struct lilc_var_node_t *)node;
             i += sprintf(buf + i, "var ");
-            i += sprintf(buf + i, "%s", n->name);
+            i += sprintf(buf + i, "%s", lilc_sym_str(n->name));
             break;
         }
         case LILC_NODE_OP_BIN: {
             struct lilc_bin_op_node_t *n = (struct lilc_bin_op_node_t *)node;
             i += sprintf(buf + i, "%s", lilc_token_str[n->op]);
-            i += sprintf(buf + i, "\n");
-            i = ast_readf(buf, i, indent + 2, n->left);
-            i += sprintf(buf + i, "\n");
-            i = ast_readf(buf, i, indent + 2, n->right);
             break;
         }
-        case LILC_NODE_FUNCDEF: {
-            struct lilc_funcdef_node_t *n = (struct lilc_funcdef_node_t *)node;
-            i += sprintf(buf + i, "%s", lilc_node_str[n->base.type]);
-            i += sprintf(buf + i, "\n");
-            i = ast_readf(buf, i, indent + 2, n->proto);
-            i += sprintf(buf + i, "\n");
-            i = ast_readf(buf, i, indent + 2, n->body);
+        case LILC_NODE_FUNCDEF:
+            i += sprintf(buf + i, "%s", lilc_node_str[node->type]);
+            if (((struct lilc_funcdef_node_t *)node)->memo) i += sprintf(buf + i, " @memo");
+            break;
+        case LILC_NODE_IF:
+            i += sprintf(buf + i, "%s", lilc_node_str[node->type]);
             break;
-        }
         case LILC_NODE_PROTO: {
             struct lilc_proto_node_t *n = (struct lilc_proto_node_t *)node;
-            i += sprintf(buf + i, "%s", n->name);
+            i += sprintf(buf + i, "%s", lilc_sym_str(n->name));
             // Param list
             i += sprintf(buf + i, "[");
             if (n->param_count > 0) {
                 for (int j = 0; j < n->param_count; j++) {
-                    i += sprintf(buf + i, "%s,", n->params[j]);
+                    i += sprintf(buf + i, "%s,", lilc_sym_str(n->params[j]));
                 }
                 i--;  // Delete trailing comma
             }
@@ -170,30 +431,41 @@ ast_readf(char *buf, int i, int indent, struct lilc_node_t *node) {
         }
         case LILC_NODE_FUNCCALL: {
             struct lilc_funccall_node_t *n = (struct lilc_funccall_node_t *)node;
-            i += sprintf(buf + i, "call %s", n->name);
-            for (int j = 0; j < n->arg_count; j++) {
-                i += sprintf(buf + i, "\n");
-                i = ast_readf(buf, i, indent + 2, n->args[j]);
-            }
-            break;
-        }
-        case LILC_NODE_IF: {
-            struct lilc_if_node_t *n = (struct lilc_if_node_t *)node;
-            i += sprintf(buf + i, "%s", lilc_node_str[n->base.type]);
-            i += sprintf(buf + i, "\n");
-            i = ast_readf(buf, i, indent + 2, n->cond);
-            i += sprintf(buf + i, "\n");
-            i = ast_readf(buf, i, indent + 2, n->then_block);
-            if (n->else_block) {
-                i += sprintf(buf + i, " else");
-                i += sprintf(buf + i, "\n");
-                i = ast_readf(buf, i, indent + 2, n->else_block);
-            }
+            i += sprintf(buf + i, "call %s", lilc_sym_str(n->name));
             break;
         }
         default:
             i += sprintf(buf + i, "Unknown: %d", node->type);
     }
-    i += sprintf(buf + i, ")");
-    return i;
-}
\ No newline at end of file
+    p->i = i;
+    p->indent += 2;
+    return AST_DESCEND;
+}
+
+// Children go on lines of their own, below their parent
+static enum ast_walk_action
+print_child(struct ast_visitor *v, struct lilc_node_t *node, unsigned int i) {
+    struct printer *p = (struct printer *)v;
+    if (node->type == LILC_NODE_IF && i == 2) {
+        p->i += sprintf(p->buf + p->i, " else");
+    }
+    p->i += sprintf(p->buf + p->i, "\n");
+    return AST_DESCEND;
+}
+
+static enum ast_walk_action
+print_leave(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct printer *p = (struct printer *)v;
+    p->indent -= 2;
+    p->i += sprintf(p->buf + p->i, ")");
+    return AST_DESCEND;
+}
+
+// Read a formatted version of an AST into a buffer, returning the number of
+// bytes written.
+int
+ast_readf(char *buf, int i, int indent, struct lilc_node_t *node) {
+    struct printer p = {{print_enter, print_child, print_leave}, buf, i, indent};
+    ast_walk(node, &p.v);
+    return p.i;
+}
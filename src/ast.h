@@ -1,8 +1,12 @@
 #ifndef LILC_AST_H
 #define LILC_AST_H
 
+#include <stdint.h>
+
 #include "kvec.h"
 
+#include "arena.h"
+#include "intern.h"
 #include "token.h"
 
 enum node_type {
@@ -17,28 +21,32 @@ enum node_type {
 };
 
 /*
- * Dynamic array of AST nodes
+ * Dynamic array of AST nodes, used while collecting a node's children.
+ * Nodes themselves hold plain arrays.
  */
 typedef kvec_t(struct lilc_node_t *) lilc_node_vec_t;
 
-lilc_node_vec_t *
-lilc_node_vec_new(void);
-
 #define lilc_node_vec_push(vec, node) kv_push(struct lilc_node_t *, vec, node)
 
 /*
- * Containers for each node type
+ * Containers for each node type. Nodes, and the arrays they point to,
+ * are allocated from an arena and freed with it.
  */
 
+// Variables and calls not yet resolved to what they name, see resolve.h
+#define LILC_UNRESOLVED UINT32_MAX
+
 // Base data shared by all nodes
 struct lilc_node_t {
     enum node_type type;
+    uint32_t offset;  // Where in the source the node starts, see loc.h
 };
 
 // Block node
 struct lilc_block_node_t {
     struct lilc_node_t base;
-    lilc_node_vec_t *stmts;
+    struct lilc_node_t **stmts;
+    unsigned int stmt_count;
 };
 
 // Double immediate node
@@ -50,7 +58,8 @@ struct lilc_dbl_node_t {
 // Variable expression node
 struct lilc_var_node_t {
     struct lilc_node_t base;
-    char *name;
+    lilc_sym_t name;
+    uint32_t slot;  // Index of the parameter it names
 };
 
 // Binary operation node
@@ -64,24 +73,28 @@ struct lilc_bin_op_node_t {
 // Function prototype node
 struct lilc_proto_node_t {
     struct lilc_node_t base;
-    char *name;
-    char **params;
+    lilc_sym_t name;
+    lilc_sym_t *params;
     unsigned int param_count;
 };
 
-// Function declaration node
+// Function declaration node. Parsing lazily, the body is left NULL until
+// it's needed, see parse_body.
 struct lilc_funcdef_node_t {
     struct lilc_node_t base;
     struct lilc_proto_node_t *proto;
     struct lilc_node_t *body;
+    uint32_t body_tok;  // Token the body starts at, past its '{'
+    int memo;           // Cache its results, see memo.h
 };
 
 // Function call node
 struct lilc_funccall_node_t {
     struct lilc_node_t base;
-    char *name;
+    lilc_sym_t name;
     struct lilc_node_t **args;
     unsigned int arg_count;
+    uint32_t func;  // Index of the function it calls, by order of definition
 };
 
 // If / else if / else node
@@ -92,47 +105,102 @@ struct lilc_if_node_t {
     struct lilc_block_node_t *else_block;
 };
 
-// Union struct--ends up being the width of the largest
-// member. Only used in places where you need to allocate
-// space for an AST node whose type you don't know in advance
-// (e.g. funccall_node_new) and thus need to allocate enough
-// space to fit the largest possible node type.
-union lilc_ast_union_t {
-    struct lilc_block_node_t a;
-    struct lilc_dbl_node_t b;
-    struct lilc_var_node_t c;
-    struct lilc_bin_op_node_t d;
-    struct lilc_proto_node_t e;
-    struct lilc_funcdef_node_t f;
-    struct lilc_funccall_node_t g;
-};
-
 /*
  *Constructors
  */
 struct lilc_dbl_node_t *
-lilc_dbl_node_new(double val);
+lilc_dbl_node_new(struct arena *a, double val);
 
 struct lilc_block_node_t *
-lilc_block_node_new(lilc_node_vec_t *stmts);
+lilc_block_node_new(struct arena *a, struct lilc_node_t **stmts, unsigned int stmt_count);
 
 struct lilc_var_node_t *
-lilc_var_node_new(char *name);
+lilc_var_node_new(struct arena *a, lilc_sym_t name);
 
 struct lilc_bin_op_node_t *
-lilc_bin_op_node_new(struct lilc_node_t *left, struct lilc_node_t *right, enum tok_type op);
+lilc_bin_op_node_new(struct arena *a, struct lilc_node_t *left, struct lilc_node_t *right, enum tok_type op);
 
 struct lilc_proto_node_t *
-lilc_proto_node_new(char *name, char **params, unsigned int param_count);
+lilc_proto_node_new(struct arena *a, lilc_sym_t name, lilc_sym_t *params, unsigned int param_count);
 
 struct lilc_funcdef_node_t *
-lilc_funcdef_node_new(struct lilc_proto_node_t *proto, struct lilc_node_t *body);
+lilc_funcdef_node_new(struct arena *a, struct lilc_proto_node_t *proto, struct lilc_node_t *body);
 
 struct lilc_funccall_node_t *
-lilc_funccall_node_new(char *name, struct lilc_node_t **args, unsigned int arg_count);
+lilc_funccall_node_new(struct arena *a, lilc_sym_t name, struct lilc_node_t **args, unsigned int arg_count);
 
 struct lilc_if_node_t *
-lilc_if_node_new(struct lilc_node_t *cond, struct lilc_block_node_t *then_block);
+lilc_if_node_new(struct arena *a, struct lilc_node_t *cond, struct lilc_block_node_t *then_block);
+
+/*
+ * Hash-consing. Pure expression nodes (constants, variables and binary
+ * operations on them) built through a node table are shared: asking for
+ * a node structurally identical to one built before returns that node.
+ * A shared node keeps the source offset it was first built with.
+ *
+ * A variable can name a different parameter in each function, so the
+ * parser clears the table at each function definition, and nodes are
+ * only ever shared within one.
+ */
+struct node_table {
+    struct arena *arena;       // Where new nodes are allocated
+    struct lilc_node_t **slots;
+    size_t cap;                // Always a power of two
+    size_t count;              // Nodes built through the table in all
+    lilc_node_vec_t live;      // Nodes in it now
+};
+
+void
+node_table_init(struct node_table *t, struct arena *a);
+
+void
+node_table_free(struct node_table *t);
+
+void
+node_table_clear(struct node_table *t);
+
+struct lilc_dbl_node_t *
+lilc_dbl_node_cons(struct node_table *t, double val, uint32_t offset);
+
+struct lilc_var_node_t *
+lilc_var_node_cons(struct node_table *t, lilc_sym_t name, uint32_t offset);
+
+struct lilc_bin_op_node_t *
+lilc_bin_op_node_cons(struct node_table *t, struct lilc_node_t *left, struct lilc_node_t *right,
+                      enum tok_type op, uint32_t offset);
+
+/*
+ * Iterative traversal. `ast_walk` goes depth first through the tree at
+ * `root`, keeping its place on a heap-allocated stack instead of the C
+ * stack, so trees of any depth can be walked. Each node is entered on the
+ * way down, each of its children is announced just before it's visited,
+ * and the node is left once they're all done. Any callback may be NULL.
+ *
+ * Visitors carry their own state by embedding `struct ast_visitor` as
+ * their first member.
+ */
+enum ast_walk_action {
+    AST_DESCEND,  // Carry on into the node or child
+    AST_SKIP,     // Pass over it: from `enter`, the node is never left
+    AST_STOP,     // End the walk
+};
+
+struct ast_visitor {
+    enum ast_walk_action (*enter)(struct ast_visitor *v, struct lilc_node_t *node);
+    enum ast_walk_action (*child)(struct ast_visitor *v, struct lilc_node_t *node, unsigned int i);
+    enum ast_walk_action (*leave)(struct ast_visitor *v, struct lilc_node_t *node);
+};
+
+struct lilc_node_t *
+ast_child(struct lilc_node_t *node, unsigned int i);
+
+void
+ast_set_child(struct lilc_node_t *node, unsigned int i, struct lilc_node_t *child);
+
+int
+ast_walk(struct lilc_node_t *root, struct ast_visitor *v);
+
+extern char *lilc_node_str[];
 
 int
 ast_readf(char *buf, int i, int indent, struct lilc_node_t *node);
@@ -8,22 +8,153 @@
 #include <llvm-c/Types.h>
 #include <llvm-c/Transforms/Scalar.h>
 
-#include "cfuhash.h"
 #include "kvec.h"
 
 #include "ast.h"
 #include "codegen.h"
+#include "flat.h"
+#include "intern.h"
+#include "memo.h"
+#include "symtab.h"
 #include "token.h"
 
-// Forward declaration
+// Values already built for shared expression nodes (see `node_table`),
+// by node. A value can only be reused in code its block dominates, so
+// entries are logged as they're added, and rolled back on leaving the
+// branch of an if/else that built them.
+struct cached_val {
+    const void *node;
+    LLVMValueRef val;  // NULL once rolled back
+};
+
+struct value_cache {
+    struct cached_val *slots;
+    size_t cap;                 // Always a power of two
+    size_t count;               // Slots with a node, rolled back or not
+    kvec_t(const void *) log;   // Nodes with a value, in the order added
+};
+
+// Codegen state for the function being generated. Its parameters are
+// kept in order, so a resolved variable's slot indexes them directly.
+// Flat ASTs aren't resolved: their variables are bound to slots in
+// `names` instead, by the tree's own name indices.
+struct scope {
+    kvec_t(LLVMValueRef) params;
+    struct symtab names;
+    struct value_cache cache;
+};
+
+// Generates code for the tree at `root` into `module`
+typedef LLVMValueRef (*gen_fn)(const void *root, LLVMModuleRef module,
+                               LLVMBuilderRef builder, struct scope *scope);
+
+// Forward declarations
 static LLVMValueRef
-do_codegen(struct lilc_node_t *node, LLVMModuleRef module, LLVMBuilderRef builder,
-           cfuhash_table_t *named_vals);
+gen_tree(const void *root, LLVMModuleRef module, LLVMBuilderRef builder,
+         struct scope *scope);
+static LLVMValueRef
+gen_flat(const void *root, LLVMModuleRef module, LLVMBuilderRef builder,
+         struct scope *scope);
+static LLVMValueRef
+emit_proto(LLVMModuleRef module, const char *name, unsigned int param_count,
+           struct scope *scope);
+static void
+emit_func_begin(LLVMBuilderRef builder, LLVMValueRef func);
+static LLVMValueRef
+emit_func_end(LLVMModuleRef module, LLVMBuilderRef builder, LLVMValueRef func,
+              LLVMValueRef body);
 
 
-// JIT an AST and return its result
-double
-lilc_eval(struct lilc_node_t *node) {
+#define VALUE_CACHE_INIT 64
+
+static void
+scope_init(struct scope *scope) {
+    kv_init(scope->params);
+    symtab_init(&scope->names);
+    scope->cache.cap = VALUE_CACHE_INIT;
+    scope->cache.count = 0;
+    scope->cache.slots = calloc(VALUE_CACHE_INIT, sizeof(struct cached_val));
+    kv_init(scope->cache.log);
+}
+
+static void
+scope_free(struct scope *scope) {
+    kv_destroy(scope->params);
+    symtab_free(&scope->names);
+    free(scope->cache.slots);
+    kv_destroy(scope->cache.log);
+}
+
+// Slot for `node`, or the empty one where it goes
+static struct cached_val *
+cache_slot(struct value_cache *c, const void *node) {
+    uint64_t h = ((uintptr_t)node >> 3) * 0x9e3779b97f4a7c15u;
+    size_t i = (h ^ (h >> 32)) & (c->cap - 1);
+    while (c->slots[i].node && c->slots[i].node != node) {
+        i = (i + 1) & (c->cap - 1);
+    }
+    return &c->slots[i];
+}
+
+static LLVMValueRef
+cache_get(struct value_cache *c, const void *node) {
+    return cache_slot(c, node)->val;
+}
+
+static void
+cache_put(struct value_cache *c, const void *node, LLVMValueRef val) {
+    struct cached_val *slot = cache_slot(c, node);
+    if (!slot->node) {
+        slot->node = node;
+        c->count++;
+    }
+    slot->val = val;
+    kv_push(const void *, c->log, node);
+
+    // Keep the load under a half, dropping rolled back entries
+    if (c->count * 2 > c->cap) {
+        struct cached_val *old = c->slots;
+        size_t old_cap = c->cap;
+        if (kv_size(c->log) * 4 > c->cap) c->cap *= 2;
+        c->slots = calloc(c->cap, sizeof(struct cached_val));
+        c->count = 0;
+        for (size_t i = 0; i < old_cap; i++) {
+            if (old[i].val) {
+                *cache_slot(c, old[i].node) = old[i];
+                c->count++;
+            }
+        }
+        free(old);
+    }
+}
+
+// Forget values added since the log was `mark` long
+static void
+cache_rollback(struct value_cache *c, size_t mark) {
+    while (kv_size(c->log) > mark) {
+        cache_slot(c, kv_pop(c->log))->val = NULL;
+    }
+}
+
+// Read back what the caches of the memoized functions in `module` did
+static void
+read_memo_stats(LLVMModuleRef module, LLVMExecutionEngineRef engine, memo_stats_t *stats) {
+    for (LLVMValueRef f = LLVMGetFirstFunction(module); f; f = LLVMGetNextFunction(f)) {
+        size_t len;
+        const char *name = LLVMGetValueName2(f, &len);
+        char buf[len + sizeof(".memo")];
+        snprintf(buf, sizeof(buf), "%s.memo", name);
+        if (!LLVMGetNamedGlobal(module, buf)) continue;
+        const uint64_t *counts = (const uint64_t *)LLVMGetGlobalValueAddress(engine, buf);
+        struct memo_stats s = {lilc_intern(name, len), counts[0], counts[1], counts[2]};
+        kv_push(struct memo_stats, *stats, s);
+    }
+}
+
+// JIT an AST, generated by `gen`, and return its result. Given `stats`,
+// what the caches of memoized functions did is added to it.
+static double
+eval(gen_fn gen, const void *root, memo_stats_t *stats) {
     // LLVM setup
     // Contains functions and global vars. Top-level structure
     // to contain any generated IR.
@@ -50,12 +181,14 @@ lilc_eval(struct lilc_node_t *node) {
     }
 
     // Walk AST and generate code
-    // named_vals keeps track of which values are defined in the current
-    // scope and what their LLVM representations are. Basically a symbol table.
-    // Currently, this will only store function parameters--to be accessed when
-    // generating code for a function body.
-    cfuhash_table_t *named_vals = cfuhash_new_with_initial_size(64);
-    LLVMValueRef val = do_codegen(node, module, builder, named_vals);
+    // scope keeps track of which values are defined in the current
+    // function and what their LLVM representations are. Basically a symbol
+    // table. Currently, this will only store function parameters--to be
+    // accessed when generating code for a function body.
+    struct scope scope;
+    scope_init(&scope);
+    LLVMValueRef val = gen(root, module, builder, &scope);
+    scope_free(&scope);
     if (!val) {
         fprintf(stderr, "\nEval failed. Exiting.\n");
         exit(1);
@@ -72,6 +205,7 @@ lilc_eval(struct lilc_node_t *node) {
     }
     LLVMGenericValueRef eval = LLVMRunFunction(engine, main_func, 0, NULL);
     double result = (double)LLVMGenericValueToFloat(LLVMDoubleType(), eval);
+    if (stats) read_memo_stats(module, engine, stats);
 
     // Print IR
     fprintf(stderr, "Module Dump: \n");
@@ -84,9 +218,30 @@ lilc_eval(struct lilc_node_t *node) {
     return result;
 }
 
-// Emit a native object file at `path`, given an AST
-void
-lilc_emit(struct lilc_node_t *node, char *path) {
+// JIT an AST and return its result
+double
+lilc_eval(struct lilc_node_t *node) {
+    return eval(gen_tree, node, NULL);
+}
+
+// JIT an AST and return its result, adding to `stats` what the caches of
+// its memoized functions did, see memo.h
+double
+lilc_eval_stats(struct lilc_node_t *node, memo_stats_t *stats) {
+    return eval(gen_tree, node, stats);
+}
+
+// JIT a flat AST and return its result
+double
+lilc_eval_flat(const struct flat_ast *f) {
+    return eval(gen_flat, f, NULL);
+}
+
+// Emit a native object file at `path`, given an AST generated by `gen`.
+// With `ir` set, write the module's textual IR there instead, skipping
+// the backend.
+static void
+emit(gen_fn gen, const void *root, char *path, int ir) {
     // LLVM setup
     LLVMModuleRef module = LLVMModuleCreateWithName("lilc");
     LLVMBuilderRef builder = LLVMCreateBuilder();
@@ -96,19 +251,22 @@ lilc_emit(struct lilc_node_t *node, char *path) {
     LLVMInitializeAllAsmParsers();
     LLVMInitializeAllAsmPrinters();
 
-    // Wrap provided node in a top-level 'main' function, if user hasn't.
+    // Walk AST and generate code, wrapped in a top-level 'main' function
+    // as if the user had written one around it.
     // TODO: require user to provide a main function,
     // once function definitions are implemented in the frontend
-    struct lilc_proto_node_t *proto = lilc_proto_node_new("main", NULL, 0);
-    node = (struct lilc_node_t *)lilc_funcdef_node_new(proto, node);
-
-    // Walk AST and generate code
-    // named_vals keeps track of which values are defined in the current
-    // scope and what their LLVM representations are. Basically a symbol table.
-    // Currently, this will only store function parameters--to be accessed when
-    // generating code for a function body.
-    cfuhash_table_t *named_vals = cfuhash_new_with_initial_size(64);
-    LLVMValueRef val = do_codegen(node, module, builder, named_vals);
+    // scope keeps track of which values are defined in the current
+    // function and what their LLVM representations are. Basically a symbol
+    // table. Currently, this will only store function parameters--to be
+    // accessed when generating code for a function body.
+    struct scope scope;
+    scope_init(&scope);
+    LLVMValueRef val = emit_proto(module, "main", 0, &scope);
+    if (val) {
+        emit_func_begin(builder, val);
+        val = emit_func_end(module, builder, val, gen(root, module, builder, &scope));
+    }
+    scope_free(&scope);
     if (!val) {
         fprintf(stderr, "\nEmit Failed. Exiting.\n");
         exit(1);
@@ -122,6 +280,14 @@ lilc_emit(struct lilc_node_t *node, char *path) {
     LLVMTargetRef target;
     LLVMBool rc;
     char *triple, *err;
+    if (ir) {
+        if (LLVMPrintModuleToFile(module, path, &err)) {
+            fprintf(stderr, "Could not emit IR file: %s\n", err);
+        }
+        LLVMDisposeBuilder(builder);
+        LLVMDisposeModule(module);
+        return;
+    }
     triple = LLVMGetDefaultTargetTriple();
     rc = LLVMGetTargetFromTriple(triple, &target, &err);
     if (rc) {
@@ -158,45 +324,47 @@ lilc_emit(struct lilc_node_t *node, char *path) {
     LLVMDisposeModule(module);
 }
 
-static LLVMValueRef
-codegen_dbl(struct lilc_dbl_node_t *node) {
-    return LLVMConstReal(LLVMDoubleType(), node->val);
+// Emit a native object file at `path`, given an AST
+void
+lilc_emit(struct lilc_node_t *node, char *path) {
+    emit(gen_tree, node, path, 0);
 }
 
-static LLVMValueRef
-codegen_var(struct lilc_var_node_t *node, cfuhash_table_t *named_vals) {
-    LLVMValueRef val = cfuhash_get(named_vals, node->name);
-    return val;
+// Emit a native object file at `path`, given a flat AST
+void
+lilc_emit_flat(const struct flat_ast *f, char *path) {
+    emit(gen_flat, f, path, 0);
 }
 
-// Currently, blocks evaluate to the value of the last statement within
-// them. Not sure how that will end up interacting with the 'return'
-// keyword if I end up implementing that but I'll come back to it later.
-// TODO: Implement block-scoping
-static LLVMValueRef
-codegen_block(struct lilc_block_node_t *node, LLVMModuleRef module,
-              LLVMBuilderRef builder, cfuhash_table_t *named_vals) {
-    LLVMValueRef val;
-    for (int i = 0; i < kv_size(*node->stmts); i++) {
-        val = do_codegen(kv_A(*node->stmts, i), module, builder, named_vals);
-        if (!val) {
-            return NULL;
-        }
-    }
-    return val;
+// Write the LLVM IR for an AST to `path`
+void
+lilc_emit_ir(struct lilc_node_t *node, char *path) {
+    emit(gen_tree, node, path, 1);
+}
+
+// Write the LLVM IR for a flat AST to `path`
+void
+lilc_emit_ir_flat(const struct flat_ast *f, char *path) {
+    emit(gen_flat, f, path, 1);
 }
 
+/*
+ * IR emitters shared by the pointer and flat AST walkers. Each builds
+ * the code for one construct once its operands have been generated.
+ */
+
 static LLVMValueRef
-codegen_binop(struct lilc_bin_op_node_t *node, LLVMModuleRef module,
-              LLVMBuilderRef builder, cfuhash_table_t *named_vals) {
-    LLVMValueRef lhs = do_codegen(node->left, module, builder, named_vals);
-    LLVMValueRef rhs = do_codegen(node->right, module, builder, named_vals);
+param(struct scope *scope, uint32_t slot) {
+    return slot < kv_size(scope->params) ? kv_A(scope->params, slot) : NULL;
+}
 
+static LLVMValueRef
+emit_binop(LLVMBuilderRef builder, enum tok_type op, LLVMValueRef lhs, LLVMValueRef rhs) {
     if(lhs == NULL || rhs == NULL) {
         return NULL;
     }
 
-    switch(node->op) {
+    switch(op) {
         case LILC_TOK_ADD: {
             // names like "addtmp" are just a hint here--
             // LLVM appends an auto-incrementing suffix if the
@@ -218,18 +386,25 @@ codegen_binop(struct lilc_bin_op_node_t *node, LLVMModuleRef module,
             // 1.0 or 0.0 because Lilc doesn't have a bool type just yet.
             return LLVMBuildUIToFP(builder, cmp_result, LLVMDoubleType(), "boolcasttmp");
         }
+        default:
+            return NULL;
     }
-    return NULL;
 }
 
+// Declare function `name` taking `param_count` doubles, or reuse an
+// existing, bodiless declaration of it. Starts a new scope for its
+// parameters, which the caller binds with `bind_param`.
 static LLVMValueRef
-codegen_proto(struct lilc_proto_node_t *node, LLVMModuleRef module,
-              cfuhash_table_t *named_vals) {
+emit_proto(LLVMModuleRef module, const char *name, unsigned int param_count,
+           struct scope *scope) {
+    kv_size(scope->params) = 0;  // New scope
+    cache_rollback(&scope->cache, 0);
+
     // Use an existing definition if one exists.
-    LLVMValueRef func = LLVMGetNamedFunction(module, node->name);
+    LLVMValueRef func = LLVMGetNamedFunction(module, name);
     if(func != NULL) {
         // Verify parameter count matches.
-        if(LLVMCountParams(func) != node->param_count) {
+        if(LLVMCountParams(func) != param_count) {
             fprintf(stderr, "Existing function exists with different parameter count\n");
             return NULL;
         }
@@ -240,47 +415,42 @@ codegen_proto(struct lilc_proto_node_t *node, LLVMModuleRef module,
         }
     } else {
         // Create parameter list.
-        LLVMTypeRef *params = malloc(sizeof(LLVMTypeRef) * node->param_count);
-        for (int i = 0; i < node->param_count; i++) {
+        LLVMTypeRef *params = malloc(sizeof(LLVMTypeRef) * param_count);
+        for (int i = 0; i < param_count; i++) {
             params[i] = LLVMDoubleType();  // TODO Look up types on the proto node?
         }
         // Create function type.
-        LLVMTypeRef funcType = LLVMFunctionType(LLVMDoubleType(), params, node->param_count, 0);
+        LLVMTypeRef funcType = LLVMFunctionType(LLVMDoubleType(), params, param_count, 0);
+        free(params);
         // Create function.
-        func = LLVMAddFunction(module, node->name, funcType);
+        func = LLVMAddFunction(module, name, funcType);
         LLVMSetLinkage(func, LLVMExternalLinkage);
     }
-
-    // Assign parameters to named values lookup.
-    for (int i = 0; i < node->param_count; i++) {
-        // Not necessay, but results in more readable IR,
-        // and allows for later arg lookup by name
-        LLVMValueRef param = LLVMGetParam(func, i);
-        LLVMSetValueName(param, node->params[i]);
-        cfuhash_put(named_vals, node->params[i], param);
-    }
-
     return func;
 }
 
-static LLVMValueRef
-codegen_funcdef(struct lilc_funcdef_node_t *node, LLVMModuleRef module,
-                LLVMBuilderRef builder, cfuhash_table_t *named_vals) {
-    cfuhash_clear(named_vals);  // New scope
-
-    // Codegen prototype
-    LLVMValueRef func = do_codegen((struct lilc_node_t *)node->proto, module, builder, named_vals);
-    if(func == NULL) {
-        return NULL;
-    }
+// Add parameter `i` of `func` to the scope, as slot `i`
+static void
+bind_param(LLVMValueRef func, unsigned int i, const char *str, struct scope *scope) {
+    // Not necessay, but results in more readable IR
+    LLVMValueRef param = LLVMGetParam(func, i);
+    LLVMSetValueName(param, str);
+    kv_push(LLVMValueRef, scope->params, param);
+}
 
+// Start generating the body of `func`
+static void
+emit_func_begin(LLVMBuilderRef builder, LLVMValueRef func) {
     // Append a new basic block at the end of the function, named "entry"
     LLVMBasicBlockRef block = LLVMAppendBasicBlock(func, "entry");
     // Tell builder insert new instructions at the end of our new basic block
     LLVMPositionBuilderAtEnd(builder, block);
+}
 
-    // Codegen body
-    LLVMValueRef body = do_codegen(node->body, module, builder, named_vals);
+// Finish `func`, returning `body`'s value, and verify it
+static LLVMValueRef
+emit_func_end(LLVMModuleRef module, LLVMBuilderRef builder, LLVMValueRef func,
+              LLVMValueRef body) {
     if(body == NULL) {
         LLVMDeleteFunction(func);
         return NULL;
@@ -300,39 +470,30 @@ codegen_funcdef(struct lilc_funcdef_node_t *node, LLVMModuleRef module,
     return func;
 }
 
+// Check function `func` takes `arg_count` args
 static LLVMValueRef
-codegen_funccall(struct lilc_funccall_node_t *node, LLVMModuleRef module,
-                LLVMBuilderRef builder, cfuhash_table_t *named_vals) {
-    // Retrieve function and check signature
-    LLVMValueRef func = LLVMGetNamedFunction(module, node->name);
+callee(LLVMValueRef func, unsigned int arg_count) {
     if(func == NULL) {
         // Function used before declared
         return NULL;
     }
-    if (LLVMCountParams(func) != node->arg_count) {
+    if (LLVMCountParams(func) != arg_count) {
         // Wrong number of args supplied
         return NULL;
     }
-
-    // Eval args
-    LLVMValueRef *args = malloc(sizeof(LLVMValueRef) * node->arg_count);
-    for (int i = 0; i < node->arg_count; i++) {
-        args[i] = do_codegen(node->args[i], module, builder, named_vals);
-        if (args[i] == NULL) {
-            free(args);
-            return NULL;
-        }
-    }
-
-    return LLVMBuildCall(builder, func, args, node->arg_count, node->name);
+    return func;
 }
 
-static LLVMValueRef
-codegen_if(struct lilc_if_node_t *node, LLVMModuleRef module,
-           LLVMBuilderRef builder, cfuhash_table_t *named_vals) {
-    LLVMValueRef cond = do_codegen(node->cond, module, builder, named_vals);
-    if (!cond) return NULL;
+// Blocks making up an if/else
+struct if_blocks {
+    LLVMBasicBlockRef then_block;
+    LLVMBasicBlockRef else_block;
+    LLVMBasicBlockRef merge_block;
+};
 
+// Branch on `cond`, leaving the builder in the 'then' block
+static void
+emit_if_begin(LLVMBuilderRef builder, LLVMValueRef cond, struct if_blocks *b) {
     // Convert condition from double to bool by comparing
     // it with the double zero.
     LLVMValueRef zero = LLVMConstReal(LLVMDoubleType(), 0);
@@ -341,42 +502,45 @@ codegen_if(struct lilc_if_node_t *node, LLVMModuleRef module,
     // Get a reference to the function that we're currently in and append
     // our conditional blocks to it
     LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
-    LLVMBasicBlockRef then_block = LLVMAppendBasicBlock(func, "then");
-    LLVMBasicBlockRef else_block = LLVMAppendBasicBlock(func, "else");
-    LLVMBasicBlockRef merge_block = LLVMAppendBasicBlock(func, "ifcont");
+    b->then_block = LLVMAppendBasicBlock(func, "then");
+    b->else_block = LLVMAppendBasicBlock(func, "else");
+    b->merge_block = LLVMAppendBasicBlock(func, "ifcont");
 
     // Generate the branch instruction using the condition
     // we just translated
-    LLVMBuildCondBr(builder, cond, then_block, else_block);
+    LLVMBuildCondBr(builder, cond, b->then_block, b->else_block);
 
-    // Generate 'then' block.
-    LLVMPositionBuilderAtEnd(builder, then_block);
-    LLVMValueRef then_value = do_codegen(node->then_block, module, builder, named_vals);
-    if(then_value == NULL) return NULL;
+    LLVMPositionBuilderAtEnd(builder, b->then_block);
+}
 
+// Close off the 'then' block and move on to the 'else' block
+static void
+emit_if_else(LLVMBuilderRef builder, struct if_blocks *b) {
     // Unconditional branch from then_block to merge_block
-    LLVMBuildBr(builder, merge_block);
+    LLVMBuildBr(builder, b->merge_block);
 
-    // `do_codegen` can change the current insert block, e.g.
-    // with a nested if/else, so we need to get the latest position
-    then_block = LLVMGetInsertBlock(builder);
+    // Generating the 'then' value can change the current insert block,
+    // e.g. with a nested if/else, so we need to get the latest position
+    b->then_block = LLVMGetInsertBlock(builder);
 
-    // Generate 'else' block
-    LLVMPositionBuilderAtEnd(builder, else_block);
-    LLVMValueRef else_value = do_codegen(node->else_block, module, builder, named_vals);
-    if(else_value == NULL) return NULL;
+    LLVMPositionBuilderAtEnd(builder, b->else_block);
+}
 
+// Close off the 'else' block and merge the two values
+static LLVMValueRef
+emit_if_end(LLVMBuilderRef builder, struct if_blocks *b, LLVMValueRef then_value,
+            LLVMValueRef else_value) {
     // Unconditional branch from else_block to merge block
-    LLVMBuildBr(builder, merge_block);
+    LLVMBuildBr(builder, b->merge_block);
 
     // Get latest cursor position again
-    else_block = LLVMGetInsertBlock(builder);
+    b->else_block = LLVMGetInsertBlock(builder);
 
     // Build phi op, see: https://en.wikipedia.org/wiki/Static_single_assignment_form
-    LLVMPositionBuilderAtEnd(builder, merge_block);
+    LLVMPositionBuilderAtEnd(builder, b->merge_block);
     LLVMValueRef phi = LLVMBuildPhi(builder, LLVMDoubleType (), "ifphitmp");
-    LLVMAddIncoming(phi, &then_value, &then_block, 1);
-    LLVMAddIncoming(phi, &else_value, &else_block, 1);
+    LLVMAddIncoming(phi, &then_value, &b->then_block, 1);
+    LLVMAddIncoming(phi, &else_value, &b->else_block, 1);
 
     // Note that we don't build a ret instruction--if/else expressions currently evaluate
     // to these phi instructions, which will be returned in whatever top-level function
@@ -386,35 +550,454 @@ codegen_if(struct lilc_if_node_t *node, LLVMModuleRef module,
     return phi;
 }
 
-// Recursively walk an AST and generate LLVM IR
+/*
+ * Memoized functions, see memo.h. Each has a cache of its own, a global
+ * named after it, laid out as
+ *
+ *   {i64 hits, i64 misses, i64 evictions,
+ *    [SLOTS x i8] full, [SLOTS x double] vals, [SLOTS x [params x i64]] keys}
+ *
+ * with the counters first, so they can be read back the same way for
+ * any number of parameters.
+ */
+enum {MEMO_HITS, MEMO_MISSES, MEMO_EVICTIONS, MEMO_FULL, MEMO_VALS, MEMO_KEYS};
+
+#define MEMO_HASH_MUL 0x9e3779b97f4a7c15u
+
+// A memoized function's cache, and the slot the arguments it was called
+// with go in
+struct memo_site {
+    LLVMValueRef cache;
+    LLVMTypeRef type;
+    LLVMValueRef slot;
+};
+
+// Argument `i` of `func`, as a key: its bits
 static LLVMValueRef
-do_codegen(struct lilc_node_t *node, LLVMModuleRef module,
-           LLVMBuilderRef builder, cfuhash_table_t *named_vals) {
-    switch(node->type) {
-        case LILC_NODE_DBL: {
-            return codegen_dbl((struct lilc_dbl_node_t *)node);
-        }
-        case LILC_NODE_VAR: {
-            return codegen_var((struct lilc_var_node_t *)node, named_vals);
-        }
-        case LILC_NODE_BLOCK: {
-            return codegen_block((struct lilc_block_node_t *)node, module, builder, named_vals);
+memo_key(LLVMBuilderRef builder, LLVMValueRef func, unsigned int i) {
+    return LLVMBuildBitCast(builder, LLVMGetParam(func, i), LLVMInt64Type(), "memokey");
+}
+
+// Pointer to a counter, or to the slot's entry in `field`, key `i` of it
+// for the keys
+static LLVMValueRef
+memo_field(LLVMBuilderRef builder, struct memo_site *m, unsigned int field, unsigned int i) {
+    LLVMValueRef idx[] = {
+        LLVMConstInt(LLVMInt32Type(), 0, 0),
+        LLVMConstInt(LLVMInt32Type(), field, 0),
+        m->slot,
+        LLVMConstInt(LLVMInt32Type(), i, 0),
+    };
+    unsigned int count = field < MEMO_FULL ? 2 : field < MEMO_KEYS ? 3 : 4;
+    return LLVMBuildInBoundsGEP2(builder, m->type, m->cache, idx, count, "memoptr");
+}
+
+static void
+memo_count(LLVMBuilderRef builder, struct memo_site *m, unsigned int counter, LLVMValueRef by) {
+    LLVMValueRef ptr = memo_field(builder, m, counter, 0);
+    LLVMValueRef n = LLVMBuildLoad2(builder, LLVMInt64Type(), ptr, "memocount");
+    LLVMBuildStore(builder, LLVMBuildAdd(builder, n, by, "memocount"), ptr);
+}
+
+// Look the arguments of `func` up in a new cache for it, returning what's
+// found there straight away. The builder is left where a miss goes on to
+// the body.
+static void
+emit_memo_begin(LLVMModuleRef module, LLVMBuilderRef builder, LLVMValueRef func,
+                struct memo_site *m) {
+    LLVMTypeRef i64 = LLVMInt64Type();
+    unsigned int param_count = LLVMCountParams(func);
+    LLVMTypeRef fields[] = {
+        i64, i64, i64,
+        LLVMArrayType(LLVMInt8Type(), LILC_MEMO_SLOTS),
+        LLVMArrayType(LLVMDoubleType(), LILC_MEMO_SLOTS),
+        LLVMArrayType(LLVMArrayType(i64, param_count), LILC_MEMO_SLOTS),
+    };
+    m->type = LLVMStructType(fields, sizeof(fields) / sizeof(fields[0]), 0);
+    size_t len;
+    const char *name = LLVMGetValueName2(func, &len);
+    char buf[len + sizeof(".memo")];
+    snprintf(buf, sizeof(buf), "%s.memo", name);
+    m->cache = LLVMAddGlobal(module, m->type, buf);
+    LLVMSetInitializer(m->cache, LLVMConstNull(m->type));
+
+    // The slot is picked by the top bits of a multiplicative hash. The
+    // bits that vary between small numbers are all near the top, where a
+    // multiply alone barely spreads them, so each key is multiplied and
+    // folded in half before it's mixed in.
+    LLVMValueRef h = LLVMConstInt(i64, 0, 0);
+    LLVMValueRef mul = LLVMConstInt(i64, MEMO_HASH_MUL, 0);
+    LLVMValueRef half = LLVMConstInt(i64, 32, 0);
+    for (unsigned int i = 0; i < param_count; i++) {
+        LLVMValueRef key = LLVMBuildMul(builder, memo_key(builder, func, i), mul, "memomix");
+        key = LLVMBuildXor(builder, key, LLVMBuildLShr(builder, key, half, "memomix"), "memomix");
+        h = LLVMBuildMul(builder, LLVMBuildXor(builder, h, key, "memohash"), mul, "memohash");
+    }
+    m->slot = LLVMBuildLShr(builder, h, LLVMConstInt(i64, 64 - LILC_MEMO_SLOT_BITS, 0), "memoslot");
+
+    LLVMValueRef full = LLVMBuildLoad2(builder, LLVMInt8Type(), memo_field(builder, m, MEMO_FULL, 0), "memofull");
+    LLVMValueRef hit = LLVMBuildICmp(builder, LLVMIntNE, full, LLVMConstInt(LLVMInt8Type(), 0, 0), "memohit");
+    for (unsigned int i = 0; i < param_count; i++) {
+        LLVMValueRef key = LLVMBuildLoad2(builder, i64, memo_field(builder, m, MEMO_KEYS, i), "memokey");
+        LLVMValueRef same = LLVMBuildICmp(builder, LLVMIntEQ, key, memo_key(builder, func, i), "memosame");
+        hit = LLVMBuildAnd(builder, hit, same, "memohit");
+    }
+    LLVMBasicBlockRef hit_block = LLVMAppendBasicBlock(func, "memohit");
+    LLVMBasicBlockRef miss_block = LLVMAppendBasicBlock(func, "memomiss");
+    LLVMBuildCondBr(builder, hit, hit_block, miss_block);
+
+    LLVMValueRef one = LLVMConstInt(i64, 1, 0);
+    LLVMPositionBuilderAtEnd(builder, hit_block);
+    memo_count(builder, m, MEMO_HITS, one);
+    LLVMBuildRet(builder, LLVMBuildLoad2(builder, LLVMDoubleType(), memo_field(builder, m, MEMO_VALS, 0), "memoval"));
+
+    LLVMPositionBuilderAtEnd(builder, miss_block);
+    memo_count(builder, m, MEMO_MISSES, one);
+}
+
+// Store the value of `func`'s body in its cache, on the way out. Whatever
+// was in the slot was for other arguments, or the body would never have
+// returned, and is evicted.
+static void
+emit_memo_end(LLVMBuilderRef builder, LLVMValueRef func, struct memo_site *m, LLVMValueRef body) {
+    LLVMValueRef full = memo_field(builder, m, MEMO_FULL, 0);
+    LLVMValueRef evicted = LLVMBuildLoad2(builder, LLVMInt8Type(), full, "memofull");
+    memo_count(builder, m, MEMO_EVICTIONS, LLVMBuildZExt(builder, evicted, LLVMInt64Type(), "memoevicted"));
+    for (unsigned int i = 0; i < LLVMCountParams(func); i++) {
+        LLVMBuildStore(builder, memo_key(builder, func, i), memo_field(builder, m, MEMO_KEYS, i));
+    }
+    LLVMBuildStore(builder, body, memo_field(builder, m, MEMO_VALS, 0));
+    LLVMBuildStore(builder, LLVMConstInt(LLVMInt8Type(), 1, 0), full);
+}
+
+/*
+ * AST walkers. Code is generated on the way back up the tree: each node
+ * leaves its value on a stack for its parent to take, and an if/else or a
+ * function body gets its blocks set up just before the children that go
+ * in them. Both kinds of tree share everything but the visitor callbacks.
+ */
+
+// An if/else being generated
+struct if_frame {
+    struct if_blocks blocks;
+    size_t mark;  // Value cache log length at the branch
+};
+
+struct gen {
+    LLVMModuleRef module;
+    LLVMBuilderRef builder;
+    struct scope *scope;
+    kvec_t(LLVMValueRef) vals;     // Values of finished nodes, for their parents
+    kvec_t(struct if_frame) ifs;
+    kvec_t(LLVMValueRef) funcs;    // Functions defined so far, in order
+    struct symtab func_names;      // Flat ASTs only: index in `funcs`, by name
+    kvec_t(struct memo_site) memos;  // Memoized functions being generated
+};
+
+static void
+gen_init(struct gen *g, LLVMModuleRef module, LLVMBuilderRef builder, struct scope *scope) {
+    g->module = module;
+    g->builder = builder;
+    g->scope = scope;
+    kv_init(g->vals);
+    kv_init(g->ifs);
+    kv_init(g->funcs);
+    symtab_init(&g->func_names);
+    kv_init(g->memos);
+}
+
+// Value of the root once the walk is done, or NULL if it failed
+static LLVMValueRef
+gen_finish(struct gen *g, int rc) {
+    LLVMValueRef val = rc == 0 && kv_size(g->vals) ? kv_A(g->vals, kv_size(g->vals) - 1) : NULL;
+    kv_destroy(g->vals);
+    kv_destroy(g->ifs);
+    kv_destroy(g->funcs);
+    symtab_free(&g->func_names);
+    kv_destroy(g->memos);
+    return val;
+}
+
+static enum ast_walk_action
+gen_push(struct gen *g, LLVMValueRef val) {
+    if (!val) return AST_STOP;
+    kv_push(LLVMValueRef, g->vals, val);
+    return AST_DESCEND;
+}
+
+// Currently, blocks evaluate to the value of the last statement within
+// them. Not sure how that will end up interacting with the 'return'
+// keyword if I end up implementing that but I'll come back to it later.
+// TODO: Implement block-scoping
+static enum ast_walk_action
+gen_block(struct gen *g, unsigned int stmt_count) {
+    if (stmt_count == 0) return AST_STOP;
+    LLVMValueRef val = kv_pop(g->vals);
+    kv_size(g->vals) -= stmt_count - 1;
+    return gen_push(g, val);
+}
+
+static LLVMValueRef
+gen_binop(struct gen *g, enum tok_type op) {
+    LLVMValueRef rhs = kv_pop(g->vals);
+    LLVMValueRef lhs = kv_pop(g->vals);
+    return emit_binop(g->builder, op, lhs, rhs);
+}
+
+// The function is still on the stack, under where its body will go
+static void
+gen_func_begin(struct gen *g, int memo) {
+    LLVMValueRef func = kv_A(g->vals, kv_size(g->vals) - 1);
+    emit_func_begin(g->builder, func);
+    if (memo) {
+        struct memo_site m;
+        emit_memo_begin(g->module, g->builder, func, &m);
+        kv_push(struct memo_site, g->memos, m);
+    }
+}
+
+static enum ast_walk_action
+gen_func_end(struct gen *g, int memo) {
+    LLVMValueRef body = kv_pop(g->vals);
+    LLVMValueRef func = kv_pop(g->vals);
+    if (memo) {
+        struct memo_site m = kv_pop(g->memos);
+        if (body) {
+            emit_memo_end(g->builder, func, &m, body);
+        } else {
+            LLVMDeleteGlobal(m.cache);
         }
+    }
+    return gen_push(g, emit_func_end(g->module, g->builder, func, body));
+}
+
+static enum ast_walk_action
+gen_call(struct gen *g, LLVMValueRef func, const char *name, unsigned int arg_count) {
+    func = callee(func, arg_count);
+    if (func == NULL) {
+        return AST_STOP;
+    }
+    // Args are the top `arg_count` values, in order
+    kv_size(g->vals) -= arg_count;
+    LLVMValueRef *args = g->vals.a + kv_size(g->vals);
+    return gen_push(g, LLVMBuildCall(g->builder, func, args, arg_count, name));
+}
+
+// Set up the branch before the 'then' (1) and 'else' (2) children. Values
+// built in either branch don't dominate the other one, nor the code after
+// the if/else, so the value cache is rolled back past them.
+static void
+gen_if_child(struct gen *g, unsigned int i) {
+    if (i == 1) {
+        struct if_frame fr;
+        emit_if_begin(g->builder, kv_pop(g->vals), &fr.blocks);
+        fr.mark = kv_size(g->scope->cache.log);
+        kv_push(struct if_frame, g->ifs, fr);
+    } else if (i == 2) {
+        struct if_frame *fr = &kv_A(g->ifs, kv_size(g->ifs) - 1);
+        cache_rollback(&g->scope->cache, fr->mark);
+        emit_if_else(g->builder, &fr->blocks);
+    }
+}
+
+static enum ast_walk_action
+gen_if_end(struct gen *g) {
+    struct if_frame fr = kv_pop(g->ifs);
+    cache_rollback(&g->scope->cache, fr.mark);
+    LLVMValueRef else_value = kv_pop(g->vals);
+    LLVMValueRef then_value = kv_pop(g->vals);
+    return gen_push(g, emit_if_end(g->builder, &fr.blocks, then_value, else_value));
+}
+
+/*
+ * Pointer AST walker
+ */
+struct tree_gen {
+    struct ast_visitor v;
+    struct gen g;
+};
+
+static enum ast_walk_action
+tree_gen_enter(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct gen *g = &((struct tree_gen *)v)->g;
+    switch (node->type) {
         case LILC_NODE_OP_BIN: {
-            return codegen_binop((struct lilc_bin_op_node_t *)node, module, builder, named_vals);
+            // A hash-consed tree can reach the same operation more than
+            // once, and its value is reused wherever the first one dominates.
+            LLVMValueRef val = cache_get(&g->scope->cache, node);
+            if (val) {
+                gen_push(g, val);
+                return AST_SKIP;
+            }
+            return AST_DESCEND;
         }
         case LILC_NODE_PROTO: {
-            return codegen_proto((struct lilc_proto_node_t *)node, module, named_vals);
+            struct lilc_proto_node_t *p = (struct lilc_proto_node_t *)node;
+            LLVMValueRef func = emit_proto(g->module, lilc_sym_str(p->name), p->param_count, g->scope);
+            if (func == NULL) {
+                return AST_STOP;
+            }
+            // Bind parameters to their slots
+            for (int i = 0; i < p->param_count; i++) {
+                bind_param(func, i, lilc_sym_str(p->params[i]), g->scope);
+            }
+            kv_push(LLVMValueRef, g->funcs, func);
+            gen_push(g, func);
+            return AST_SKIP;
+        }
+        case LILC_NODE_IF:
+            return ((struct lilc_if_node_t *)node)->else_block ? AST_DESCEND : AST_STOP;
+        default:
+            return AST_DESCEND;
+    }
+}
+
+static enum ast_walk_action
+tree_gen_child(struct ast_visitor *v, struct lilc_node_t *node, unsigned int i) {
+    struct gen *g = &((struct tree_gen *)v)->g;
+    if (node->type == LILC_NODE_IF) {
+        gen_if_child(g, i);
+    } else if (node->type == LILC_NODE_FUNCDEF && i == 1) {
+        gen_func_begin(g, ((struct lilc_funcdef_node_t *)node)->memo);
+    }
+    return AST_DESCEND;
+}
+
+static enum ast_walk_action
+tree_gen_leave(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct gen *g = &((struct tree_gen *)v)->g;
+    switch (node->type) {
+        case LILC_NODE_DBL:
+            return gen_push(g, LLVMConstReal(LLVMDoubleType(), ((struct lilc_dbl_node_t *)node)->val));
+        case LILC_NODE_VAR:
+            return gen_push(g, param(g->scope, ((struct lilc_var_node_t *)node)->slot));
+        case LILC_NODE_BLOCK:
+            return gen_block(g, ((struct lilc_block_node_t *)node)->stmt_count);
+        case LILC_NODE_OP_BIN: {
+            LLVMValueRef val = gen_binop(g, ((struct lilc_bin_op_node_t *)node)->op);
+            if (val) cache_put(&g->scope->cache, node, val);
+            return gen_push(g, val);
         }
         case LILC_NODE_FUNCDEF: {
-        return codegen_funcdef((struct lilc_funcdef_node_t *)node, module, builder, named_vals);
+            // A body never parsed leaves the function declared only
+            struct lilc_funcdef_node_t *def = (struct lilc_funcdef_node_t *)node;
+            if (!def->body) return AST_DESCEND;
+            return gen_func_end(g, def->memo);
         }
         case LILC_NODE_FUNCCALL: {
-            return codegen_funccall((struct lilc_funccall_node_t *)node, module, builder, named_vals);
+            struct lilc_funccall_node_t *c = (struct lilc_funccall_node_t *)node;
+            LLVMValueRef func = c->func < kv_size(g->funcs) ? kv_A(g->funcs, c->func) : NULL;
+            return gen_call(g, func, lilc_sym_str(c->name), c->arg_count);
+        }
+        case LILC_NODE_IF:
+            return gen_if_end(g);
+        default:
+            return AST_STOP;
+    }
+}
+
+static LLVMValueRef
+gen_tree(const void *root, LLVMModuleRef module, LLVMBuilderRef builder,
+         struct scope *scope) {
+    struct tree_gen t = {{tree_gen_enter, tree_gen_child, tree_gen_leave}};
+    gen_init(&t.g, module, builder, scope);
+    return gen_finish(&t.g, ast_walk((struct lilc_node_t *)root, &t.v));
+}
+
+/*
+ * Flat AST walker. Same code as above, with nodes found by index.
+ */
+struct flat_gen {
+    struct flat_visitor v;
+    struct gen g;
+};
+
+static enum ast_walk_action
+flat_gen_enter(struct flat_visitor *v, const struct flat_ast *f, flat_idx_t n) {
+    struct gen *g = &((struct flat_gen *)v)->g;
+    switch (flat_kind(f, n)) {
+        case LILC_NODE_PROTO: {
+            // Parameters are leaf nodes, so they're all adjacent
+            unsigned int param_count = flat_end(f, n) - (n + 1);
+            LLVMValueRef func = emit_proto(g->module, flat_name(f, flat_payload(f, n)),
+                                           param_count, g->scope);
+            if (func == NULL) {
+                return AST_STOP;
+            }
+            symtab_bind(&g->func_names, flat_payload(f, n), kv_size(g->funcs));
+            kv_push(LLVMValueRef, g->funcs, func);
+
+            // The body's scope, closed when leaving the definition. A
+            // repeated parameter name means the first of them.
+            symtab_push(&g->scope->names);
+            for (unsigned int i = 0; i < param_count; i++) {
+                uint32_t name = flat_payload(f, n + 1 + i);
+                bind_param(func, i, flat_name(f, name), g->scope);
+                symtab_bind(&g->scope->names, name, i);
+            }
+            gen_push(g, func);
+            return AST_SKIP;
         }
         case LILC_NODE_IF: {
-            return codegen_if((struct lilc_if_node_t *)node, module, builder, named_vals);
+            flat_idx_t then_n = flat_end(f, n + 1);
+            return flat_end(f, then_n) < flat_end(f, n) ? AST_DESCEND : AST_STOP;
+        }
+        default:
+            return AST_DESCEND;
+    }
+}
+
+static enum ast_walk_action
+flat_gen_child(struct flat_visitor *v, const struct flat_ast *f, flat_idx_t n, unsigned int i) {
+    struct gen *g = &((struct flat_gen *)v)->g;
+    if (flat_kind(f, n) == LILC_NODE_IF) {
+        gen_if_child(g, i);
+    } else if (flat_kind(f, n) == LILC_NODE_FUNCDEF && i == 1) {
+        gen_func_begin(g, flat_payload(f, n));
+    }
+    return AST_DESCEND;
+}
+
+static enum ast_walk_action
+flat_gen_leave(struct flat_visitor *v, const struct flat_ast *f, flat_idx_t n) {
+    struct gen *g = &((struct flat_gen *)v)->g;
+    switch (flat_kind(f, n)) {
+        case LILC_NODE_DBL:
+            return gen_push(g, LLVMConstReal(LLVMDoubleType(), flat_dbl(f, n)));
+        case LILC_NODE_VAR: {
+            uint32_t b = symtab_find(&g->scope->names, flat_payload(f, n));
+            return gen_push(g, b == SYMTAB_NONE ? NULL : param(g->scope, symtab_val(&g->scope->names, b)));
         }
+        case LILC_NODE_BLOCK: {
+            unsigned int stmt_count = 0;
+            flat_for_children(f, n, c) stmt_count++;
+            return gen_block(g, stmt_count);
+        }
+        case LILC_NODE_OP_BIN:
+            return gen_push(g, gen_binop(g, flat_payload(f, n)));
+        case LILC_NODE_FUNCDEF:
+            symtab_pop(&g->scope->names);
+            // A body never parsed leaves the function declared only
+            if (flat_end(f, n + 1) == flat_end(f, n)) return AST_DESCEND;
+            return gen_func_end(g, flat_payload(f, n));
+        case LILC_NODE_FUNCCALL: {
+            unsigned int arg_count = 0;
+            flat_for_children(f, n, c) arg_count++;
+            uint32_t b = symtab_find(&g->func_names, flat_payload(f, n));
+            LLVMValueRef func = b == SYMTAB_NONE ? NULL : kv_A(g->funcs, symtab_val(&g->func_names, b));
+            return gen_call(g, func, flat_name(f, flat_payload(f, n)), arg_count);
+        }
+        case LILC_NODE_IF:
+            return gen_if_end(g);
+        default:
+            return AST_STOP;
     }
-    return NULL;
-}
\ No newline at end of file
+}
+
+static LLVMValueRef
+gen_flat(const void *root, LLVMModuleRef module, LLVMBuilderRef builder,
+         struct scope *scope) {
+    struct flat_gen fg = {{flat_gen_enter, flat_gen_child, flat_gen_leave}};
+    gen_init(&fg.g, module, builder, scope);
+    return gen_finish(&fg.g, flat_walk(root, 0, &fg.v));
+}
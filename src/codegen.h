@@ -2,6 +2,8 @@
 #define LILC_CODEGEN_H
 
 #include "ast.h"
+#include "flat.h"
+#include "memo.h"
 
 void
 lilc_codegen(struct lilc_node_t *node, char *path, void *result);
@@ -9,7 +11,22 @@ lilc_codegen(struct lilc_node_t *node, char *path, void *result);
 double
 lilc_eval(struct lilc_node_t *node);
 
+double
+lilc_eval_stats(struct lilc_node_t *node, memo_stats_t *stats);
+
+double
+lilc_eval_flat(const struct flat_ast *f);
+
 void
 lilc_emit(struct lilc_node_t *node, char *path);
 
+void
+lilc_emit_flat(const struct flat_ast *f, char *path);
+
+void
+lilc_emit_ir(struct lilc_node_t *node, char *path);
+
+void
+lilc_emit_ir_flat(const struct flat_ast *f, char *path);
+
 #endif
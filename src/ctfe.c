@@ -0,0 +1,297 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "kvec.h"
+
+#include "arena.h"
+#include "ast.h"
+#include "ctfe.h"
+#include "intern.h"
+#include "lex.h"
+#include "loc.h"
+#include "token.h"
+
+// Why evaluating a call stopped short, if it did
+enum ctfe_status {
+    CTFE_OK,
+    CTFE_OPAQUE,  // Something in it can't be evaluated
+    CTFE_STEPS,   // It ran out of steps
+    CTFE_DEPTH,   // It went too many calls deep
+};
+
+struct evaluator {
+    kvec_t(struct lilc_funcdef_node_t *) funcs;  // By number, as resolved
+    unsigned long steps;                          // Left for the call being run
+    unsigned int depth;                           // Calls it can still go into
+    enum ctfe_status status;
+};
+
+/*
+ * Interpreter. A function body is run with a walk of its tree: values
+ * are worked out on the way back up, each left on a stack for its parent,
+ * and the branch of an if/else not taken is passed over. Calls start a
+ * walk of their own.
+ */
+
+struct frame {
+    struct ast_visitor v;
+    struct evaluator *ev;
+    const double *args;
+    unsigned int arg_count;
+    kvec_t(double) vals;
+    kvec_t(char) taken;  // Conditions of the if/elses being run
+};
+
+// Forward declarations
+static int
+call(struct evaluator *ev, uint32_t func, const double *args, unsigned int arg_count, double *val);
+
+static enum ast_walk_action
+stop(struct frame *f, enum ctfe_status status) {
+    f->ev->status = status;
+    return AST_STOP;
+}
+
+static enum ast_walk_action
+run_enter(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct frame *f = (struct frame *)v;
+    if (f->ev->steps == 0) return stop(f, CTFE_STEPS);
+    f->ev->steps--;
+    switch (node->type) {
+        case LILC_NODE_DBL:
+            kv_push(double, f->vals, ((struct lilc_dbl_node_t *)node)->val);
+            return AST_SKIP;
+        case LILC_NODE_VAR: {
+            // Parameters are all there is to name
+            uint32_t slot = ((struct lilc_var_node_t *)node)->slot;
+            if (slot >= f->arg_count) return stop(f, CTFE_OPAQUE);
+            kv_push(double, f->vals, f->args[slot]);
+            return AST_SKIP;
+        }
+        case LILC_NODE_BLOCK:
+            // Codegen has no value for an empty block, nor for an if
+            // without an else
+            return ((struct lilc_block_node_t *)node)->stmt_count ? AST_DESCEND : stop(f, CTFE_OPAQUE);
+        case LILC_NODE_IF:
+            return ((struct lilc_if_node_t *)node)->else_block ? AST_DESCEND : stop(f, CTFE_OPAQUE);
+        case LILC_NODE_OP_BIN:
+        case LILC_NODE_FUNCCALL:
+            return AST_DESCEND;
+        default:
+            return stop(f, CTFE_OPAQUE);
+    }
+}
+
+// Only the branch taken is run. The condition is true when it's ordered
+// and not equal to zero, as the generated branch.
+static enum ast_walk_action
+run_child(struct ast_visitor *v, struct lilc_node_t *node, unsigned int i) {
+    struct frame *f = (struct frame *)v;
+    if (node->type != LILC_NODE_IF || i == 0) return AST_DESCEND;
+    if (i == 1) {
+        double cond = kv_pop(f->vals);
+        kv_push(char, f->taken, cond != 0 && !isnan(cond));
+    }
+    int then = kv_A(f->taken, kv_size(f->taken) - 1);
+    return then == (i == 1) ? AST_DESCEND : AST_SKIP;
+}
+
+static enum ast_walk_action
+run_leave(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct frame *f = (struct frame *)v;
+    switch (node->type) {
+        case LILC_NODE_BLOCK: {
+            // The value of the last statement
+            double val = kv_pop(f->vals);
+            kv_size(f->vals) -= ((struct lilc_block_node_t *)node)->stmt_count - 1;
+            kv_push(double, f->vals, val);
+            break;
+        }
+        case LILC_NODE_IF:
+            // The value of the branch taken
+            kv_pop(f->taken);
+            break;
+        case LILC_NODE_OP_BIN: {
+            double r = kv_pop(f->vals);
+            double l = kv_pop(f->vals);
+            double val;
+            switch (((struct lilc_bin_op_node_t *)node)->op) {
+                case LILC_TOK_ADD: val = l + r; break;
+                case LILC_TOK_SUB: val = l - r; break;
+                case LILC_TOK_MUL: val = l * r; break;
+                case LILC_TOK_DIV: val = l / r; break;
+                // Unordered or less than, as the generated comparison
+                case LILC_TOK_CMPLT: val = !(l >= r); break;
+                default: return stop(f, CTFE_OPAQUE);
+            }
+            kv_push(double, f->vals, val);
+            break;
+        }
+        case LILC_NODE_FUNCCALL: {
+            struct lilc_funccall_node_t *c = (struct lilc_funccall_node_t *)node;
+            kv_size(f->vals) -= c->arg_count;
+            double val;
+            if (!call(f->ev, c->func, f->vals.a + kv_size(f->vals), c->arg_count, &val)) return AST_STOP;
+            kv_push(double, f->vals, val);
+            break;
+        }
+        default:
+            break;
+    }
+    return AST_DESCEND;
+}
+
+// Run function `func` on `args`, leaving what it returns in `val`.
+// Returns 0, with the reason in `ev->status`, if it couldn't be run.
+static int
+call(struct evaluator *ev, uint32_t func, const double *args, unsigned int arg_count, double *val) {
+    struct lilc_funcdef_node_t *def = func < kv_size(ev->funcs) ? kv_A(ev->funcs, func) : NULL;
+    if (!def || !def->body || def->proto->param_count != arg_count) {
+        ev->status = CTFE_OPAQUE;
+        return 0;
+    }
+    if (ev->depth == 0) {
+        ev->status = CTFE_DEPTH;
+        return 0;
+    }
+
+    ev->depth--;
+    struct frame f = {{run_enter, run_child, run_leave}, ev, args, arg_count};
+    kv_init(f.vals);
+    kv_init(f.taken);
+    int ok = ast_walk(def->body, &f.v) == 0;
+    if (ok) *val = kv_A(f.vals, 0);
+    kv_destroy(f.vals);
+    kv_destroy(f.taken);
+    ev->depth++;
+    return ok;
+}
+
+/*
+ * Replacing calls. As with inlining, calls are replaced on the way back
+ * up the tree, each node leaving what it became on a stack for its
+ * parent, so the arguments of a call are done before it is.
+ */
+
+struct replacer {
+    struct ast_visitor v;
+    struct evaluator ev;
+    struct arena *arena;
+    unsigned long steps;
+    unsigned int depth;
+    struct lexer *lex;
+    lilc_diags_t *notes;
+    int replaced;
+    lilc_node_vec_t done;
+};
+
+// Run `func` on `args` within the budget. Unless it was never going to
+// run, how it went is noted, as for `what`, at `offset`.
+static int
+evaluate(struct replacer *r, uint32_t func, const double *args, unsigned int arg_count,
+         const char *what, size_t offset, double *val) {
+    r->ev.steps = r->steps;
+    r->ev.depth = r->depth;
+    r->ev.status = CTFE_OK;
+    int ok = call(&r->ev, func, args, arg_count, val);
+
+    if (r->notes && r->ev.status != CTFE_OPAQUE) {
+        char buf[DIAG_MSG_MAX];
+        switch (r->ev.status) {
+            case CTFE_STEPS:
+                snprintf(buf, DIAG_MSG_MAX, "ctfe: Gave up on %s, out of steps", what);
+                break;
+            case CTFE_DEPTH:
+                snprintf(buf, DIAG_MSG_MAX, "ctfe: Gave up on %s, too many calls deep", what);
+                break;
+            default:
+                snprintf(buf, DIAG_MSG_MAX, "ctfe: Evaluated %s", what);
+                break;
+        }
+        diag_push(r->notes, offset, lex_locate(r->lex, offset), buf);
+    }
+    return ok;
+}
+
+static struct lilc_node_t *
+replace_call(struct replacer *r, struct lilc_funccall_node_t *c) {
+    double args[c->arg_count + 1];
+    for (unsigned int i = 0; i < c->arg_count; i++) {
+        if (c->args[i]->type != LILC_NODE_DBL) return &c->base;
+        args[i] = ((struct lilc_dbl_node_t *)c->args[i])->val;
+    }
+
+    char what[DIAG_MSG_MAX];
+    snprintf(what, DIAG_MSG_MAX, "call to '%s'", lilc_sym_str(c->name));
+    double val;
+    if (!evaluate(r, c->func, args, c->arg_count, what, c->base.offset, &val)) return &c->base;
+    r->replaced++;
+    struct lilc_dbl_node_t *d = lilc_dbl_node_new(r->arena, val);
+    d->base.offset = c->base.offset;
+    return &d->base;
+}
+
+static enum ast_walk_action
+replace_enter(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct replacer *r = (struct replacer *)v;
+    // Numbered as by the resolver, in the order they're defined
+    if (node->type == LILC_NODE_FUNCDEF) {
+        kv_push(struct lilc_funcdef_node_t *, r->ev.funcs, (struct lilc_funcdef_node_t *)node);
+    }
+    return AST_DESCEND;
+}
+
+static enum ast_walk_action
+replace_leave(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct replacer *r = (struct replacer *)v;
+
+    // Put the children in place, the last of them on top
+    unsigned int count = 0;
+    while (ast_child(node, count)) count++;
+    kv_size(r->done) -= count;
+    for (unsigned int i = 0; i < count; i++) {
+        ast_set_child(node, i, kv_A(r->done, kv_size(r->done) + i));
+    }
+
+    if (node->type == LILC_NODE_FUNCCALL) node = replace_call(r, (struct lilc_funccall_node_t *)node);
+    lilc_node_vec_push(r->done, node);
+    return AST_DESCEND;
+}
+
+// Replace the body of a `main` taking no arguments with what it returns
+static void
+replace_main(struct replacer *r) {
+    lilc_sym_t main_sym = lilc_intern("main", 4);
+    for (uint32_t f = 0; f < kv_size(r->ev.funcs); f++) {
+        struct lilc_funcdef_node_t *def = kv_A(r->ev.funcs, f);
+        if (def->proto->name != main_sym || def->proto->param_count) continue;
+
+        // Already as simple as it gets
+        struct lilc_block_node_t *body = (struct lilc_block_node_t *)def->body;
+        if (body && body->stmt_count == 1 && body->stmts[0]->type == LILC_NODE_DBL) return;
+
+        double val;
+        if (!evaluate(r, f, NULL, 0, "main", def->base.offset, &val)) return;
+        r->replaced++;
+        struct lilc_node_t *d = &lilc_dbl_node_new(r->arena, val)->base;
+        d->offset = body->base.offset;
+        struct lilc_block_node_t *b = lilc_block_node_new(r->arena, &d, 1);
+        b->base.offset = body->base.offset;
+        def->body = &b->base;
+        return;
+    }
+}
+
+int
+ctfe(struct lilc_node_t *root, struct arena *a, unsigned long steps, unsigned int depth,
+     struct lexer *l, lilc_diags_t *notes) {
+    struct replacer r = {{replace_enter, NULL, replace_leave}, {{0}}, a, steps, depth, l, notes, 0};
+    kv_init(r.ev.funcs);
+    kv_init(r.done);
+    ast_walk(root, &r.v);
+    replace_main(&r);
+    kv_destroy(r.ev.funcs);
+    kv_destroy(r.done);
+    return r.replaced;
+}
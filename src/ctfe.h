@@ -0,0 +1,36 @@
+#ifndef LILC_CTFE_H
+#define LILC_CTFE_H
+
+#include "arena.h"
+#include "ast.h"
+#include "lex.h"
+#include "loc.h"
+
+/*
+ * Compile-time function evaluation, run on a tree once it's resolved.
+ * Calls whose arguments are all constants are run by an interpreter of
+ * the tree, and, if they return, replaced by what they returned: exactly
+ * what the generated code would have computed. Calls inside arguments go
+ * first, so `f(g(1))` can go too. A `main` taking no arguments is run the
+ * same way, and if it returns, its body is just what it returned.
+ *
+ * Functions in lilc are pure, so what a call returns is all it does. The
+ * interpreter gives up on anything it can't see into: calls that didn't
+ * resolve, functions whose bodies haven't been parsed (see parse_body),
+ * definitions inside bodies, and anything codegen would reject. So it
+ * can't hang the compiler, it also gives up on a call once it's been
+ * through `steps` nodes, or is `depth` calls deep.
+ *
+ * If `notes` is set, each call evaluated is noted there, and each given
+ * up on for lack of budget, as located through `l`. New nodes are
+ * allocated from `a`. Returns how many calls were replaced, main's body
+ * counting as one.
+ */
+#define LILC_CTFE_STEPS 100000
+#define LILC_CTFE_DEPTH 64
+
+int
+ctfe(struct lilc_node_t *root, struct arena *a, unsigned long steps, unsigned int depth,
+     struct lexer *l, lilc_diags_t *notes);
+
+#endif
@@ -0,0 +1,510 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kvec.h"
+
+#include "arena.h"
+#include "ast.h"
+#include "flat.h"
+#include "intern.h"
+#include "lex.h"
+#include "parse.h"
+
+void
+flat_ast_init(struct flat_ast *f) {
+    kv_init(f->kinds);
+    kv_init(f->ends);
+    kv_init(f->payloads);
+    kv_init(f->offsets);
+    kv_init(f->dbls);
+    kv_init(f->names);
+    kv_init(f->chars);
+    f->map = NULL;
+    f->map_len = 0;
+}
+
+void
+flat_ast_free(struct flat_ast *f) {
+    if (f->map) {
+        munmap(f->map, f->map_len);
+        flat_ast_init(f);
+        return;
+    }
+    kv_destroy(f->kinds);
+    kv_destroy(f->ends);
+    kv_destroy(f->payloads);
+    kv_destroy(f->offsets);
+    kv_destroy(f->dbls);
+    kv_destroy(f->names);
+    kv_destroy(f->chars);
+    flat_ast_init(f);
+}
+
+struct builder {
+    struct ast_visitor v;
+    struct flat_ast *f;
+    uint32_t *local;                // Name index + 1 for each interned symbol, 0 if unseen
+    kvec_t(flat_idx_t) open_nodes;  // Nodes whose children are being added
+};
+
+// The tree's name for interned symbol `sym`, adding it on first use
+static uint32_t
+local_name(struct builder *b, lilc_sym_t sym) {
+    if (!b->local[sym]) {
+        struct flat_ast *f = b->f;
+        kv_push(uint32_t, f->names, kv_size(f->chars));
+        const char *s = lilc_sym_str(sym);
+        size_t len = lilc_sym_len(sym);
+        for (size_t i = 0; i <= len; i++) {
+            kv_push(char, f->chars, s[i]);
+        }
+        b->local[sym] = kv_size(f->names);
+    }
+    return b->local[sym] - 1;
+}
+
+// Append a node, whose children must follow before `close_node` is called
+static flat_idx_t
+open_node(struct flat_ast *f, enum node_type kind, uint32_t payload, uint32_t offset) {
+    flat_idx_t n = kv_size(f->kinds);
+    kv_push(uint8_t, f->kinds, kind);
+    kv_push(flat_idx_t, f->ends, 0);
+    kv_push(uint32_t, f->payloads, payload);
+    kv_push(uint32_t, f->offsets, offset);
+    return n;
+}
+
+static void
+close_node(struct flat_ast *f, flat_idx_t n) {
+    kv_A(f->ends, n) = kv_size(f->kinds);
+}
+
+static enum ast_walk_action
+build_enter(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct builder *b = (struct builder *)v;
+    struct flat_ast *f = b->f;
+    uint32_t payload = 0;
+    switch (node->type) {
+        case LILC_NODE_DBL:
+            payload = kv_size(f->dbls);
+            kv_push(double, f->dbls, ((struct lilc_dbl_node_t *)node)->val);
+            break;
+        case LILC_NODE_VAR:
+            payload = local_name(b, ((struct lilc_var_node_t *)node)->name);
+            break;
+        case LILC_NODE_OP_BIN:
+            payload = ((struct lilc_bin_op_node_t *)node)->op;
+            break;
+        case LILC_NODE_PROTO:
+            payload = local_name(b, ((struct lilc_proto_node_t *)node)->name);
+            break;
+        case LILC_NODE_FUNCCALL:
+            payload = local_name(b, ((struct lilc_funccall_node_t *)node)->name);
+            break;
+        case LILC_NODE_FUNCDEF:
+            payload = ((struct lilc_funcdef_node_t *)node)->memo;
+            break;
+        case LILC_NODE_BLOCK:
+        case LILC_NODE_IF:
+            break;
+        default:
+            return AST_SKIP;
+    }
+    flat_idx_t n = open_node(f, node->type, payload, node->offset);
+    kv_push(flat_idx_t, b->open_nodes, n);
+
+    if (node->type == LILC_NODE_PROTO) {
+        struct lilc_proto_node_t *p = (struct lilc_proto_node_t *)node;
+        for (int i = 0; i < p->param_count; i++) {
+            close_node(f, open_node(f, LILC_NODE_VAR, local_name(b, p->params[i]), node->offset));
+        }
+    }
+    return AST_DESCEND;
+}
+
+static enum ast_walk_action
+build_leave(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct builder *b = (struct builder *)v;
+    close_node(b->f, kv_pop(b->open_nodes));
+    return AST_DESCEND;
+}
+
+// Append a flattened copy of the tree at `root` to `f`. Its root is
+// at the index `f` had as its node count beforehand.
+void
+flat_ast_build(struct flat_ast *f, struct lilc_node_t *root) {
+    struct builder b = {{build_enter, NULL, build_leave}, f,
+                        calloc(lilc_sym_count(), sizeof(uint32_t))};
+    kv_init(b.open_nodes);
+    ast_walk(root, &b.v);
+    kv_destroy(b.open_nodes);
+    free(b.local);
+}
+
+struct flat_frame {
+    flat_idx_t n;
+    flat_idx_t next;  // Next child to visit
+    unsigned int i;   // and its index among the children
+};
+
+// Walk the subtree of `f` at `root` with visitor `v`. Returns 0 once the
+// walk is complete, or -1 if a callback stopped it.
+int
+flat_walk(const struct flat_ast *f, flat_idx_t root, struct flat_visitor *v) {
+    enum ast_walk_action act = v->enter ? v->enter(v, f, root) : AST_DESCEND;
+    if (act != AST_DESCEND) return act == AST_STOP ? -1 : 0;
+
+    kvec_t(struct flat_frame) stack;
+    kv_init(stack);
+    struct flat_frame top = {root, root + 1, 0};
+    kv_push(struct flat_frame, stack, top);
+
+    while (kv_size(stack)) {
+        struct flat_frame *fr = &kv_A(stack, kv_size(stack) - 1);
+        flat_idx_t n = fr->n, c = fr->next;
+        unsigned int i = fr->i;
+
+        if (c >= flat_end(f, n)) {
+            act = v->leave ? v->leave(v, f, n) : AST_DESCEND;
+            kv_size(stack)--;
+        } else {
+            fr->next = flat_end(f, c);
+            fr->i++;
+            act = v->child ? v->child(v, f, n, i) : AST_DESCEND;
+            if (act == AST_DESCEND) {
+                act = v->enter ? v->enter(v, f, c) : AST_DESCEND;
+                if (act == AST_DESCEND) {
+                    struct flat_frame cf = {c, c + 1, 0};
+                    kv_push(struct flat_frame, stack, cf);
+                }
+            }
+        }
+        if (act == AST_STOP) break;
+    }
+
+    kv_destroy(stack);
+    return act == AST_STOP ? -1 : 0;
+}
+
+struct flat_printer {
+    struct flat_visitor v;
+    char *buf;
+    int i;
+    int indent;
+};
+
+static enum ast_walk_action
+print_enter(struct flat_visitor *v, const struct flat_ast *f, flat_idx_t n) {
+    struct flat_printer *p = (struct flat_printer *)v;
+    char *buf = p->buf;
+    int i = p->i;
+    i += sprintf(buf + i, "%*s(", p->indent, "");
+    switch (flat_kind(f, n)) {
+        case LILC_NODE_DBL:
+            i += sprintf(buf + i, "dbl ");
+            i += sprintf(buf + i, "%.1f", flat_dbl(f, n));
+            break;
+        case LILC_NODE_VAR:
+            i += sprintf(buf + i, "var ");
+            i += sprintf(buf + i, "%s", flat_name(f, flat_payload(f, n)));
+            break;
+        case LILC_NODE_OP_BIN:
+            i += sprintf(buf + i, "%s", lilc_token_str[flat_payload(f, n)]);
+            break;
+        case LILC_NODE_PROTO: {
+            i += sprintf(buf + i, "%s", flat_name(f, flat_payload(f, n)));
+            // Param list
+            i += sprintf(buf + i, "[");
+            int params = 0;
+            flat_for_children(f, n, c) {
+                i += sprintf(buf + i, "%s,", flat_name(f, flat_payload(f, c)));
+                params++;
+            }
+            if (params) i--;  // Delete trailing comma
+            i += sprintf(buf + i, "])");
+            p->i = i;
+            return AST_SKIP;  // Parameters are done, and so is the node
+        }
+        case LILC_NODE_FUNCCALL:
+            i += sprintf(buf + i, "call %s", flat_name(f, flat_payload(f, n)));
+            break;
+        case LILC_NODE_BLOCK:
+            i += sprintf(buf + i, "block");
+            break;
+        case LILC_NODE_FUNCDEF:
+            i += sprintf(buf + i, "%s", lilc_node_str[flat_kind(f, n)]);
+            if (flat_payload(f, n)) i += sprintf(buf + i, " @memo");
+            break;
+        case LILC_NODE_IF:
+            i += sprintf(buf + i, "%s", lilc_node_str[flat_kind(f, n)]);
+            break;
+        default:
+            i += sprintf(buf + i, "Unknown: %d", flat_kind(f, n));
+    }
+    p->i = i;
+    p->indent += 2;
+    return AST_DESCEND;
+}
+
+static enum ast_walk_action
+print_child(struct flat_visitor *v, const struct flat_ast *f, flat_idx_t n, unsigned int i) {
+    struct flat_printer *p = (struct flat_printer *)v;
+    if (flat_kind(f, n) == LILC_NODE_IF && i == 2) {
+        p->i += sprintf(p->buf + p->i, " else");
+    }
+    p->i += sprintf(p->buf + p->i, "\n");
+    return AST_DESCEND;
+}
+
+static enum ast_walk_action
+print_leave(struct flat_visitor *v, const struct flat_ast *f, flat_idx_t n) {
+    struct flat_printer *p = (struct flat_printer *)v;
+    p->indent -= 2;
+    p->i += sprintf(p->buf + p->i, ")");
+    return AST_DESCEND;
+}
+
+// Read a formatted version of the subtree at `n` into a buffer, returning
+// the number of bytes written. Same format as `ast_readf`.
+int
+flat_ast_readf(char *buf, int i, int indent, const struct flat_ast *f, flat_idx_t n) {
+    struct flat_printer p = {{print_enter, print_child, print_leave}, buf, i, indent};
+    flat_walk(f, n, &p.v);
+    return p.i;
+}
+
+/*
+ * Cache file layout, in native byte order: a header, then each array in
+ * turn. Arrays are ordered by decreasing element size, so all of them
+ * start suitably aligned without padding.
+ */
+#define FLAT_MAGIC "LILCAST"
+#define FLAT_VERSION 1
+#define FLAT_BYTE_ORDER 0x01020304u
+
+struct flat_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;    // Tells a file written on a foreign machine
+    uint64_t source_hash;
+    uint32_t nodes;
+    uint32_t dbls;
+    uint32_t names;
+    uint32_t chars;
+    uint64_t size;          // Of the whole file
+};
+
+// File size for a tree with the header's element counts
+static uint64_t
+flat_file_size(const struct flat_header *h) {
+    return sizeof(struct flat_header)
+        + (uint64_t)h->dbls * sizeof(double)
+        + (uint64_t)h->nodes * (sizeof(flat_idx_t) + 2 * sizeof(uint32_t) + sizeof(uint8_t))
+        + (uint64_t)h->names * sizeof(uint32_t)
+        + (uint64_t)h->chars;
+}
+
+// Hash of the source text, to key cache files by. Checking the cache
+// means hashing the whole source, so it goes a word at a time.
+uint64_t
+flat_source_hash(const char *source, size_t len) {
+    uint64_t h = 14695981039346656037u ^ len;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, source + i, 8);
+        h = (h ^ w) * 0x9e3779b97f4a7c15u;
+        h ^= h >> 32;
+    }
+    for (; i < len; i++) {
+        h = (h ^ (unsigned char)source[i]) * 1099511628211u;
+    }
+    return h ^ (h >> 29);
+}
+
+static int
+write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) return -1;
+        p += w;
+        len -= w;
+    }
+    return 0;
+}
+
+// Write `f` to a cache file at `path`, keyed by `source_hash`. The file
+// is written aside and renamed into place, so readers never see part of
+// one. Returns 0 on success, -1 on failure with errno set.
+int
+flat_ast_write(const struct flat_ast *f, uint64_t source_hash, const char *path) {
+    struct flat_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, FLAT_MAGIC, sizeof(h.magic));
+    h.version = FLAT_VERSION;
+    h.byte_order = FLAT_BYTE_ORDER;
+    h.source_hash = source_hash;
+    h.nodes = kv_size(f->kinds);
+    h.dbls = kv_size(f->dbls);
+    h.names = kv_size(f->names);
+    h.chars = kv_size(f->chars);
+    h.size = flat_file_size(&h);
+
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid()) >= sizeof(tmp)) return -1;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    int rc = write_all(fd, &h, sizeof(h))
+        || write_all(fd, f->dbls.a, h.dbls * sizeof(double))
+        || write_all(fd, f->ends.a, h.nodes * sizeof(flat_idx_t))
+        || write_all(fd, f->payloads.a, h.nodes * sizeof(uint32_t))
+        || write_all(fd, f->offsets.a, h.nodes * sizeof(uint32_t))
+        || write_all(fd, f->names.a, h.names * sizeof(uint32_t))
+        || write_all(fd, f->kinds.a, h.nodes * sizeof(uint8_t))
+        || write_all(fd, f->chars.a, h.chars);
+    if (close(fd) || rc || rename(tmp, path)) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Point `v` at `count` elements starting at `*at`, and move `*at` past them
+#define flat_view(v, at, count) \
+    ((v).a = (void *)(at), (v).n = (count), (v).m = 0, (at) += (count) * sizeof(*(v).a))
+
+// Whether the tree mapped into `f` can be walked and read without going
+// outside its arrays, however the file was damaged: each subtree ends
+// within its parent, each node has the children and payload its kind
+// calls for, and each name starts within the string table.
+static int
+flat_valid(const struct flat_ast *f) {
+    flat_idx_t nodes = kv_size(f->kinds);
+    if (!nodes || flat_end(f, 0) != nodes) return 0;
+    for (flat_idx_t n = 0; n < nodes; n++) {
+        if (flat_end(f, n) <= n || flat_end(f, n) > nodes) return 0;
+    }
+
+    for (flat_idx_t n = 0; n < nodes; n++) {
+        unsigned int count = 0, vars = 0;
+        flat_for_children(f, n, c) {
+            if (flat_end(f, c) > flat_end(f, n)) return 0;
+            count++;
+            vars += flat_kind(f, c) == LILC_NODE_VAR;
+        }
+        uint32_t payload = flat_payload(f, n);
+        switch (flat_kind(f, n)) {
+            case LILC_NODE_DBL:
+                if (count || payload >= kv_size(f->dbls)) return 0;
+                break;
+            case LILC_NODE_VAR:
+                if (count || payload >= kv_size(f->names)) return 0;
+                break;
+            case LILC_NODE_OP_BIN:
+                if (count != 2 || payload > LILC_TOK_AT) return 0;
+                break;
+            case LILC_NODE_PROTO:
+                if (vars != count || payload >= kv_size(f->names)) return 0;
+                break;
+            case LILC_NODE_FUNCDEF:
+                if (count < 1 || count > 2 || flat_kind(f, n + 1) != LILC_NODE_PROTO) return 0;
+                break;
+            case LILC_NODE_FUNCCALL:
+                if (payload >= kv_size(f->names)) return 0;
+                break;
+            case LILC_NODE_IF:
+                if (count != 2 && count != 3) return 0;
+                break;
+            case LILC_NODE_BLOCK:
+                break;
+            default:
+                return 0;
+        }
+    }
+
+    for (size_t i = 0; i < kv_size(f->names); i++) {
+        if (kv_A(f->names, i) >= kv_size(f->chars)) return 0;
+    }
+    return 1;
+}
+
+// Map the cache file at `path` into `f`, which must be empty. Returns 1
+// if it holds a tree for the source with hash `source_hash`, or 0 if it
+// doesn't, can't be read, was written by another version of lilc, or is
+// damaged, in which case `f` is left empty.
+int
+flat_ast_load(struct flat_ast *f, const char *path, uint64_t source_hash) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    struct flat_header h;
+    if (fstat(fd, &st) || st.st_size < sizeof(h) || read(fd, &h, sizeof(h)) != sizeof(h)
+        || memcmp(h.magic, FLAT_MAGIC, sizeof(h.magic)) != 0
+        || h.version != FLAT_VERSION
+        || h.byte_order != FLAT_BYTE_ORDER
+        || h.source_hash != source_hash
+        || h.size != st.st_size || h.size != flat_file_size(&h)) {
+        close(fd);
+        return 0;
+    }
+
+    char *base = mmap(NULL, h.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // A mapping stays valid after its descriptor is closed
+    if (base == MAP_FAILED) return 0;
+
+    // Names must stay within the mapping when read as strings
+    if (h.chars && base[h.size - 1] != '\0') {
+        munmap(base, h.size);
+        return 0;
+    }
+
+    const char *at = base + sizeof(h);
+    flat_view(f->dbls, at, h.dbls);
+    flat_view(f->ends, at, h.nodes);
+    flat_view(f->payloads, at, h.nodes);
+    flat_view(f->offsets, at, h.nodes);
+    flat_view(f->names, at, h.names);
+    flat_view(f->kinds, at, h.nodes);
+    flat_view(f->chars, at, h.chars);
+    if (!flat_valid(f)) {
+        munmap(base, h.size);
+        flat_ast_init(f);
+        return 0;
+    }
+    f->map = base;
+    f->map_len = h.size;
+    return 1;
+}
+
+// Fill `f` with the tree for `source`, `len` bytes long, from the cache
+// file at `cache_path` if it holds one for the same text. Otherwise the
+// source is parsed and the cache file rewritten, on a best effort basis.
+// Returns 1 on a cache hit. Dies on syntax errors, like `parse`.
+int
+flat_ast_cached(struct flat_ast *f, const char *source, size_t len, char *path,
+                const char *cache_path) {
+    uint64_t hash = flat_source_hash(source, len);
+    if (flat_ast_load(f, cache_path, hash)) return 1;
+
+    struct lexer l;
+    struct parser p;
+    struct arena a;
+    lex_init(&l, source, path);
+    arena_init(&a);
+    parser_init(&p, &l, &a);
+    flat_ast_build(f, parse(&p));
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+
+    flat_ast_write(f, hash, cache_path);
+    return 0;
+}
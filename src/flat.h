@@ -0,0 +1,98 @@
+#ifndef LILC_FLAT_H
+#define LILC_FLAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kvec.h"
+
+#include "ast.h"
+
+/*
+ * Flat AST. Nodes are stored in pre-order in parallel arrays and refer
+ * to each other by 32-bit index, so node `n`'s children are the subtrees
+ * starting at `n + 1` up to `ends[n]`, one after the other. Nodes carry a
+ * single 32-bit payload, depending on their kind:
+ *
+ *   DBL       index into `dbls`
+ *   VAR       name
+ *   BLOCK     -             children: statements
+ *   OP_BIN    operator      children: left, right
+ *   PROTO     name          children: parameters, as VAR nodes
+ *   FUNCDEF   memo flag     children: proto, body if parsed
+ *   FUNCCALL  name          children: arguments
+ *   IF        -             children: cond, then block, else block if any
+ *
+ * Names index the tree's own string table rather than the process-wide
+ * intern table, so a flat AST is self-contained and can be written out
+ * as is.
+ *
+ * A tree loaded with `flat_ast_load` is used in place in the mapped file:
+ * its arrays point into the mapping, and it must not be added to.
+ */
+typedef uint32_t flat_idx_t;
+
+struct flat_ast {
+    kvec_t(uint8_t) kinds;      // enum node_type
+    kvec_t(flat_idx_t) ends;    // Index just past each node's subtree
+    kvec_t(uint32_t) payloads;
+    kvec_t(uint32_t) offsets;   // Source offsets, as in `lilc_node_t`
+    kvec_t(double) dbls;
+    kvec_t(uint32_t) names;     // Start of each name in `chars`
+    kvec_t(char) chars;         // Names, each NUL-terminated
+    void *map;                  // Mapped file backing the arrays, if loaded
+    size_t map_len;
+};
+
+#define flat_kind(f, n) ((enum node_type)kv_A((f)->kinds, n))
+#define flat_end(f, n) kv_A((f)->ends, n)
+#define flat_payload(f, n) kv_A((f)->payloads, n)
+#define flat_dbl(f, n) kv_A((f)->dbls, flat_payload(f, n))
+#define flat_name(f, name) (&kv_A((f)->chars, kv_A((f)->names, name)))
+
+// Iterate over the children of node `n`
+#define flat_for_children(f, n, c) \
+    for (flat_idx_t c = (n) + 1; c < flat_end(f, n); c = flat_end(f, c))
+
+// Iterative traversal of a flat AST, as `ast_walk` does for a tree
+struct flat_visitor {
+    enum ast_walk_action (*enter)(struct flat_visitor *v, const struct flat_ast *f, flat_idx_t n);
+    enum ast_walk_action (*child)(struct flat_visitor *v, const struct flat_ast *f, flat_idx_t n,
+                                  unsigned int i);
+    enum ast_walk_action (*leave)(struct flat_visitor *v, const struct flat_ast *f, flat_idx_t n);
+};
+
+int
+flat_walk(const struct flat_ast *f, flat_idx_t root, struct flat_visitor *v);
+
+void
+flat_ast_init(struct flat_ast *f);
+
+void
+flat_ast_free(struct flat_ast *f);
+
+void
+flat_ast_build(struct flat_ast *f, struct lilc_node_t *root);
+
+int
+flat_ast_readf(char *buf, int i, int indent, const struct flat_ast *f, flat_idx_t n);
+
+/*
+ * Binary AST cache. A cache file holds a flat AST along with a hash of the
+ * source text it was parsed from, laid out so that it can be mapped and
+ * used without any decoding.
+ */
+uint64_t
+flat_source_hash(const char *source, size_t len);
+
+int
+flat_ast_write(const struct flat_ast *f, uint64_t source_hash, const char *path);
+
+int
+flat_ast_load(struct flat_ast *f, const char *path, uint64_t source_hash);
+
+int
+flat_ast_cached(struct flat_ast *f, const char *source, size_t len, char *path,
+                const char *cache_path);
+
+#endif
@@ -0,0 +1,115 @@
+#include <math.h>
+
+#include "kvec.h"
+
+#include "arena.h"
+#include "ast.h"
+#include "fold.h"
+#include "token.h"
+
+// Nodes are folded on the way back up the tree. Each leaves what it
+// folded down to on a stack, where its parent picks it up.
+struct folder {
+    struct ast_visitor v;
+    struct arena *arena;
+    lilc_node_vec_t done;
+};
+
+static int
+constant(struct lilc_node_t *node, double *val) {
+    if (node->type != LILC_NODE_DBL) return 0;
+    *val = ((struct lilc_dbl_node_t *)node)->val;
+    return 1;
+}
+
+static int
+is_zero(int is_const, double val, int sign) {
+    return is_const && val == 0 && !!signbit(val) == sign;
+}
+
+static struct lilc_node_t *
+fold_bin_op(struct folder *fo, struct lilc_bin_op_node_t *n) {
+    double l, r, val;
+    int lc = constant(n->left, &l);
+    int rc = constant(n->right, &r);
+
+    if (lc && rc) {
+        switch (n->op) {
+            case LILC_TOK_ADD: val = l + r; break;
+            case LILC_TOK_SUB: val = l - r; break;
+            case LILC_TOK_MUL: val = l * r; break;
+            case LILC_TOK_DIV: val = l / r; break;
+            // Unordered or less than, as the generated comparison
+            case LILC_TOK_CMPLT: val = !(l >= r); break;
+            default: return &n->base;
+        }
+        struct lilc_dbl_node_t *d = lilc_dbl_node_new(fo->arena, val);
+        d->base.offset = n->base.offset;
+        return &d->base;
+    }
+
+    switch (n->op) {
+        case LILC_TOK_MUL:
+            if (rc && r == 1) return n->left;
+            if (lc && l == 1) return n->right;
+            break;
+        case LILC_TOK_DIV:
+            if (rc && r == 1) return n->left;
+            break;
+        case LILC_TOK_SUB:
+            if (is_zero(rc, r, 0)) return n->left;
+            break;
+        case LILC_TOK_ADD:
+            if (is_zero(rc, r, 1)) return n->left;
+            if (is_zero(lc, l, 1)) return n->right;
+            break;
+        default:
+            break;
+    }
+    return &n->base;
+}
+
+// An if/else on a constant is the block it takes. The condition is
+// true when it's ordered and not equal to zero, as the generated branch.
+static struct lilc_node_t *
+fold_if(struct lilc_if_node_t *n) {
+    double cond;
+    if (!n->else_block || !constant(n->cond, &cond)) return &n->base;
+    return (struct lilc_node_t *)(cond != 0 && !isnan(cond) ? n->then_block : n->else_block);
+}
+
+static enum ast_walk_action
+fold_leave(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct folder *fo = (struct folder *)v;
+
+    // Put the folded children in place, the last of them on top
+    unsigned int count = 0;
+    while (ast_child(node, count)) count++;
+    kv_size(fo->done) -= count;
+    for (unsigned int i = 0; i < count; i++) {
+        ast_set_child(node, i, kv_A(fo->done, kv_size(fo->done) + i));
+    }
+
+    switch (node->type) {
+        case LILC_NODE_OP_BIN:
+            node = fold_bin_op(fo, (struct lilc_bin_op_node_t *)node);
+            break;
+        case LILC_NODE_IF:
+            node = fold_if((struct lilc_if_node_t *)node);
+            break;
+        default:
+            break;
+    }
+    lilc_node_vec_push(fo->done, node);
+    return AST_DESCEND;
+}
+
+struct lilc_node_t *
+fold(struct lilc_node_t *root, struct arena *a) {
+    struct folder fo = {{NULL, NULL, fold_leave}, a};
+    kv_init(fo.done);
+    ast_walk(root, &fo.v);
+    root = kv_A(fo.done, 0);
+    kv_destroy(fo.done);
+    return root;
+}
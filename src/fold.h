@@ -0,0 +1,25 @@
+#ifndef LILC_FOLD_H
+#define LILC_FOLD_H
+
+#include "arena.h"
+#include "ast.h"
+
+/*
+ * Constant folding, run on a tree once it's parsed. Operations on
+ * constants, comparisons included, are replaced by their results, and so
+ * are if/elses on a constant condition, by the block they'd take. Of the
+ * algebraic identities, only those that hold for every double, signed
+ * zeros and NaNs included, are applied:
+ *
+ *   x * 1,  1 * x,  x / 1,  x - 0,  x + -0,  -0 + x   =>   x
+ *
+ * but not, say, x + 0, which is +0 for x = -0. Folded values are exactly
+ * what the generated code would have computed.
+ *
+ * The tree is changed in place, and new nodes are allocated from `a`.
+ * Returns the new root.
+ */
+struct lilc_node_t *
+fold(struct lilc_node_t *root, struct arena *a);
+
+#endif
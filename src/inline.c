@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "kvec.h"
+
+#include "arena.h"
+#include "ast.h"
+#include "inline.h"
+#include "intern.h"
+#include "lex.h"
+#include "loc.h"
+
+// What's known of a function by the time calls to it are reached
+struct callee {
+    struct lilc_node_t *body;  // Expression to inline, or NULL if it can't be
+    unsigned int size;         // Nodes in `body`
+    unsigned int *uses;        // How often each parameter is used in it
+};
+
+// Nodes are inlined into on the way back up the tree, so the bodies of
+// functions are done before the calls after them are reached. Each node
+// leaves what it became on a stack, where its parent picks it up.
+struct inliner {
+    struct ast_visitor v;
+    struct arena *arena;
+    unsigned int threshold;
+    struct lexer *lex;
+    lilc_diags_t *notes;
+    int inlined;
+    kvec_t(struct callee) funcs;  // By number, as resolved
+    kvec_t(uint32_t) defining;    // Functions whose bodies are being walked
+    lilc_node_vec_t done;
+};
+
+/*
+ * Sizing up bodies and arguments
+ */
+
+struct measure {
+    struct ast_visitor v;
+    uint32_t self;       // Function the tree is the body of, if any
+    unsigned int size;
+    unsigned int *uses;  // If set, counts each parameter used
+    int ok;              // Whether the tree can be copied into a caller
+    int calls;           // Whether it calls anything
+};
+
+static enum ast_walk_action
+measure_enter(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct measure *m = (struct measure *)v;
+    m->size++;
+    switch (node->type) {
+        case LILC_NODE_FUNCDEF:
+            m->ok = 0;
+            return AST_STOP;
+        case LILC_NODE_FUNCCALL:
+            m->calls = 1;
+            if (((struct lilc_funccall_node_t *)node)->func != m->self) break;
+            m->ok = 0;
+            return AST_STOP;
+        case LILC_NODE_VAR: {
+            uint32_t slot = ((struct lilc_var_node_t *)node)->slot;
+            if (slot == LILC_UNRESOLVED) {
+                m->ok = 0;
+                return AST_STOP;
+            }
+            if (m->uses) m->uses[slot]++;
+            break;
+        }
+        default:
+            break;
+    }
+    return AST_DESCEND;
+}
+
+// What evaluating an argument once more costs. There's no telling what a
+// call costs, so an argument with one in it is never evaluated twice.
+static unsigned int
+arg_cost(struct lilc_node_t *node, unsigned int threshold) {
+    struct measure m = {{measure_enter, NULL, NULL}, LILC_UNRESOLVED, 0, NULL, 1, 0};
+    ast_walk(node, &m.v);
+    return m.calls ? threshold + 1 : m.size;
+}
+
+// Record what function `func`, just walked, can be inlined as. Only a
+// body of one expression can, and only if it has no definitions in it
+// and doesn't call the function itself.
+static void
+define(struct inliner *in, uint32_t func, struct lilc_funcdef_node_t *def) {
+    struct callee *c = &kv_A(in->funcs, func);
+    struct lilc_block_node_t *body = (struct lilc_block_node_t *)def->body;
+    if (!body || body->base.type != LILC_NODE_BLOCK || body->stmt_count != 1) return;
+
+    c->uses = calloc(def->proto->param_count + 1, sizeof(unsigned int));
+    struct measure m = {{measure_enter, NULL, NULL}, func, 0, c->uses, 1, 0};
+    ast_walk(body->stmts[0], &m.v);
+    if (!m.ok) return;
+    c->body = body->stmts[0];
+    c->size = m.size;
+}
+
+/*
+ * Copying bodies
+ */
+
+// Like the inliner, copies are built on the way back up
+struct copier {
+    struct ast_visitor v;
+    struct arena *arena;
+    struct lilc_node_t **args;  // Put in place of the parameters
+    lilc_node_vec_t done;
+};
+
+static enum ast_walk_action
+copy_leave(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct copier *c = (struct copier *)v;
+    unsigned int count = 0;
+    while (ast_child(node, count)) count++;
+    kv_size(c->done) -= count;
+    struct lilc_node_t **kids = &kv_A(c->done, kv_size(c->done));
+
+    struct lilc_node_t *copy;
+    switch (node->type) {
+        case LILC_NODE_VAR:
+            // Parameters are all a body can name
+            lilc_node_vec_push(c->done, c->args[((struct lilc_var_node_t *)node)->slot]);
+            return AST_DESCEND;
+        case LILC_NODE_DBL:
+            copy = &lilc_dbl_node_new(c->arena, ((struct lilc_dbl_node_t *)node)->val)->base;
+            break;
+        case LILC_NODE_OP_BIN:
+            copy = &lilc_bin_op_node_new(c->arena, kids[0], kids[1],
+                                         ((struct lilc_bin_op_node_t *)node)->op)->base;
+            break;
+        case LILC_NODE_FUNCCALL: {
+            struct lilc_funccall_node_t *call = (struct lilc_funccall_node_t *)node;
+            struct lilc_funccall_node_t *n = lilc_funccall_node_new(c->arena, call->name, kids, count);
+            n->func = call->func;
+            copy = &n->base;
+            break;
+        }
+        case LILC_NODE_BLOCK:
+            copy = &lilc_block_node_new(c->arena, kids, count)->base;
+            break;
+        case LILC_NODE_IF: {
+            struct lilc_if_node_t *n = lilc_if_node_new(c->arena, kids[0], (struct lilc_block_node_t *)kids[1]);
+            if (count > 2) n->else_block = (struct lilc_block_node_t *)kids[2];
+            copy = &n->base;
+            break;
+        }
+        default:
+            // Definitions are never inlined
+            copy = node;
+            break;
+    }
+    copy->offset = node->offset;
+    lilc_node_vec_push(c->done, copy);
+    return AST_DESCEND;
+}
+
+static struct lilc_node_t *
+copy_body(struct arena *a, struct lilc_node_t *body, struct lilc_node_t **args) {
+    struct copier c = {{NULL, NULL, copy_leave}, a, args};
+    kv_init(c.done);
+    ast_walk(body, &c.v);
+    struct lilc_node_t *copy = kv_A(c.done, 0);
+    kv_destroy(c.done);
+    return copy;
+}
+
+/*
+ * Inlining
+ */
+
+static int
+is_leaf(struct lilc_node_t *node) {
+    return node->type == LILC_NODE_VAR || node->type == LILC_NODE_DBL;
+}
+
+static struct lilc_node_t *
+inline_call(struct inliner *in, struct lilc_funccall_node_t *call) {
+    if (call->func == LILC_UNRESOLVED) return &call->base;
+    struct callee *c = &kv_A(in->funcs, call->func);
+    if (!c->body) return &call->base;
+
+    unsigned int cost = c->size;
+    for (unsigned int i = 0; i < call->arg_count && cost <= in->threshold; i++) {
+        if (c->uses[i] > 1 && !is_leaf(call->args[i])) {
+            cost += (c->uses[i] - 1) * arg_cost(call->args[i], in->threshold);
+        }
+    }
+    if (cost > in->threshold) return &call->base;
+
+    if (in->notes) {
+        char buf[DIAG_MSG_MAX];
+        snprintf(buf, DIAG_MSG_MAX, "inline: Inlined call to '%s', cost %u", lilc_sym_str(call->name), cost);
+        diag_push(in->notes, call->base.offset, lex_locate(in->lex, call->base.offset), buf);
+    }
+    in->inlined++;
+    return copy_body(in->arena, c->body, call->args);
+}
+
+static enum ast_walk_action
+inline_leave(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct inliner *in = (struct inliner *)v;
+
+    // Put the children in place, inlined into, the last of them on top
+    unsigned int count = 0;
+    while (ast_child(node, count)) count++;
+    kv_size(in->done) -= count;
+    for (unsigned int i = 0; i < count; i++) {
+        ast_set_child(node, i, kv_A(in->done, kv_size(in->done) + i));
+    }
+
+    switch (node->type) {
+        case LILC_NODE_PROTO:
+            // Numbered as by the resolver, in the order they're defined
+            kv_push(struct callee, in->funcs, ((struct callee){NULL, 0, NULL}));
+            kv_push(uint32_t, in->defining, kv_size(in->funcs) - 1);
+            break;
+        case LILC_NODE_FUNCDEF:
+            define(in, kv_pop(in->defining), (struct lilc_funcdef_node_t *)node);
+            break;
+        case LILC_NODE_FUNCCALL:
+            node = inline_call(in, (struct lilc_funccall_node_t *)node);
+            break;
+        default:
+            break;
+    }
+    lilc_node_vec_push(in->done, node);
+    return AST_DESCEND;
+}
+
+int
+inline_calls(struct lilc_node_t *root, struct arena *a, unsigned int threshold,
+             struct lexer *l, lilc_diags_t *notes) {
+    struct inliner in = {{NULL, NULL, inline_leave}, a, threshold, l, notes, 0};
+    kv_init(in.funcs);
+    kv_init(in.defining);
+    kv_init(in.done);
+    ast_walk(root, &in.v);
+    for (size_t i = 0; i < kv_size(in.funcs); i++) free(kv_A(in.funcs, i).uses);
+    kv_destroy(in.funcs);
+    kv_destroy(in.defining);
+    kv_destroy(in.done);
+    return in.inlined;
+}
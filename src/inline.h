@@ -0,0 +1,32 @@
+#ifndef LILC_INLINE_H
+#define LILC_INLINE_H
+
+#include "arena.h"
+#include "ast.h"
+#include "lex.h"
+#include "loc.h"
+
+/*
+ * Inlining, run on a tree once it's resolved. A call to a function whose
+ * body is a single expression, with no definitions in it and no calls to
+ * the function itself, is replaced by a copy of that expression, its
+ * parameters replaced by the call's arguments. Calls inside bodies are
+ * inlined first, so a chain of small helpers collapses into its callers.
+ *
+ * What a call costs to inline is the size of the body, in nodes, plus the
+ * size of each argument once for every extra time its parameter is used,
+ * as each use evaluates it again. Variables and constants are free to
+ * repeat, and arguments with calls in them never are. Calls costing more
+ * than `threshold` are left alone.
+ *
+ * The functions themselves stay defined, whether anything still calls
+ * them or not. If `notes` is set, each call inlined is noted there, as
+ * located through `l`. Returns how many calls were inlined.
+ */
+#define LILC_INLINE_THRESHOLD 16
+
+int
+inline_calls(struct lilc_node_t *root, struct arena *a, unsigned int threshold,
+             struct lexer *l, lilc_diags_t *notes);
+
+#endif
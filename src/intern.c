@@ -0,0 +1,156 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+// Interned strings are copied into fixed blocks that are never moved or
+// freed, so a pointer handed out by `lilc_sym_str` stays valid forever.
+#define POOL_BLOCK_SIZE (64 * 1024)
+
+struct sym_entry {
+    const char *str;  // NUL-terminated copy in the string pool
+    uint32_t len;
+    uint32_t hash;
+};
+
+// Entries are kept in chunks that are never moved, each twice the size of
+// the one before, so a symbol's entry can be read without the lock.
+#define SYM_CHUNK0_BITS 10
+#define SYM_CHUNKS (33 - SYM_CHUNK0_BITS)
+
+static struct {
+    struct sym_entry *chunks[SYM_CHUNKS];  // Indexed through `entry`
+    uint32_t count;                        // Symbols so far, published last
+    uint32_t *slots;                       // Open-addressed, holds ID + 1, 0 if empty
+    uint32_t cap;                          // Slot count, always a power of two
+    char *pool;                            // Current string pool block
+    size_t pool_left;
+} tab;
+
+// The table is shared by all threads. Lookups go through a small
+// per-thread, direct-mapped cache first, so the lock is only taken the
+// first time a thread sees each name rather than on every occurrence.
+// Only adding a symbol takes it: a symbol's entry is written before the
+// symbol is handed out, and never changes after.
+#define CACHE_SIZE 1024
+
+static pthread_mutex_t tab_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct {
+    const char *str;  // Pool copy, which never moves, so safe to read unlocked
+    uint32_t len;
+    uint32_t hash;
+    lilc_sym_t sym;
+} cache[CACHE_SIZE];
+
+// FNV-1a
+static uint32_t
+hash_bytes(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Chunk k holds the 2^(SYM_CHUNK0_BITS + k) symbols after those before it
+static struct sym_entry *
+entry(lilc_sym_t sym) {
+    unsigned int k = 31 - __builtin_clz((sym >> SYM_CHUNK0_BITS) + 1);
+    size_t first = (((size_t)1 << k) - 1) << SYM_CHUNK0_BITS;
+    return &tab.chunks[k][sym - first];
+}
+
+static const char *
+pool_copy(const char *s, size_t len) {
+    if (tab.pool_left < len + 1) {
+        size_t size = len + 1 > POOL_BLOCK_SIZE ? len + 1 : POOL_BLOCK_SIZE;
+        tab.pool = malloc(size);
+        tab.pool_left = size;
+    }
+    char *copy = tab.pool;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    tab.pool += len + 1;
+    tab.pool_left -= len + 1;
+    return copy;
+}
+
+static void
+grow(void) {
+    uint32_t cap = tab.cap ? tab.cap * 2 : 1024;
+    uint32_t *slots = calloc(cap, sizeof(uint32_t));
+    for (uint32_t id = 0; id < tab.count; id++) {
+        uint32_t i = entry(id)->hash & (cap - 1);
+        while (slots[i]) i = (i + 1) & (cap - 1);
+        slots[i] = id + 1;
+    }
+    free(tab.slots);
+    tab.slots = slots;
+    tab.cap = cap;
+}
+
+static lilc_sym_t
+intern_locked(const char *s, size_t len, uint32_t hash) {
+    // Keep the load factor under 1/2
+    if ((tab.count + 1) * 2 > tab.cap) grow();
+
+    uint32_t i = hash & (tab.cap - 1);
+    while (tab.slots[i]) {
+        struct sym_entry *e = entry(tab.slots[i] - 1);
+        if (e->hash == hash && e->len == len && memcmp(e->str, s, len) == 0) {
+            return tab.slots[i] - 1;
+        }
+        i = (i + 1) & (tab.cap - 1);
+    }
+
+    lilc_sym_t sym = tab.count;
+    unsigned int k = 31 - __builtin_clz((sym >> SYM_CHUNK0_BITS) + 1);
+    if (!tab.chunks[k]) tab.chunks[k] = malloc(sizeof(struct sym_entry) << (SYM_CHUNK0_BITS + k));
+    *entry(sym) = (struct sym_entry){pool_copy(s, len), len, hash};
+    tab.slots[i] = sym + 1;
+    __atomic_store_n(&tab.count, sym + 1, __ATOMIC_RELEASE);
+    return sym;
+}
+
+// Return the symbol for `len` bytes at `s`, which need not be
+// NUL-terminated, adding it to the table on first sight. Thread-safe.
+lilc_sym_t
+lilc_intern(const char *s, size_t len) {
+    uint32_t hash = hash_bytes(s, len);
+
+    unsigned int c = hash & (CACHE_SIZE - 1);
+    if (cache[c].str && cache[c].hash == hash && cache[c].len == len &&
+        memcmp(cache[c].str, s, len) == 0) {
+        return cache[c].sym;
+    }
+
+    pthread_mutex_lock(&tab_lock);
+    lilc_sym_t sym = intern_locked(s, len, hash);
+    const char *str = entry(sym)->str;
+    pthread_mutex_unlock(&tab_lock);
+
+    cache[c].str = str;
+    cache[c].len = len;
+    cache[c].hash = hash;
+    cache[c].sym = sym;
+    return sym;
+}
+
+const char *
+lilc_sym_str(lilc_sym_t sym) {
+    return entry(sym)->str;
+}
+
+size_t
+lilc_sym_len(lilc_sym_t sym) {
+    return entry(sym)->len;
+}
+
+unsigned int
+lilc_sym_count(void) {
+    return __atomic_load_n(&tab.count, __ATOMIC_ACQUIRE);
+}
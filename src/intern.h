@@ -0,0 +1,27 @@
+#ifndef LILC_INTERN_H
+#define LILC_INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Global string-interning table. Every distinct identifier maps to a
+ * stable 32-bit symbol ID, so later stages compare names as integers.
+ * Symbols live for the lifetime of the process. Safe to use from
+ * several threads at once.
+ */
+typedef uint32_t lilc_sym_t;
+
+lilc_sym_t
+lilc_intern(const char *s, size_t len);
+
+const char *
+lilc_sym_str(lilc_sym_t sym);
+
+size_t
+lilc_sym_len(lilc_sym_t sym);
+
+unsigned int
+lilc_sym_count(void);
+
+#endif
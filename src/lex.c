@@ -1,19 +1,58 @@
-#include <ctype.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "intern.h"
 #include "lex.h"
+#include "num.h"
+#include "scan.h"
 #include "token.h"
 #include "util.h"
 
 void
-lex_init(struct lexer *l, char *source, char *path) {
+lex_init(struct lexer *l, const char *source, char *path) {
     l->filename = path;
     l->source = source;
     l->offset = 0;
-    l->lineno = 1;
+    l->tok_start = 0;
+    l->fd = -1;
+    l->window = NULL;
+    l->window_size = 0;
+    l->fill = SIZE_MAX;
+    l->base = 0;
+    l->eof = 1;
+    line_index_init(&l->lines);
     l->err = NULL;
+    l->diags = NULL;
+    l->broken = 0;
+}
+
+// Lex the stream behind `fd` through a window of `window_size` bytes,
+// so memory stays constant however long the input is. Tokens may span
+// refills, but must be shorter than the window.
+void
+lex_init_fd(struct lexer *l, int fd, char *path, size_t window_size) {
+    char *window = malloc(window_size + 1);
+    window[0] = '\0';
+    lex_init(l, window, path);
+    l->window = window;
+    l->fd = fd;
+    l->window_size = window_size;
+    l->fill = 0;
+    l->eof = 0;
+}
+
+// Release a streaming lexer's window and the line index, if either was
+// needed. Does not close the descriptor.
+void
+lex_close(struct lexer *l) {
+    free(l->window);
+    l->window = NULL;
+    line_index_free(&l->lines);
 }
 
 static void
@@ -21,99 +60,228 @@ err(struct lexer *l, char *msg) {
     l->err = msg;
 }
 
+// Slide the token being scanned to the front of the streaming window and
+// top the window up from the stream. Offsets into the window are rebased
+// to match. Returns the number of bytes read: 0 at end of stream, on read
+// error, or when the token already fills the whole window.
+static size_t
+lex_refill(struct lexer *l) {
+    if (l->eof) return 0;
+
+    // Bytes about to slide out of the window can't be indexed later on
+    size_t drop = l->base + l->tok_start;
+    if (drop > l->lines.indexed) {
+        line_index_add(&l->lines, l->window + (l->lines.indexed - l->base),
+                       drop - l->lines.indexed);
+    }
+
+    size_t keep = l->fill - l->tok_start;
+    memmove(l->window, l->window + l->tok_start, keep);
+    l->base += l->tok_start;
+    l->offset -= l->tok_start;
+    l->tok_start = 0;
+    l->fill = keep;
+
+    if (keep == l->window_size) {
+        err(l, "LEX - Token longer than the stream window\n");
+        l->broken = 1;
+        l->eof = 1;
+        return 0;
+    }
+
+    ssize_t r;
+    do {
+        r = read(l->fd, l->window + l->fill, l->window_size - l->fill);
+    } while (r < 0 && errno == EINTR);
+
+    if (r <= 0) {
+        if (r < 0) {
+            err(l, strerror(errno));
+            l->broken = 1;
+        }
+        l->eof = 1;
+        r = 0;
+    }
+    l->fill += r;
+    l->window[l->fill] = '\0';
+    return r;
+}
+
+// Length of the run matched by `scan` starting `at` bytes into the
+// current token. A run that reaches the end of a streaming window is
+// re-scanned once more input is in, so tokens spanning refills come
+// out whole.
+static inline size_t
+scan_run(struct lexer *l, size_t at, size_t (*scan)(const char *)) {
+    size_t len = scan(l->source + l->tok_start + at);
+    while (l->tok_start + at + len == l->fill && lex_refill(l)) {
+        len = scan(l->source + l->tok_start + at);
+    }
+    return len;
+}
+
+// Byte `at` bytes into the current token, reading more of a stream
+// first if it isn't buffered yet. NUL at the end of the input.
+static inline char
+lex_peek(struct lexer *l, size_t at) {
+    while (l->tok_start + at >= l->fill && lex_refill(l));
+    return l->source[l->tok_start + at];
+}
+
 static enum tok_type
 set_tok_type(struct lexer *l, enum tok_type t) {
     return l->tok.cls = t;
 }
 
-static void
-putback(struct lexer *l) {
-    l->offset--;
-}
+// Keyword table, addressed by a perfect hash of the keyword set:
+// (length + first char) & 7 is distinct for "def", "if" and "else".
+// Adding a keyword means re-checking that property.
+#define KW_HASH(s, len) (((len) + (unsigned char)(s)[0]) & 7)
+static const struct {
+    const char *str;
+    size_t len;
+    enum tok_type cls;
+} keywords[8] = {
+    [7] = {"def", 3, LILC_TOK_DEF},
+    [3] = {"if", 2, LILC_TOK_IF},
+    [1] = {"else", 4, LILC_TOK_ELSE},
+};
 
-#define MAX_IDENT 64
 // Tokenize an entire identifier.
-// Identifiers must be <= 64 char long and can contain
-// alphas, nums, and '_', but must start with an alpha.
+// Identifiers can contain alphas, nums, and '_', but must start with
+// an alpha. Non-keyword identifiers are interned straight from the
+// source buffer.
 static enum tok_type
-consume_id(struct lexer *l, char c) {
-    char buf[MAX_IDENT];
-    int i = 0;
-
-    do {
-        buf[i++] = c;
-    } while (
-        (isalpha(c = l->source[l->offset++]) || isdigit(c) || c == '_') &&
-        i < MAX_IDENT - 1
-    );
-    buf[i] = '\0';
-    putback(l);
+consume_id(struct lexer *l) {
+    size_t len = 1 + scan_run(l, 1, scan_ident);
+    if (l->err) return set_tok_type(l, LILC_TOK_ERR);
+    const char *start = l->source + l->tok_start;
+    l->offset = l->tok_start + len;
+    l->tok.len = len;
 
     // Keywords
-    if (strcmp(buf, "def") == 0) return set_tok_type(l, LILC_TOK_DEF);
-    if (strcmp(buf, "if") == 0) return set_tok_type(l, LILC_TOK_IF);
-    if (strcmp(buf, "else") == 0) return set_tok_type(l, LILC_TOK_ELSE);
+    int k = KW_HASH(start, len);
+    if (keywords[k].len == len && memcmp(keywords[k].str, start, len) == 0) {
+        return set_tok_type(l, keywords[k].cls);
+    }
 
     // Non-keyword identifier
-    l->tok.val.as_str = strdup(buf);
+    l->tok.val.as_sym = lilc_intern(start, len);
     return set_tok_type(l, LILC_TOK_ID);
 }
 
-// Tokenize an entire number.
-// Only floats supported for now
+// Tokenize an entire number:
+// digits ['.' digits] [('e' | 'E') ['+' | '-'] digits]
+// A '.' or exponent marker not followed by digits isn't part of it.
 static enum tok_type
-consume_number(struct lexer *l, char c) {
-    double n = 0;
-    do {
-        n = n * 10 + (c - '0');
-    } while (isdigit(c = l->source[l->offset++]));
-    putback(l);
+consume_number(struct lexer *l) {
+    size_t len = 1 + scan_run(l, 1, scan_digits);
+    if (lex_peek(l, len) == '.' && lilc_cc_is(lex_peek(l, len + 1), LILC_CC_DIGIT)) {
+        len += 1 + scan_run(l, len + 1, scan_digits);
+    }
+    char c = lex_peek(l, len);
+    if (c == 'e' || c == 'E') {
+        c = lex_peek(l, len + 1);
+        size_t sign = c == '+' || c == '-';
+        if (lilc_cc_is(lex_peek(l, len + 1 + sign), LILC_CC_DIGIT)) {
+            len += 1 + sign + scan_run(l, len + 1 + sign, scan_digits);
+        }
+    }
+    if (l->err) return set_tok_type(l, LILC_TOK_ERR);
 
-    l->tok.val.as_dbl = n;
+    l->offset = l->tok_start + len;
+    l->tok.len = len;
+    l->tok.val.as_dbl = lilc_strtod(l->source + l->tok_start, len);
     return set_tok_type(l, LILC_TOK_DBL);
 }
 
 // Scan the next token in the source input.
-// Returns the class of the scanned token, dies on error.
+// Returns the class of the scanned token, or ERR with `l->err` set.
 static enum tok_type
 _lex_scan(struct lexer *l) {
-    char c;
-    while (1) {
-        c = l->source[l->offset++];
-        switch (c) {
-            case '\n': l->lineno++;
-            case ' ':
-            case '\t': continue;
-            case ',': return set_tok_type(l, LILC_TOK_COMMA);
-            case ';': return set_tok_type(l, LILC_TOK_SEMI);
-            case '(': return set_tok_type(l, LILC_TOK_LPAREN);
-            case ')': return set_tok_type(l, LILC_TOK_RPAREN);
-            case '{': return set_tok_type(l, LILC_TOK_LCURL);
-            case '}': return set_tok_type(l, LILC_TOK_RCURL);
-            case '+': return set_tok_type(l, LILC_TOK_ADD);
-            case '-': return set_tok_type(l, LILC_TOK_SUB);
-            case '*': return set_tok_type(l, LILC_TOK_MUL);
-            case '/': return set_tok_type(l, LILC_TOK_DIV);
-            case '<': return set_tok_type(l, LILC_TOK_CMPLT);
-            case '\0': return set_tok_type(l, LILC_TOK_EOS);
-            default:
-                if (isalpha(c)) return consume_id(l, c);
-                if (isdigit(c)) return consume_number(l, c);
-                err(l, "LEX - Unrecognized input character\n");
-                return set_tok_type(l, LILC_TOK_ERR);
-        }
+    // Whitespace runs are skipped in bulk
+    do {
+        l->offset += scan_space(l->source + l->offset);
+        l->tok_start = l->offset;
+    } while (l->offset == l->fill && lex_refill(l));
+
+    if (l->err) return set_tok_type(l, LILC_TOK_ERR);
+
+    l->tok.offset = l->base + l->tok_start;
+    l->tok.len = 1;
+
+    char c = l->source[l->offset++];
+    switch (c) {
+        case ',': return set_tok_type(l, LILC_TOK_COMMA);
+        case ';': return set_tok_type(l, LILC_TOK_SEMI);
+        case '(': return set_tok_type(l, LILC_TOK_LPAREN);
+        case ')': return set_tok_type(l, LILC_TOK_RPAREN);
+        case '{': return set_tok_type(l, LILC_TOK_LCURL);
+        case '}': return set_tok_type(l, LILC_TOK_RCURL);
+        case '+': return set_tok_type(l, LILC_TOK_ADD);
+        case '-': return set_tok_type(l, LILC_TOK_SUB);
+        case '*': return set_tok_type(l, LILC_TOK_MUL);
+        case '/': return set_tok_type(l, LILC_TOK_DIV);
+        case '<': return set_tok_type(l, LILC_TOK_CMPLT);
+        case '@': return set_tok_type(l, LILC_TOK_AT);
+        case '\0': return set_tok_type(l, LILC_TOK_EOS);
+        default:
+            if (lilc_cc_is(c, LILC_CC_ALPHA)) return consume_id(l);
+            if (lilc_cc_is(c, LILC_CC_DIGIT)) return consume_number(l);
+            err(l, "LEX - Unrecognized input character\n");
+            return set_tok_type(l, LILC_TOK_ERR);
     }
 }
 
+// Scan the next token. Errors are reported through `lex_report`; when
+// that returns, a bad character is skipped, and a stream that can't be
+// read any further ends as if it were complete.
 enum tok_type
 lex_scan(struct lexer *l) {
     enum tok_type t;
-    if ((t = _lex_scan(l)) == LILC_TOK_ERR) {
-        die(l->filename, l->lineno, l->err);
+    while ((t = _lex_scan(l)) == LILC_TOK_ERR) {
+        lex_report(l, l->base + l->tok_start, l->err);
+        l->err = NULL;
+        if (l->broken) {
+            l->tok.offset = l->base + l->fill;
+            l->tok.len = 0;
+            return set_tok_type(l, LILC_TOK_EOS);
+        }
     }
     return t;
 }
 
+// Line and column of byte `offset` of the input, indexing newlines up to
+// there if that hasn't been done yet. A streaming lexer can only look up
+// offsets it has read.
+struct src_pos
+lex_locate(struct lexer *l, size_t offset) {
+    if (offset >= l->lines.indexed) {
+        size_t end = offset + 1;
+        if (end > l->base + l->fill) end = l->base + l->fill;
+        if (end > l->lines.indexed) {
+            line_index_add(&l->lines, l->source + (l->lines.indexed - l->base),
+                           end - l->lines.indexed);
+        }
+    }
+    return line_index_lookup(&l->lines, offset);
+}
+
+// Print `msg` as an error at byte `offset` of the input and exit.
+void
+lex_die(struct lexer *l, size_t offset, char *msg) {
+    struct src_pos pos = lex_locate(l, offset);
+    die_at(l->filename, pos.line, pos.col, msg);
+}
+
+// Add an error at byte `offset` to the lexer's diagnostics, or die with
+// it if it has none. A trailing newline is dropped from the message.
+void
+lex_report(struct lexer *l, size_t offset, const char *msg) {
+    if (!l->diags) lex_die(l, offset, (char *)msg);
+    diag_push(l->diags, offset, lex_locate(l, offset), msg);
+}
+
 // Return 1 if current token is type `t`,
 // 0 otherwise.
 int
@@ -134,9 +302,9 @@ lex_consume(struct lexer *l, enum tok_type t) {
     }
 }
 
-// Assert current token type, failing hard.
+// Assert current token type.
 // If assertion passes, returns 1 and advances lexer,
-// otherwise prints an error message and dies.
+// otherwise reports an error and returns 0.
 int
 lex_consumef(struct lexer *l, enum tok_type t) {
     if (!lex_consume(l, t)) {
@@ -148,7 +316,8 @@ lex_consumef(struct lexer *l, enum tok_type t) {
             lilc_token_str[t],
             lilc_token_str[l->tok.cls]
         );
-        die(l->filename, l->lineno, buf);
+        lex_report(l, l->tok.offset, buf);
+        return 0;
     }
     return 1;
 }
@@ -169,7 +338,7 @@ tok_strm_readf(char *buf, struct lexer *l) {
                 break;
             case LILC_TOK_ID:
                 i += sprintf(buf + i, "%s,", lilc_token_str[l->tok.cls]);
-                i += sprintf(buf + i, "%s", l->tok.val.as_str);
+                i += sprintf(buf + i, "%s", lilc_sym_str(l->tok.val.as_sym));
                 break;
             default:
                 i += sprintf(buf + i, "%s", lilc_token_str[l->tok.cls]);
@@ -179,3 +348,149 @@ tok_strm_readf(char *buf, struct lexer *l) {
     }
     return i;
 }
+
+void
+tok_strm_init(struct tok_strm *ts) {
+    kv_init(ts->kinds);
+    kv_init(ts->offsets);
+    kv_init(ts->payloads);
+    kv_init(ts->dbls);
+}
+
+void
+tok_strm_free(struct tok_strm *ts) {
+    kv_destroy(ts->kinds);
+    kv_destroy(ts->offsets);
+    kv_destroy(ts->payloads);
+    kv_destroy(ts->dbls);
+    tok_strm_init(ts);
+}
+
+// Scan the next token, as `lex_scan`, ending the input at any token too
+// far in for a token stream's 32-bit offsets.
+static enum tok_type
+lex_next(struct lexer *l) {
+    enum tok_type t = lex_scan(l);
+    if (l->tok.offset > UINT32_MAX) {
+        lex_report(l, UINT32_MAX, "Source too large for a token stream (4 GB max)\n");
+        l->tok.offset = UINT32_MAX;
+        t = LILC_TOK_EOS;
+    }
+    return t;
+}
+
+// Append a token to the end of a token stream
+static inline void
+tok_strm_push(struct tok_strm *ts, enum tok_type t, uint32_t offset, lilc_sym_t sym, double dbl) {
+    uint32_t payload = 0;
+    if (t == LILC_TOK_ID) {
+        payload = sym;
+    } else if (t == LILC_TOK_DBL) {
+        payload = kv_size(ts->dbls);
+        kv_push(double, ts->dbls, dbl);
+    }
+
+    kv_push(uint8_t, ts->kinds, t);
+    kv_push(uint32_t, ts->offsets, offset);
+    kv_push(uint32_t, ts->payloads, payload);
+}
+
+static inline int
+tok_strm_done(struct tok_strm *ts) {
+    return kv_size(ts->kinds) && kv_A(ts->kinds, kv_size(ts->kinds) - 1) == LILC_TOK_EOS;
+}
+
+// Lex up to `max` more tokens from `l` onto the end of a token stream,
+// stopping after EOS. Returns the number of tokens added. Errors are
+// reported as by `lex_scan`.
+size_t
+tok_strm_fill(struct tok_strm *ts, struct lexer *l, size_t max) {
+    size_t n = 0;
+    if (tok_strm_done(ts)) return 0;
+
+    enum tok_type t;
+    do {
+        t = lex_next(l);
+        tok_strm_push(ts, t, l->tok.offset, l->tok.val.as_sym, l->tok.val.as_dbl);
+    } while (t != LILC_TOK_EOS && ++n < max);
+
+    return t == LILC_TOK_EOS ? n + 1 : n;
+}
+
+// Lex everything remaining in `l` onto the end of a token stream,
+// up to and including the EOS token.
+void
+tok_strm_lex(struct tok_strm *ts, struct lexer *l) {
+    tok_strm_fill(ts, l, SIZE_MAX);
+}
+
+/*
+ * Token ring. Each side only ever writes its own counter, and keeps a
+ * copy of the other side's that it rereads only once the ring looks full
+ * (to the lexer) or empty (to the parser), so in the steady state the
+ * two threads rarely touch the same cache line. Counters run freely;
+ * slot `i` lives at `i % TOK_RING_SIZE`.
+ */
+void
+tok_ring_init(struct tok_ring *r) {
+    r->head = 0;
+    r->tail_seen = 0;
+    r->tail = 0;
+    r->head_seen = 0;
+}
+
+// Spin until `*counter` moves past `seen`, giving up the CPU between
+// looks once it's been a while. Returns its new value.
+static size_t
+tok_ring_wait(size_t *counter, size_t seen) {
+    size_t now;
+    for (unsigned int spins = 0; (now = __atomic_load_n(counter, __ATOMIC_ACQUIRE)) == seen; spins++) {
+        if (spins >= 64) sched_yield();
+    }
+    return now;
+}
+
+// Lex everything remaining in `l` into the ring, up to and including
+// the EOS token, waiting for room whenever it fills up. Meant to run on
+// a thread of its own, with one consumer draining the ring.
+void
+tok_ring_lex(struct tok_ring *r, struct lexer *l) {
+    size_t head = r->head;
+    enum tok_type t;
+    do {
+        if (head - r->tail_seen == TOK_RING_SIZE) {
+            r->tail_seen = tok_ring_wait(&r->tail, r->tail_seen);
+        }
+        t = lex_next(l);
+        struct tok_slot *s = &r->slots[head % TOK_RING_SIZE];
+        s->kind = t;
+        s->offset = l->tok.offset;
+        if (t == LILC_TOK_DBL) {
+            s->val.dbl = l->tok.val.as_dbl;
+        } else {
+            s->val.sym = l->tok.val.as_sym;
+        }
+        __atomic_store_n(&r->head, ++head, __ATOMIC_RELEASE);
+    } while (t != LILC_TOK_EOS);
+}
+
+// Move up to `max` tokens from the ring onto the end of a token stream,
+// waiting for the lexer if there are none yet. Returns the number moved,
+// which is 0 only once the stream has been given its EOS.
+size_t
+tok_ring_drain(struct tok_ring *r, struct tok_strm *ts, size_t max) {
+    if (tok_strm_done(ts)) return 0;
+
+    size_t tail = r->tail;
+    if (tail == r->head_seen) {
+        r->head_seen = tok_ring_wait(&r->head, tail);
+    }
+    size_t n = r->head_seen - tail;
+    if (n > max) n = max;
+    for (size_t i = 0; i < n; i++) {
+        struct tok_slot *s = &r->slots[(tail + i) % TOK_RING_SIZE];
+        tok_strm_push(ts, s->kind, s->offset, s->val.sym, s->val.dbl);
+    }
+    __atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
@@ -1,22 +1,59 @@
 #ifndef LILC_LEX_H
 #define LILC_LEX_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kvec.h"
+
+#include "loc.h"
 #include "token.h"
 
+// Default window size for streaming lexers, which also bounds the
+// length of a token they can handle.
+#define LEX_STREAM_WINDOW (64 * 1024)
+
 // Lexer state
 struct lexer {
-    char *source;     // Pointer to in-memory source code buffer
-    int offset;       // Character offset into source buffer
+    const char *source;  // Pointer to in-memory, NUL-terminated source buffer
+    size_t offset;       // Character offset into source buffer
+    size_t tok_start;    // Offset of the token being scanned
     struct token tok; // Tokenized interpretation of current character
+    // Streaming input (see `lex_init_fd`). `source` is then a fixed-size
+    // window onto the stream, slid forward and refilled as the scanner
+    // reaches its end. For in-memory buffers `fill` is SIZE_MAX.
+    int fd;
+    char *window;
+    size_t window_size;
+    size_t fill;         // Bytes currently buffered in the window
+    size_t base;         // Stream position of window[0]
+    int eof;
     // Error reporting
     char *filename;
-    int lineno;       // Current line number (number '\n' chars seen so far)
+    struct line_index lines;  // Built on demand, see `lex_locate`
     char *err;
+    lilc_diags_t *diags;      // Where errors are reported, NULL to die on them
+    int broken;               // Stream can't be read any further
 };
 
 
 void
-lex_init(struct lexer *l, char *source, char *path);
+lex_init(struct lexer *l, const char *source, char *path);
+
+void
+lex_init_fd(struct lexer *l, int fd, char *path, size_t window_size);
+
+void
+lex_close(struct lexer *l);
+
+struct src_pos
+lex_locate(struct lexer *l, size_t offset);
+
+void
+lex_die(struct lexer *l, size_t offset, char *msg);
+
+void
+lex_report(struct lexer *l, size_t offset, const char *msg);
 
 int
 lex_is(struct lexer *l, enum tok_type t);
@@ -33,4 +70,66 @@ lex_scan(struct lexer *l);
 int
 tok_strm_readf(char *buf, struct lexer *l);
 
+/*
+ * Pre-tokenized input, stored as parallel arrays so the parser can walk
+ * it by index. Token `i` has class `kinds[i]`, starts at byte `offsets[i]`
+ * and, for identifiers and numbers, carries `payloads[i]`: the symbol ID
+ * or an index into `dbls` respectively. The stream ends with an EOS token.
+ * Line numbers come from the lexer's line index, via `lex_locate`.
+ */
+struct tok_strm {
+    kvec_t(uint8_t) kinds;
+    kvec_t(uint32_t) offsets;
+    kvec_t(uint32_t) payloads;
+    kvec_t(double) dbls;
+};
+
+void
+tok_strm_init(struct tok_strm *ts);
+
+void
+tok_strm_free(struct tok_strm *ts);
+
+size_t
+tok_strm_fill(struct tok_strm *ts, struct lexer *l, size_t max);
+
+void
+tok_strm_lex(struct tok_strm *ts, struct lexer *l);
+
+/*
+ * Lock-free ring of tokens passed from a lexer on one thread to a parser
+ * on another (one of each). The lexer fills it with `tok_ring_lex`, and
+ * the parser moves tokens out onto its token stream with `tok_ring_drain`
+ * as it needs them.
+ */
+#define TOK_RING_SIZE 4096  // Slots, a power of two
+
+struct tok_slot {
+    uint8_t kind;
+    uint32_t offset;
+    union {
+        lilc_sym_t sym;
+        double dbl;
+    } val;
+};
+
+struct tok_ring {
+    struct tok_slot slots[TOK_RING_SIZE];
+    // Written by the lexer
+    size_t head __attribute__((aligned(64)));  // Tokens put in so far
+    size_t tail_seen;                          // Last `tail` it looked at
+    // Written by the parser
+    size_t tail __attribute__((aligned(64)));  // Tokens taken out so far
+    size_t head_seen;                          // Last `head` it looked at
+};
+
+void
+tok_ring_init(struct tok_ring *r);
+
+void
+tok_ring_lex(struct tok_ring *r, struct lexer *l);
+
+size_t
+tok_ring_drain(struct tok_ring *r, struct tok_strm *ts, size_t max);
+
 #endif
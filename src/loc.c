@@ -0,0 +1,62 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "kvec.h"
+
+#include "loc.h"
+#include "scan.h"
+
+void
+line_index_init(struct line_index *ix) {
+    kv_init(ix->starts);
+    ix->indexed = 0;
+}
+
+void
+line_index_free(struct line_index *ix) {
+    kv_destroy(ix->starts);
+    line_index_init(ix);
+}
+
+// Extend the index over the next `len` bytes of the text, `text` pointing
+// at the first byte not yet indexed.
+void
+line_index_add(struct line_index *ix, const char *text, size_t len) {
+    if (kv_size(ix->starts) == 0) kv_push(size_t, ix->starts, 0);
+
+    size_t i = 0;
+    while ((i += scan_newline(text + i, len - i)) < len) {
+        i++;
+        kv_push(size_t, ix->starts, ix->indexed + i);
+    }
+    ix->indexed += len;
+}
+
+// Line and column of byte `offset`, which must be in the indexed text
+// or just past its end.
+struct src_pos
+line_index_lookup(const struct line_index *ix, size_t offset) {
+    // Last line starting at or before `offset`
+    size_t lo = 0, hi = kv_size(ix->starts);
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (kv_A(ix->starts, mid) <= offset) lo = mid;
+        else hi = mid;
+    }
+    size_t start = hi ? kv_A(ix->starts, lo) : 0;
+    return (struct src_pos){lo + 1, offset - start + 1};
+}
+
+// Add an error at byte `offset`, found at `pos`, to `diags`. A trailing
+// newline is dropped from the message.
+void
+diag_push(lilc_diags_t *diags, size_t offset, struct src_pos pos, const char *msg) {
+    struct lilc_diag d;
+    d.offset = offset;
+    d.pos = pos;
+    snprintf(d.msg, DIAG_MSG_MAX, "%s", msg);
+    size_t len = strlen(d.msg);
+    if (len && d.msg[len - 1] == '\n') d.msg[len - 1] = '\0';
+    kv_push(struct lilc_diag, *diags, d);
+}
@@ -0,0 +1,52 @@
+#ifndef LILC_LOC_H
+#define LILC_LOC_H
+
+#include <stddef.h>
+
+#include "kvec.h"
+
+/*
+ * Source locations are carried around as byte offsets, and only turned
+ * into line and column numbers when a diagnostic needs to show one. The
+ * index of line starts that takes is built lazily: it covers the text
+ * from the start up to as far as it's been asked about.
+ */
+struct line_index {
+    kvec_t(size_t) starts;  // Offset of the first byte of each line
+    size_t indexed;         // Bytes scanned for newlines so far
+};
+
+// 1-based line and byte column
+struct src_pos {
+    int line;
+    int col;
+};
+
+// A problem found in the source, at byte `offset`. Messages are copied
+// in, truncated to fit.
+#define DIAG_MSG_MAX 128
+
+struct lilc_diag {
+    size_t offset;
+    struct src_pos pos;
+    char msg[DIAG_MSG_MAX];
+};
+
+typedef kvec_t(struct lilc_diag) lilc_diags_t;
+
+void
+line_index_init(struct line_index *ix);
+
+void
+line_index_free(struct line_index *ix);
+
+void
+line_index_add(struct line_index *ix, const char *text, size_t len);
+
+struct src_pos
+line_index_lookup(const struct line_index *ix, size_t offset);
+
+void
+diag_push(lilc_diags_t *diags, size_t offset, struct src_pos pos, const char *msg);
+
+#endif
@@ -0,0 +1,140 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "kvec.h"
+
+#include "ast.h"
+#include "intern.h"
+#include "memo.h"
+
+// A function, numbered in the order they're defined, as resolved
+struct memo_func {
+    struct lilc_funcdef_node_t *def;
+    unsigned int self_calls;  // Places it calls itself from
+    int impure;
+};
+
+// A call between two functions
+struct memo_call {
+    uint32_t from;
+    uint32_t to;
+};
+
+struct purity {
+    struct ast_visitor v;
+    kvec_t(struct memo_func) funcs;
+    kvec_t(struct memo_call) calls;
+    kvec_t(uint32_t) defining;  // Functions whose bodies are being walked
+};
+
+static enum ast_walk_action
+purity_enter(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct purity *p = (struct purity *)v;
+    switch (node->type) {
+        case LILC_NODE_FUNCDEF: {
+            struct lilc_funcdef_node_t *def = (struct lilc_funcdef_node_t *)node;
+            struct memo_func f = {def, 0, !def->body};
+            kv_push(uint32_t, p->defining, kv_size(p->funcs));
+            kv_push(struct memo_func, p->funcs, f);
+            break;
+        }
+        case LILC_NODE_FUNCCALL: {
+            // Calls from the top level are no function's
+            size_t n = kv_size(p->defining);
+            if (!n) break;
+            struct memo_call c = {kv_A(p->defining, n - 1), ((struct lilc_funccall_node_t *)node)->func};
+            if (c.to == LILC_UNRESOLVED) {
+                kv_A(p->funcs, c.from).impure = 1;
+            } else if (c.to == c.from) {
+                kv_A(p->funcs, c.from).self_calls++;
+            } else {
+                kv_push(struct memo_call, p->calls, c);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return AST_DESCEND;
+}
+
+static enum ast_walk_action
+purity_leave(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct purity *p = (struct purity *)v;
+    if (node->type == LILC_NODE_FUNCDEF) kv_pop(p->defining);
+    return AST_DESCEND;
+}
+
+// Spread impurity from each function to those calling it
+static void
+spread_impurity(struct purity *p) {
+    // Callers grouped by the function they call
+    size_t n = kv_size(p->funcs);
+    size_t *first = calloc(n + 1, sizeof(size_t));
+    uint32_t *from = malloc(sizeof(uint32_t) * (kv_size(p->calls) + 1));
+    for (size_t i = 0; i < kv_size(p->calls); i++) first[kv_A(p->calls, i).to + 1]++;
+    for (size_t f = 0; f < n; f++) first[f + 1] += first[f];
+    size_t *fill = malloc(sizeof(size_t) * (n + 1));
+    for (size_t f = 0; f < n; f++) fill[f] = first[f];
+    for (size_t i = 0; i < kv_size(p->calls); i++) {
+        struct memo_call c = kv_A(p->calls, i);
+        from[fill[c.to]++] = c.from;
+    }
+
+    kvec_t(uint32_t) work;
+    kv_init(work);
+    for (size_t f = 0; f < n; f++) {
+        if (kv_A(p->funcs, f).impure) kv_push(uint32_t, work, f);
+    }
+    while (kv_size(work)) {
+        uint32_t f = kv_pop(work);
+        for (size_t i = first[f]; i < first[f + 1]; i++) {
+            struct memo_func *caller = &kv_A(p->funcs, from[i]);
+            if (caller->impure) continue;
+            caller->impure = 1;
+            kv_push(uint32_t, work, from[i]);
+        }
+    }
+
+    kv_destroy(work);
+    free(first);
+    free(from);
+    free(fill);
+}
+
+int
+memoize(struct lilc_node_t *root, enum memo_mode mode) {
+    struct purity p = {{purity_enter, NULL, purity_leave}};
+    kv_init(p.funcs);
+    kv_init(p.calls);
+    kv_init(p.defining);
+    ast_walk(root, &p.v);
+    spread_impurity(&p);
+
+    int marked = 0;
+    for (size_t f = 0; f < kv_size(p.funcs); f++) {
+        struct memo_func *mf = &kv_A(p.funcs, f);
+        if (mf->impure) {
+            mf->def->memo = 0;
+        } else if (mode == LILC_MEMO_AUTO && mf->self_calls > 1) {
+            mf->def->memo = 1;
+        }
+        marked += mf->def->memo;
+    }
+
+    kv_destroy(p.funcs);
+    kv_destroy(p.calls);
+    kv_destroy(p.defining);
+    return marked;
+}
+
+// Write out what each cache did, a line per function
+void
+memo_stats_dump(FILE *f, const memo_stats_t *stats) {
+    for (size_t i = 0; i < kv_size(*stats); i++) {
+        const struct memo_stats *s = &kv_A(*stats, i);
+        fprintf(f, "memo: %s: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " evictions\n",
+                lilc_sym_str(s->name), s->hits, s->misses, s->evictions);
+    }
+}
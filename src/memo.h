@@ -0,0 +1,56 @@
+#ifndef LILC_MEMO_H
+#define LILC_MEMO_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "kvec.h"
+
+#include "ast.h"
+#include "intern.h"
+
+/*
+ * Memoization. Codegen gives a function marked `memo`, with `@memo` or by
+ * `memoize`, a cache of the results it returns, keyed on the bits of its
+ * arguments. The cache is direct-mapped: each set of arguments has the
+ * one slot, picked by hashing them, and a result stored there evicts the
+ * one that was. It counts its hits, misses and evictions as it goes, for
+ * `lilc_eval_stats` to read back.
+ */
+#define LILC_MEMO_SLOT_BITS 12
+#define LILC_MEMO_SLOTS (1 << LILC_MEMO_SLOT_BITS)
+
+enum memo_mode {
+    LILC_MEMO_ANNOTATED,  // Only what's marked @memo
+    LILC_MEMO_AUTO,       // That, and pure functions recursing more than once
+};
+
+/*
+ * Purity analysis, run on a tree once it's resolved. There are no side
+ * effects in lilc, so a function is pure unless it calls something that
+ * isn't known to be: a call that didn't resolve, a function whose body
+ * hasn't been parsed (see parse_body), or a function that calls either.
+ * Functions marked but not pure are unmarked.
+ *
+ * In auto mode, pure functions calling themselves from more than one
+ * place are marked too, as those calls are likely to repeat each other's
+ * work. A function calling itself once never would. Returns how many
+ * functions are marked.
+ */
+int
+memoize(struct lilc_node_t *root, enum memo_mode mode);
+
+// What a memoized function's cache did while the program ran
+struct memo_stats {
+    lilc_sym_t name;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+typedef kvec_t(struct memo_stats) memo_stats_t;
+
+void
+memo_stats_dump(FILE *f, const memo_stats_t *stats);
+
+#endif
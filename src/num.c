@@ -0,0 +1,93 @@
+#include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "num.h"
+
+// Powers of ten that are exact as doubles
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#define MAX_POW10 22
+#define MAX_MANTISSA (1ull << 53)  // Integers up to here are exact as doubles
+#define MAX_DIGITS 19              // Any 19-digit number fits in 64 bits
+
+static inline int
+is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Hand anything the fast path can't do exactly to the C library, which
+// needs a NUL-terminated copy.
+static double
+slow_path(const char *s, size_t len) {
+    char buf[64];
+    char *copy = len < sizeof(buf) ? buf : malloc(len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    double d = strtod(copy, NULL);
+    if (copy != buf) free(copy);
+    return d;
+}
+
+// Convert a decimal literal, as described in num.h.
+//
+// Most literals in source code are short: a mantissa of at most 15 or
+// so significant digits and a small exponent. Then both the mantissa and
+// the power of ten are exact doubles, and a single IEEE multiply or divide
+// rounds their product or quotient correctly (Clinger's fast path).
+// Everything else goes through `strtod`.
+double
+lilc_strtod(const char *s, size_t len) {
+    const char *p = s, *end = s + len;
+    uint64_t w = 0;  // Significant digits, as an integer
+    int digits = 0;  // How many of them, leading zeros excluded
+    int exp10 = 0;
+
+    for (; p < end && is_digit(*p); p++) {
+        if (w == 0 && *p == '0') continue;
+        if (++digits > MAX_DIGITS) return slow_path(s, len);
+        w = w * 10 + (*p - '0');
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && is_digit(*p); p++) {
+            exp10--;
+            if (w == 0 && *p == '0') continue;
+            if (++digits > MAX_DIGITS) return slow_path(s, len);
+            w = w * 10 + (*p - '0');
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        int neg = 0, e = 0;
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) neg = *p++ == '-';
+        for (; p < end && is_digit(*p); p++) {
+            if (e < 100000) e = e * 10 + (*p - '0');
+        }
+        exp10 += neg ? -e : e;
+    }
+
+    if (w == 0) return 0.0;
+
+    // Only sound if double arithmetic isn't carried out at a wider
+    // precision, as on x87.
+#if FLT_EVAL_METHOD == 0
+    if (w <= MAX_MANTISSA) {
+        if (exp10 >= 0 && exp10 <= MAX_POW10) return (double)w * exact_pow10[exp10];
+        if (exp10 < 0 && exp10 >= -MAX_POW10) return (double)w / exact_pow10[-exp10];
+
+        // 1.5e25 is 15e24 is 150e23, and so on: move spare powers of ten
+        // into the mantissa while it stays exact.
+        while (exp10 > MAX_POW10 && w <= MAX_MANTISSA / 10) {
+            w *= 10;
+            exp10--;
+        }
+        if (exp10 == MAX_POW10) return (double)w * exact_pow10[MAX_POW10];
+    }
+#endif
+
+    return slow_path(s, len);
+}
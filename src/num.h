@@ -0,0 +1,14 @@
+#ifndef LILC_NUM_H
+#define LILC_NUM_H
+
+#include <stddef.h>
+
+/*
+ * Number literal conversion. `s` holds `len` bytes of the form
+ * digits ['.' digits] [('e' | 'E') ['+' | '-'] digits], not necessarily
+ * NUL-terminated. The result is correctly rounded, same as `strtod`.
+ */
+double
+lilc_strtod(const char *s, size_t len);
+
+#endif
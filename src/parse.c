@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,88 +6,214 @@
 #include "kvec.h"
 
 #include "ast.h"
+#include "intern.h"
 #include "lex.h"
 #include "parse.h"
+#include "scan.h"
 #include "token.h"
 #include "util.h"
 
+// Nodes are allocated from `arena`, and live as long as it does. Errors
+// from `l` are collected along with the parser's own.
+void
+parser_init(struct parser *p, struct lexer *l, struct arena *arena) {
+    p->lex = l;
+    p->pos = 0;
+    p->depth = 0;
+    p->arena = arena;
+    p->cons = NULL;
+    p->pipelined = 0;
+    p->lazy = 0;
+    p->ring = NULL;
+    tok_strm_init(&p->toks);
+    kv_init(p->scratch);
+    kv_init(p->diags);
+    l->diags = &p->diags;
+}
+
+void
+parser_free(struct parser *p) {
+    tok_strm_free(&p->toks);
+    kv_destroy(p->scratch);
+    kv_destroy(p->diags);
+}
+
+/*
+ * Token stream cursor. Tokens are addressed by their index in `p->toks`;
+ * `p->pos` is the current token, and any token up to the trailing EOS
+ * can be looked at directly. `parse` lexes the whole input up front, but
+ * a partially filled stream is topped up in batches as the cursor reaches
+ * its end: from the lexer, or when pipelined, from the lexer thread's
+ * token ring.
+ */
+#define TOK_BATCH 256
+
+static inline size_t
+refill(struct parser *p) {
+    if (p->ring) return tok_ring_drain(p->ring, &p->toks, TOK_BATCH);
+    return tok_strm_fill(&p->toks, p->lex, TOK_BATCH);
+}
+
+static inline void
+need(struct parser *p, uint32_t t) {
+    while (t >= kv_size(p->toks.kinds) && refill(p));
+}
+
+static inline enum tok_type
+tok_kind(struct parser *p, uint32_t t) {
+    return kv_A(p->toks.kinds, t);
+}
+
+static inline lilc_sym_t
+tok_sym(struct parser *p, uint32_t t) {
+    return kv_A(p->toks.payloads, t);
+}
+
+static inline double
+tok_dbl(struct parser *p, uint32_t t) {
+    return kv_A(p->toks.dbls, kv_A(p->toks.payloads, t));
+}
+
+// Class of the token `k` places past the current one
+static inline enum tok_type
+peek(struct parser *p, uint32_t k) {
+    need(p, p->pos + k);
+    uint32_t last = kv_size(p->toks.kinds) - 1;
+    return tok_kind(p, p->pos + k < last ? p->pos + k : last);
+}
+
+// Return 1 if current token is type `t`, 0 otherwise.
+static inline int
+at(struct parser *p, enum tok_type t) {
+    return tok_kind(p, p->pos) == t;
+}
+
+// Move past the current token, returning its index. Never moves past EOS.
+static inline uint32_t
+advance(struct parser *p) {
+    uint32_t t = p->pos;
+    if (!at(p, LILC_TOK_EOS)) need(p, ++p->pos);
+    return t;
+}
+
+// If the current token is type `t`, returns 1 and advances,
+// otherwise returns 0 and does not advance.
+static int
+accept(struct parser *p, enum tok_type t) {
+    if (at(p, t)) {
+        advance(p);
+        return 1;
+    }
+    return 0;
+}
+
+// Report an error at the current token. Returns NULL, for passing
+// failure up to the statement being parsed. While pipelined, the lexer
+// belongs to the other thread, so the position is looked up afterwards.
 static void *
 err(struct parser *p, char *msg) {
-    p->err = msg;
+    size_t offset = kv_A(p->toks.offsets, p->pos);
+    if (p->ring) {
+        diag_push(&p->diags, offset, (struct src_pos){0, 0}, msg);
+    } else {
+        lex_report(p->lex, offset, msg);
+    }
     return NULL;
 }
 
-void
-parser_init(struct parser *p, struct lexer *l) {
-    p->lex = l;
+// Assert current token type.
+// If assertion passes, returns 1 and advances,
+// otherwise reports an error and returns 0.
+static int
+expect(struct parser *p, enum tok_type t) {
+    if (!accept(p, t)) {
+        char buf[128];
+        snprintf(
+            buf,
+            128,
+            "expect: Expected '%s' but saw '%s'\n",
+            lilc_token_str[t],
+            lilc_token_str[tok_kind(p, p->pos)]
+        );
+        err(p, buf);
+        return 0;
+    }
+    return 1;
+}
+
+// Record token `t` as where `node` starts in the source
+static inline struct lilc_node_t *
+located(struct parser *p, uint32_t t, void *node) {
+    ((struct lilc_node_t *)node)->offset = kv_A(p->toks.offsets, t);
+    return node;
 }
 
 // Interface for parsing-related functionality for each token type.
+// Prefix and infix functions get the index of the token they were
+// dispatched on.
 struct vtable {
     int lbp;  // Left Binding Power
-    struct lilc_node_t *(*as_prefix)(struct parser *p, struct token t);
-    struct lilc_node_t *(*as_infix)(struct parser *p, struct token t, struct lilc_node_t *left);
+    struct lilc_node_t *(*as_prefix)(struct parser *p, uint32_t t);
+    struct lilc_node_t *(*as_infix)(struct parser *p, uint32_t t, struct lilc_node_t *left);
     void (*repr)(void);
 };
 
 // Forward declarations
 struct vtable vtables[];
 static struct lilc_node_t *expression(struct parser *p, int rbp);
-static struct lilc_node_t * block(struct parser *p);
+static struct lilc_node_t * block(struct parser *p, int top);
 
 /*
  * `as_prefix` and `as_infix` (`nud` and `led` respectively in Pratt's lingo)
- * implementations for each token class
- * TODO: Implement error checking, otherwise it'll SEGFAULT on bad input
+ * implementations for each token class. On a syntax error they report it
+ * and return NULL, leaving recovery to `block`.
  */
 
 /*
 DBL
 */
 static struct lilc_node_t *
-dbl_prefix(struct parser *p, struct token t) {
-    return (struct lilc_node_t *)lilc_dbl_node_new(t.val.as_dbl);
+dbl_prefix(struct parser *p, uint32_t t) {
+    if (p->cons) {
+        return (struct lilc_node_t *)lilc_dbl_node_cons(p->cons, tok_dbl(p, t), kv_A(p->toks.offsets, t));
+    }
+    return located(p, t, lilc_dbl_node_new(p->arena, tok_dbl(p, t)));
 }
 
 /*
 ID
 */
 static struct lilc_node_t *
-id_prefix(struct parser *p, struct token t) {
-    return (struct lilc_node_t *)lilc_var_node_new(t.val.as_str);
+id_prefix(struct parser *p, uint32_t t) {
+    if (p->cons) {
+        return (struct lilc_node_t *)lilc_var_node_cons(p->cons, tok_sym(p, t), kv_A(p->toks.offsets, t));
+    }
+    return located(p, t, lilc_var_node_new(p->arena, tok_sym(p, t)));
 }
 
 /*
 if => IF LPAREN expr RPAREN LCURL block RCURL elif* else?
 */
 static struct lilc_node_t *
-if_prefix(struct parser *p, struct token t) {
-    lex_consumef(p->lex, LILC_TOK_LPAREN);
+if_prefix(struct parser *p, uint32_t t) {
+    if (!expect(p, LILC_TOK_LPAREN)) return NULL;
 
     struct lilc_node_t *cond = expression(p, 0);
+    if (!cond) return NULL;
 
-    lex_consumef(p->lex, LILC_TOK_RPAREN);
-    lex_consumef(p->lex, LILC_TOK_LCURL);
-
-    struct lilc_block_node_t *then_block = (struct lilc_block_node_t *)block(p);
+    if (!expect(p, LILC_TOK_RPAREN) || !expect(p, LILC_TOK_LCURL)) return NULL;
 
-    lex_consumef(p->lex, LILC_TOK_RCURL);
+    struct lilc_block_node_t *then_block = (struct lilc_block_node_t *)block(p, 0);
 
-    struct lilc_if_node_t *node = lilc_if_node_new(cond, then_block);
-    if (!node) {
-        return err(p, "if: Could not allocate 'if' node\n");
-    }
-
-    if (lex_consume(p->lex, LILC_TOK_ELSE)) {
-        lex_consumef(p->lex, LILC_TOK_LCURL);
+    if (!expect(p, LILC_TOK_RCURL)) return NULL;
 
-        struct lilc_block_node_t *else_block = (struct lilc_block_node_t *)block(p);
-        if (!(node->else_block = (struct lilc_block_node_t *)block(p))) {
-            return err(p, "if: Could not parse 'else' block\n");
-        }
-        node->else_block = else_block;
+    struct lilc_if_node_t *node = lilc_if_node_new(p->arena, cond, then_block);
+    located(p, t, node);
 
-        lex_consumef(p->lex, LILC_TOK_RCURL);
+    if (accept(p, LILC_TOK_ELSE)) {
+        if (!expect(p, LILC_TOK_LCURL)) return NULL;
+        node->else_block = (struct lilc_block_node_t *)block(p, 0);
+        if (!expect(p, LILC_TOK_RCURL)) return NULL;
     }
 
     return (struct lilc_node_t *)node;
@@ -96,14 +223,14 @@ if_prefix(struct parser *p, struct token t) {
 factor => LPAREN expr RPAREN
 */
 static struct lilc_node_t *
-lparen_prefix(struct parser *p, struct token t) {
+lparen_prefix(struct parser *p, uint32_t t) {
     // 0 rbp here b/c we obviously want to
     // continue parsing the contents of the
     // parenthesized expression. Parenthesized
     // expressions are always subexpressions of
     // any containing expression they're part of.
     struct lilc_node_t *node = expression(p, 0);
-    lex_consumef(p->lex, LILC_TOK_RPAREN);
+    if (!node || !expect(p, LILC_TOK_RPAREN)) return NULL;
     return node;
 }
 
@@ -114,25 +241,32 @@ lparen_prefix(struct parser *p, struct token t) {
 call => ID LPAREN (params | E) RPAREN
 */
 static struct lilc_node_t *
-lparen_infix(struct parser *p, struct token t, struct lilc_node_t *left) {
+lparen_infix(struct parser *p, uint32_t t, struct lilc_node_t *left) {
     struct lilc_node_t *args[MAX_FUNC_PARAMS];
     struct lilc_node_t *arg;
     unsigned int arg_count = 0;
 
-    while (!lex_is(p->lex, LILC_TOK_RPAREN) && arg_count <= MAX_FUNC_PARAMS) {
-        if (!(arg = expression(p, 0))) {
-            return err(p, "Could not parse call argument\n");
+    if (left->type != LILC_NODE_VAR) {
+        return err(p, "call: Callee must be a function name\n");
+    }
+
+    while (!at(p, LILC_TOK_RPAREN) && !at(p, LILC_TOK_EOS)) {
+        if (arg_count == MAX_FUNC_PARAMS) {
+            return err(p, "call: Too many arguments\n");
         }
+        if (!(arg = expression(p, 0))) return NULL;
 
         args[arg_count++] = arg;
 
-        lex_consume(p->lex, LILC_TOK_COMMA);
+        accept(p, LILC_TOK_COMMA);
     }
 
-    lex_consumef(p->lex, LILC_TOK_RPAREN);
+    if (!expect(p, LILC_TOK_RPAREN)) return NULL;
 
-    char *name = ((struct lilc_var_node_t *)left)->name;
-    return (struct lilc_node_t *)lilc_funccall_node_new(name, args, arg_count);
+    lilc_sym_t name = ((struct lilc_var_node_t *)left)->name;
+    struct lilc_funccall_node_t *node = lilc_funccall_node_new(p->arena, name, args, arg_count);
+    node->base.offset = left->offset;
+    return (struct lilc_node_t *)node;
 }
 
 /*
@@ -149,54 +283,108 @@ term1 =>
     term2
 */
 static struct lilc_node_t *
-bin_op_infix(struct parser *p, struct token t, struct lilc_node_t *left) {
-    struct lilc_node_t *right = expression(p, vtables[t.cls].lbp);
+bin_op_infix(struct parser *p, uint32_t t, struct lilc_node_t *left) {
+    struct lilc_node_t *right = expression(p, vtables[tok_kind(p, t)].lbp);
+
+    if (!right) return NULL;
 
-    if (!right) {
-        return err(p, "Could not parse right operand of binary expr\n");
+    if (p->cons) {
+        return (struct lilc_node_t *)lilc_bin_op_node_cons(p->cons, left, right, tok_kind(p, t),
+                                                           kv_A(p->toks.offsets, t));
     }
+    return located(p, t, lilc_bin_op_node_new(p->arena, left, right, tok_kind(p, t)));
+}
+
 
-    return (struct lilc_node_t *)lilc_bin_op_node_new(left, right, t.cls);
+// Parse a function body, from just past its '{'. Nothing is shared in or
+// out of it, see `node_table`.
+static struct lilc_node_t *
+func_body(struct parser *p) {
+    if (p->cons) node_table_clear(p->cons);
+    struct lilc_node_t *body = block(p, 0);
+    if (p->cons) node_table_clear(p->cons);
+    return body;
 }
 
+// Skip a function body, up to the '}' closing it
+static void
+skip_body(struct parser *p) {
+    int depth = 0;
+    while (!at(p, LILC_TOK_EOS)) {
+        if (at(p, LILC_TOK_LCURL)) {
+            depth++;
+        } else if (at(p, LILC_TOK_RCURL)) {
+            if (depth == 0) return;
+            depth--;
+        }
+        advance(p);
+    }
+}
 
 /*
 funcdef => DEF ID LPAREN ID {COMMA ID} RPAREN LCURL block RCURL
 */
 static struct lilc_node_t *
-funcdef_prefix(struct parser *p, struct token t) {
-    char *funcname = p->lex->tok.val.as_str;
+funcdef_prefix(struct parser *p, uint32_t t) {
+    uint32_t name_tok = p->pos;
+    lilc_sym_t funcname = tok_sym(p, name_tok);
 
-    lex_consumef(p->lex, LILC_TOK_ID);
-    lex_consumef(p->lex, LILC_TOK_LPAREN);
+    if (!expect(p, LILC_TOK_ID) || !expect(p, LILC_TOK_LPAREN)) return NULL;
 
     // Parse parameter list
-    char *params[MAX_FUNC_PARAMS];
+    lilc_sym_t params[MAX_FUNC_PARAMS];
     unsigned int param_count = 0;
-    while (!lex_is(p->lex, LILC_TOK_RPAREN) && param_count <= MAX_FUNC_PARAMS) {
-        if (!lex_is(p->lex, LILC_TOK_ID)) {
+    while (!at(p, LILC_TOK_RPAREN)) {
+        if (!at(p, LILC_TOK_ID)) {
             return err(p, "funcdef params: Expected identifier\n");
         }
+        if (param_count == MAX_FUNC_PARAMS) {
+            return err(p, "funcdef: Too many parameters\n");
+        }
 
-        params[param_count++] = p->lex->tok.val.as_str;
+        params[param_count++] = tok_sym(p, p->pos);
 
-        lex_scan(p->lex);
-        lex_consume(p->lex, LILC_TOK_COMMA);
+        advance(p);
+        accept(p, LILC_TOK_COMMA);
     }
 
-    if (param_count == MAX_FUNC_PARAMS) {
-        return err(p, "funcdef: Too many parameters\n");
+    if (!expect(p, LILC_TOK_RPAREN) || !expect(p, LILC_TOK_LCURL)) return NULL;
+
+    uint32_t body_tok = p->pos;
+    struct lilc_node_t *body = NULL;
+    if (p->lazy) {
+        skip_body(p);
+    } else {
+        body = func_body(p);
     }
 
-    lex_consumef(p->lex, LILC_TOK_RPAREN);
-    lex_consumef(p->lex, LILC_TOK_LCURL);
+    if (!expect(p, LILC_TOK_RCURL)) return NULL;
 
-    struct lilc_node_t *body = block(p);
+    struct lilc_proto_node_t *proto = lilc_proto_node_new(p->arena, funcname, params, param_count);
+    located(p, name_tok, proto);
+    struct lilc_funcdef_node_t *def = lilc_funcdef_node_new(p->arena, proto, body);
+    def->body_tok = body_tok;
+    return located(p, t, def);
+}
 
-    lex_consumef(p->lex, LILC_TOK_RCURL);
+/*
+annotated => AT ID funcdef
+*/
+static struct lilc_node_t *
+at_prefix(struct parser *p, uint32_t t) {
+    uint32_t name_tok = p->pos;
+    if (!expect(p, LILC_TOK_ID)) return NULL;
+    if (tok_sym(p, name_tok) != lilc_intern("memo", 4)) {
+        p->pos = name_tok;
+        return err(p, "annotation: Unknown annotation\n");
+    }
 
-    struct lilc_proto_node_t *proto = lilc_proto_node_new(funcname, params, param_count);
-    return (struct lilc_node_t *)lilc_funcdef_node_new(proto, body);
+    uint32_t def_tok = p->pos;
+    if (!expect(p, LILC_TOK_DEF)) return NULL;
+    struct lilc_funcdef_node_t *def = (struct lilc_funcdef_node_t *)funcdef_prefix(p, def_tok);
+    if (!def) return NULL;
+    def->memo = 1;
+    return located(p, t, def);
 }
 
 // Lookup array for token vtable implementations
@@ -217,6 +405,10 @@ struct vtable vtables[] = {
     [LILC_TOK_IF] = {
         .as_prefix = if_prefix,
     },
+    // Annotations
+    [LILC_TOK_AT] = {
+        .as_prefix = at_prefix,
+    },
     // Operators
     [LILC_TOK_CMPLT] = {
         .lbp = 1,
@@ -253,34 +445,46 @@ struct vtable vtables[] = {
 // Main loop of Pratt (Top-Down Operator Precedence) expression parsing.
 // `rbp`: right binding power
 static struct lilc_node_t *
-expression(struct parser *p, int rbp) {
-    struct token t;
+pratt(struct parser *p, int rbp) {
+    uint32_t t;
     struct lilc_node_t *left;
 
-    t = p->lex->tok;
-    lex_scan(p->lex);
-
-    if (!vtables[t.cls].as_prefix) {
+    if (!vtables[tok_kind(p, p->pos)].as_prefix) {
         return err(p, "expression: No prefix function found\n");
     }
-    left = vtables[t.cls].as_prefix(p, t);
+    t = advance(p);
+    if (!(left = vtables[tok_kind(p, t)].as_prefix(p, t))) return NULL;
 
     // Precedence climbing! Any expression on the right side
     // of an operator with a higher binding power is considered
     // a subexpression, so we want to continue parsing it!
-    while (rbp < vtables[p->lex->tok.cls].lbp) {
-        t = p->lex->tok;
-        lex_scan(p->lex);
-
-        if (!vtables[t.cls].as_infix) {
+    while (rbp < vtables[peek(p, 0)].lbp) {
+        if (!vtables[tok_kind(p, p->pos)].as_infix) {
             return err(p, "expression: No infix function found\n");
         }
-        left = vtables[t.cls].as_infix(p, t, left);
+        t = advance(p);
+        if (!(left = vtables[tok_kind(p, t)].as_infix(p, t, left))) return NULL;
     }
 
     return left;
 }
 
+// Chains of left-associative operators are parsed in a loop, but anything
+// nested inside an expression (parentheses, arguments, the blocks of an
+// if or a function) is parsed by recursing. Nesting is limited to keep
+// the depth of the C stack bounded.
+#define MAX_NESTING 1024
+
+static struct lilc_node_t *
+expression(struct parser *p, int rbp) {
+    if (p->depth == MAX_NESTING) {
+        return err(p, "expression: Nested too deeply\n");
+    }
+    p->depth++;
+    struct lilc_node_t *node = pratt(p, rbp);
+    p->depth--;
+    return node;
+}
 
 /*
 expr_stmt => expr SEMI
@@ -288,28 +492,63 @@ expr_stmt => expr SEMI
 static struct lilc_node_t *
 expr_stmt(struct parser *p) {
     struct lilc_node_t *node = expression(p, 0);
-    lex_consumef(p->lex, LILC_TOK_SEMI);
+    if (!node || !expect(p, LILC_TOK_SEMI)) return NULL;
     return node;
 }
 
+// Panic-mode recovery after a bad statement: skip to just past the next
+// ';', or up to the '}' closing the enclosing block, whichever comes
+// first. Braces opened along the way are skipped over whole.
+static void
+synchronize(struct parser *p) {
+    int depth = 0;
+    while (!at(p, LILC_TOK_EOS)) {
+        if (at(p, LILC_TOK_LCURL)) {
+            depth++;
+        } else if (at(p, LILC_TOK_RCURL)) {
+            if (depth == 0) return;
+            depth--;
+        } else if (at(p, LILC_TOK_SEMI) && depth == 0) {
+            advance(p);
+            return;
+        }
+        advance(p);
+    }
+}
 
 /*
 block => expr_stmt+
 */
 static struct lilc_node_t *
-block(struct parser *p) {
-    lilc_node_vec_t *stmts = lilc_node_vec_new();
+block(struct parser *p, int top) {
     struct lilc_node_t *node;
+    uint32_t first = p->pos;
+
+    // Statements are gathered on the scratch stack, above any belonging
+    // to enclosing blocks, then copied into the arena.
+    size_t base = kv_size(p->scratch);
 
     // If this is the top-level block that represents the series of expr_stmts
     // that constitute the whole program, it won't be surrounded by curlies.
-    // If it's a sub-block, it will be.
-    while (!lex_is(p->lex, LILC_TOK_EOS) && !lex_is(p->lex, LILC_TOK_RCURL)) {
-        if (!(node = expr_stmt(p))) return NULL;
-        lilc_node_vec_push(*stmts, node);
+    // If it's a sub-block, it will be. Bad statements are left out.
+    while (!at(p, LILC_TOK_EOS)) {
+        if (at(p, LILC_TOK_RCURL)) {
+            if (!top) break;
+            err(p, "block: Unmatched '}'\n");
+            advance(p);
+            continue;
+        }
+        if (!(node = expr_stmt(p))) {
+            synchronize(p);
+            continue;
+        }
+        lilc_node_vec_push(p->scratch, node);
     }
 
-    return (struct lilc_node_t *)lilc_block_node_new(stmts);
+    struct lilc_block_node_t *b = lilc_block_node_new(p->arena, p->scratch.a + base,
+                                                      kv_size(p->scratch) - base);
+    kv_size(p->scratch) = base;
+    return located(p, first, b);
 }
 
 /*
@@ -317,18 +556,531 @@ program => block
 */
 static struct lilc_node_t *
 program(struct parser *p) {
-    lex_scan(p->lex);  // Load first token
-    return block(p);
+    // Lex the whole input up front, unless the caller already has
+    if (kv_size(p->toks.kinds) == 0) {
+        tok_strm_lex(&p->toks, p->lex);
+    }
+    return block(p, 1);
+}
 
+struct lex_job {
+    struct tok_ring *ring;
+    struct lexer *lex;
+};
+
+static void *
+lex_worker(void *arg) {
+    struct lex_job *job = arg;
+    tok_ring_lex(job->ring, job->lex);
+    return NULL;
+}
+
+// Parse a program while another thread lexes it, the tokens passing
+// between them through a ring. Errors end up in `p->diags` just as when
+// parsing sequentially. Falls back to that if the thread can't be started.
+static struct lilc_node_t *
+program_pipelined(struct parser *p) {
+    // Aligned as it says, so head and tail are on cache lines of their own
+    struct tok_ring *ring = aligned_alloc(_Alignof(struct tok_ring), sizeof(struct tok_ring));
+    tok_ring_init(ring);
+
+    // The lexer thread reports into a list of its own
+    lilc_diags_t lex_diags;
+    kv_init(lex_diags);
+    p->lex->diags = &lex_diags;
+
+    struct lex_job job = {ring, p->lex};
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, lex_worker, &job) != 0) {
+        p->lex->diags = &p->diags;
+        kv_destroy(lex_diags);
+        free(ring);
+        return program(p);
+    }
+
+    p->ring = ring;
+    need(p, 0);
+    struct lilc_node_t *root = block(p, 1);
+    pthread_join(thread, NULL);
+    p->ring = NULL;
+    p->lex->diags = &p->diags;
+
+    for (size_t i = 0; i < kv_size(p->diags); i++) {
+        struct lilc_diag *d = &kv_A(p->diags, i);
+        d->pos = lex_locate(p->lex, d->offset);
+    }
+    for (size_t i = 0; i < kv_size(lex_diags); i++) {
+        kv_push(struct lilc_diag, p->diags, kv_A(lex_diags, i));
+    }
+    kv_destroy(lex_diags);
+    free(ring);
+    return root;
+}
+
+static int
+diag_cmp(const void *a, const void *b) {
+    size_t x = ((const struct lilc_diag *)a)->offset;
+    size_t y = ((const struct lilc_diag *)b)->offset;
+    return (x > y) - (x < y);
+}
+
+// Exit with the first of the errors collected so far, if there are any
+static void
+die_on_error(struct parser *p) {
+    if (kv_size(p->diags) == 0) return;
+    qsort(p->diags.a, kv_size(p->diags), sizeof(struct lilc_diag), diag_cmp);
+    struct lilc_diag *d = &kv_A(p->diags, 0);
+    die_at(p->lex->filename, d->pos.line, d->pos.col, d->msg);
+}
+
+// Parse a Lilc program, carrying on past syntax errors. Returns the root
+// node, with any statement that failed to parse left out of it; the
+// errors are in `p->diags`, in source order.
+struct lilc_node_t *
+parse_collect(struct parser *p) {
+    struct lilc_node_t *root = p->pipelined ? program_pipelined(p) : program(p);
+    qsort(p->diags.a, kv_size(p->diags), sizeof(struct lilc_diag), diag_cmp);
+    return root;
 }
 
 // Parse a Lilc program. Returns a pointer to the root node
-// upon successful parsing--otherwise crashes.
+// upon successful parsing--otherwise exits with the first error.
 struct lilc_node_t *
 parse(struct parser *p) {
-    struct lilc_node_t *root;
-    if (!(root = program(p))) {
-        die(p->lex->filename, p->lex->lineno, p->err);
-    }
+    struct lilc_node_t *root = p->pipelined ? program_pipelined(p) : program(p);
+    die_on_error(p);
     return root;
 }
+
+static struct lilc_node_t *
+lazy_body(struct parser *p, struct lilc_funcdef_node_t *def) {
+    if (def->body) return def->body;
+    uint32_t pos = p->pos;
+    p->pos = def->body_tok;
+    def->body = func_body(p);
+    p->pos = pos;
+    return def->body;
+}
+
+struct lilc_node_t *
+parse_body(struct parser *p, struct lilc_funcdef_node_t *def) {
+    lazy_body(p, def);
+    die_on_error(p);
+    return def->body;
+}
+
+// Functions are looked for by name. Walking a body, the definitions in
+// it are noted down but not walked into, and the calls in it are wanted,
+// unless it's only being searched for definitions.
+struct reacher {
+    struct ast_visitor v;
+    struct parser *p;
+    int searching;
+    struct lilc_funcdef_node_t **defs;        // By name
+    char *wanted;                             // By name
+    kvec_t(lilc_sym_t) work;                  // Wanted, not yet looked for
+    kvec_t(struct lilc_funcdef_node_t *) all;  // Every definition found
+    int parsed;
+};
+
+static void
+want(struct reacher *r, lilc_sym_t name) {
+    if (r->wanted[name]) return;
+    r->wanted[name] = 1;
+    kv_push(lilc_sym_t, r->work, name);
+}
+
+static enum ast_walk_action
+reach_enter(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct reacher *r = (struct reacher *)v;
+    if (node->type == LILC_NODE_FUNCDEF) {
+        struct lilc_funcdef_node_t *def = (struct lilc_funcdef_node_t *)node;
+        lilc_sym_t name = def->proto->name;
+        if (!r->defs[name]) {
+            r->defs[name] = def;
+            // Wanted before it was found
+            if (r->wanted[name]) kv_push(lilc_sym_t, r->work, name);
+        }
+        kv_push(struct lilc_funcdef_node_t *, r->all, def);
+        return AST_SKIP;
+    }
+    if (node->type == LILC_NODE_FUNCCALL && !r->searching) {
+        want(r, ((struct lilc_funccall_node_t *)node)->name);
+    }
+    return AST_DESCEND;
+}
+
+static void
+reach_body(struct reacher *r, struct lilc_funcdef_node_t *def) {
+    if (!def->body) r->parsed++;
+    ast_walk(lazy_body(r->p, def), &r->v);
+}
+
+int
+parse_reachable(struct parser *p, struct lilc_node_t *root, const lilc_sym_t *exports,
+                unsigned int export_count) {
+    lilc_sym_t main_sym = lilc_intern("main", 4);
+    size_t syms = lilc_sym_count();
+    struct reacher r = {{reach_enter, NULL, NULL}, p, 0};
+    r.defs = calloc(syms, sizeof(struct lilc_funcdef_node_t *));
+    r.wanted = calloc(syms, 1);
+    kv_init(r.work);
+    kv_init(r.all);
+
+    ast_walk(root, &r.v);
+    want(&r, main_sym);
+    for (unsigned int i = 0; i < export_count; i++) want(&r, exports[i]);
+
+    char *walked = calloc(syms, 1);
+    for (;;) {
+        while (kv_size(r.work)) {
+            lilc_sym_t name = kv_pop(r.work);
+            if (!r.defs[name] || walked[name]) continue;
+            walked[name] = 1;
+            reach_body(&r, r.defs[name]);
+        }
+
+        // A function called but not found may be defined in a body not
+        // parsed yet. Search them until it turns up. Programs needn't
+        // have a main, so that's never searched for.
+        int missing = 0;
+        for (size_t s = 0; s < syms && !missing; s++) missing = r.wanted[s] && !r.defs[s] && s != main_sym;
+        size_t searched = 0;
+        r.searching = 1;
+        for (size_t i = 0; missing && i < kv_size(r.all) && !kv_size(r.work); i++) {
+            struct lilc_funcdef_node_t *def = kv_A(r.all, i);
+            if (def->body) continue;
+            reach_body(&r, def);
+            searched++;
+        }
+        r.searching = 0;
+        if (!searched) break;
+    }
+
+    free(walked);
+    free(r.defs);
+    free(r.wanted);
+    kv_destroy(r.work);
+    kv_destroy(r.all);
+    die_on_error(p);
+    return r.parsed;
+}
+
+/*
+ * Parallel parsing. Outside of braces, a ';' always ends a top-level
+ * statement, so the source can be cut after any such ';' and the pieces
+ * lexed and parsed independently of each other.
+ */
+
+// Aim for a few chunks per thread so one slow chunk doesn't hold up the
+// rest, but keep them big enough to be worth handing off.
+#define CHUNKS_PER_THREAD 4
+#define MIN_CHUNK_SIZE (64 * 1024)
+
+struct chunk {
+    size_t start;
+    size_t end;
+    struct lilc_node_t **stmts;
+    unsigned int stmt_count;
+};
+
+typedef kvec_t(struct chunk) chunks_t;
+
+struct chunk_job {
+    const char *source;
+    char *path;
+    struct chunk *chunks;
+    size_t count;
+    size_t next;  // Next chunk to be claimed, bumped atomically
+};
+
+// Cut `source` into chunks of at least `target` bytes, each ending just
+// after a top-level ';' (or at the end of the input). Only braces and ';'
+// are looked at, so it's a lot cheaper than lexing.
+static void
+split_chunks(const char *source, size_t target, chunks_t *chunks) {
+    struct chunk c = {0, 0, NULL, 0};
+    int depth = 0;
+    const char *s = source;
+    for (;;) {
+        s += scan_delims(s);
+        if (*s == '\0') break;
+        if (*s == '{') {
+            depth++;
+        } else if (*s == '}') {
+            depth--;
+        } else if (depth == 0 && (size_t)(s + 1 - source) - c.start >= target) {
+            c.end = s + 1 - source;
+            kv_push(struct chunk, *chunks, c);
+            c.start = c.end;
+        }
+        s++;
+    }
+    c.end = s - source;
+    kv_push(struct chunk, *chunks, c);
+}
+
+// Each thread allocates from its own arena
+struct chunk_worker {
+    struct chunk_job *job;
+    struct arena arena;
+};
+
+// Parse the statements starting inside a chunk. The lexer runs on past
+// the chunk end (by up to a batch), but the statements there belong to
+// the next chunk.
+static void
+parse_chunk(struct chunk_job *job, struct chunk *c, struct arena *arena) {
+    struct lexer l;
+    struct parser p;
+    lex_init(&l, job->source, job->path);
+    l.offset = c->start;
+    parser_init(&p, &l, arena);
+    need(&p, 0);
+
+    while (!at(&p, LILC_TOK_EOS) && kv_A(p.toks.offsets, p.pos) < c->end) {
+        struct lilc_node_t *node = expr_stmt(&p);
+        die_on_error(&p);
+        lilc_node_vec_push(p.scratch, node);
+    }
+
+    c->stmt_count = kv_size(p.scratch);
+    c->stmts = arena_alloc(arena, sizeof(struct lilc_node_t *) * c->stmt_count);
+    memcpy(c->stmts, p.scratch.a, sizeof(struct lilc_node_t *) * c->stmt_count);
+
+    parser_free(&p);
+    lex_close(&l);
+}
+
+static void *
+parse_worker(void *arg) {
+    struct chunk_worker *w = arg;
+    struct chunk_job *job = w->job;
+    size_t i;
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        parse_chunk(job, &job->chunks[i], &w->arena);
+    }
+    return NULL;
+}
+
+// Parse the NUL-terminated program `source`, `len` bytes long, on up to
+// `nthreads` threads, allocating the tree from `arena`. Returns the same
+// tree as `parse`. Dies on syntax errors, though with several in the
+// input it's not defined which one gets reported.
+struct lilc_node_t *
+parse_parallel(const char *source, size_t len, char *path, int nthreads, struct arena *arena) {
+    if (nthreads < 1) nthreads = 1;
+    size_t target = len / ((size_t)nthreads * CHUNKS_PER_THREAD);
+    if (target < MIN_CHUNK_SIZE) target = MIN_CHUNK_SIZE;
+
+    chunks_t chunks;
+    kv_init(chunks);
+    split_chunks(source, target, &chunks);
+
+    struct chunk_job job = {source, path, chunks.a, kv_size(chunks), 0};
+    if ((size_t)nthreads > job.count) nthreads = job.count;
+
+    // The calling thread works through chunks too, as worker 0. If a
+    // thread can't be started, the ones that did pick up its share.
+    struct chunk_worker *workers = malloc(sizeof(struct chunk_worker) * nthreads);
+    pthread_t *threads = malloc(sizeof(pthread_t) * nthreads);
+    int started = 1;
+    workers[0].job = &job;
+    arena_init(&workers[0].arena);
+    for (int i = 1; i < nthreads; i++) {
+        workers[started].job = &job;
+        arena_init(&workers[started].arena);
+        if (pthread_create(&threads[started], NULL, parse_worker, &workers[started]) == 0) {
+            started++;
+        }
+    }
+    parse_worker(&workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < started; i++) {
+        arena_adopt(arena, &workers[i].arena);
+    }
+    free(threads);
+    free(workers);
+
+    // Stitch chunk statements together in source order
+    lilc_node_vec_t stmts;
+    kv_init(stmts);
+    for (size_t i = 0; i < job.count; i++) {
+        for (unsigned int j = 0; j < job.chunks[i].stmt_count; j++) {
+            lilc_node_vec_push(stmts, job.chunks[i].stmts[j]);
+        }
+    }
+    struct lilc_block_node_t *root = lilc_block_node_new(arena, stmts.a, kv_size(stmts));
+    kv_destroy(stmts);
+    kv_destroy(chunks);
+
+    return (struct lilc_node_t *)root;
+}
+
+// Parse top-level statements of the session text starting at byte `from`
+// onto `stmts`/`spans`, lexing only as far as the parser gets.
+//
+// Statement boundaries are the only places where parser state is known
+// to be empty, so once a new statement ends exactly where an old one
+// (`old`, in pre-edit coordinates) ended at or after the edited range
+// `[.., edit_end)`, the rest of the text is unchanged and parses the same
+// as before. Returns the index of the first old statement that can be
+// reused, or `old_count` if parsing ran to the end of the input.
+static size_t
+parse_stmts_from(struct parse_session *s, size_t from,
+                 const struct stmt_span *old, size_t old_count,
+                 size_t edit_end, ptrdiff_t delta,
+                 lilc_node_vec_t *stmts, stmt_spans_t *spans) {
+    struct lexer l;
+    struct parser p;
+    lex_init(&l, s->text, s->path);
+    l.offset = from;
+    parser_init(&p, &l, &s->arena);
+    need(&p, 0);
+
+    size_t reuse = old_count;
+    while (!at(&p, LILC_TOK_EOS)) {
+        struct stmt_span span;
+        span.start = kv_A(p.toks.offsets, p.pos);
+        span.shift = 0;
+        span.size = s->arena.used;
+
+        struct lilc_node_t *node = expr_stmt(&p);
+        die_on_error(&p);
+        span.end = kv_A(p.toks.offsets, p.pos - 1) + 1;
+        span.size = s->arena.used - span.size;
+
+        lilc_node_vec_push(*stmts, node);
+        kv_push(struct stmt_span, *spans, span);
+
+        // Binary search for an old statement ending at the same spot
+        size_t lo = 0, hi = old_count, old_end = span.end - delta;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (old[mid].end < old_end) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo < old_count && old[lo].end == old_end && old_end >= edit_end) {
+            reuse = lo + 1;
+            break;
+        }
+    }
+
+    parser_free(&p);
+    lex_close(&l);
+    return reuse;
+}
+
+static void
+apply_edit(struct parse_session *s, const struct text_edit *e) {
+    size_t len = s->len - (e->end - e->start) + e->len;
+    if (len + 1 > s->cap) {
+        s->cap = (len + 1) * 2;
+        s->text = realloc(s->text, s->cap);
+    }
+    memmove(s->text + e->start + e->len, s->text + e->end, s->len - e->end + 1);
+    memcpy(s->text + e->start, e->text, e->len);
+    s->len = len;
+}
+
+// Parse the whole text from scratch, into a fresh arena
+static void
+parse_all(struct parse_session *s) {
+    arena_free(&s->arena);
+    kv_size(s->stmts) = 0;
+    kv_size(s->spans) = 0;
+    parse_stmts_from(s, 0, NULL, 0, 0, 0, &s->stmts, &s->spans);
+
+    s->root = lilc_block_node_new(&s->arena, NULL, 0);
+    s->root->stmts = s->stmts.a;
+    s->root->stmt_count = kv_size(s->stmts);
+    s->garbage = 0;
+}
+
+// Start a parse session over a copy of `text`, returning the root
+// of its full parse. Dies on syntax errors, like `parse`.
+struct lilc_node_t *
+parse_session_init(struct parse_session *s, const char *text, size_t len, char *path) {
+    s->path = path;
+    s->len = len;
+    s->cap = len + 1;
+    s->text = malloc(s->cap);
+    memcpy(s->text, text, len);
+    s->text[len] = '\0';
+    arena_init(&s->arena);
+    kv_init(s->stmts);
+    kv_init(s->spans);
+
+    parse_all(s);
+    return (struct lilc_node_t *)s->root;
+}
+
+// Apply `n` edits in order, each in the coordinates of the text left by
+// the ones before it, and return the updated root. Statement subtrees
+// outside the edited ranges are shared with the previous tree; the root
+// block is updated in place. Dies on syntax errors, like `parse`.
+//
+// Replaced statements stay in the session's arena. Once they take up
+// more of it than the live ones, the text is parsed afresh into a new
+// arena, so memory stays proportional to the size of the text.
+struct lilc_node_t *
+parse_session_edit(struct parse_session *s, const struct text_edit *edits, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+        const struct text_edit *e = &edits[k];
+        ptrdiff_t delta = (ptrdiff_t)e->len - (ptrdiff_t)(e->end - e->start);
+        apply_edit(s, e);
+
+        // Statements ending at or before the edit start are untouched,
+        // and re-lexing can begin right after the last of them: a token
+        // never continues past the ';' that ends a statement.
+        size_t count = kv_size(s->spans), first = 0;
+        while (first < count && kv_A(s->spans, first).end <= e->start) first++;
+        size_t from = first > 0 ? kv_A(s->spans, first - 1).end : 0;
+
+        lilc_node_vec_t stmts;
+        stmt_spans_t spans;
+        kv_init(stmts);
+        kv_init(spans);
+        for (size_t i = 0; i < first; i++) {
+            lilc_node_vec_push(stmts, kv_A(s->stmts, i));
+            kv_push(struct stmt_span, spans, kv_A(s->spans, i));
+        }
+
+        size_t reuse = parse_stmts_from(s, from, s->spans.a, count, e->end, delta,
+                                        &stmts, &spans);
+
+        for (size_t i = first; i < reuse; i++) {
+            s->garbage += kv_A(s->spans, i).size;
+        }
+        for (size_t i = reuse; i < count; i++) {
+            struct stmt_span span = kv_A(s->spans, i);
+            span.start += delta;
+            span.end += delta;
+            span.shift += delta;
+            lilc_node_vec_push(stmts, kv_A(s->stmts, i));
+            kv_push(struct stmt_span, spans, span);
+        }
+
+        kv_destroy(s->stmts);
+        kv_destroy(s->spans);
+        s->stmts = stmts;
+        s->spans = spans;
+        s->root->stmts = s->stmts.a;
+        s->root->stmt_count = kv_size(s->stmts);
+    }
+
+    if (s->garbage > ARENA_BLOCK_SIZE && s->garbage * 2 > s->arena.used) {
+        parse_all(s);
+    }
+    return (struct lilc_node_t *)s->root;
+}
+
+void
+parse_session_free(struct parse_session *s) {
+    arena_free(&s->arena);
+    kv_destroy(s->stmts);
+    kv_destroy(s->spans);
+    free(s->text);
+}
@@ -1,19 +1,106 @@
 #ifndef LILC_PARSE_H
 #define LILC_PARSE_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "ast.h"
 #include "lex.h"
 #include "token.h"
 
 struct parser {
     struct lexer *lex;
-    char *err;
+    struct tok_strm toks;     // Whole input, lexed before parsing starts
+    uint32_t pos;             // Index of the current token in `toks`
+    unsigned int depth;       // Expressions being parsed, one inside the next
+    struct arena *arena;      // Where nodes are allocated
+    struct node_table *cons;  // If set, pure expressions are shared through it
+    int pipelined;            // If set, lex on a thread of its own meanwhile
+    int lazy;                 // If set, skip function bodies, see parse_body
+    struct tok_ring *ring;    // Where tokens come from while pipelined
+    lilc_node_vec_t scratch;  // Statements of the blocks being parsed
+    lilc_diags_t diags;       // Syntax errors found so far
 };
 
 struct lilc_node_t *
 parse(struct parser *p);
 
+struct lilc_node_t *
+parse_collect(struct parser *p);
+
+void
+parser_init(struct parser *parse, struct lexer *l, struct arena *arena);
+
+/*
+ * Lazy parsing. With `lazy` set, a function's body is only skipped over,
+ * its braces matched, leaving the definition with no body and no errors
+ * reported from it. Bodies are parsed later, as needed, with the parser
+ * and the tokens it keeps; any functions defined in them are skipped in
+ * turn. Errors are handled as by `parse`.
+ */
+struct lilc_node_t *
+parse_body(struct parser *p, struct lilc_funcdef_node_t *def);
+
+// Parse the bodies of the functions that can be reached from the top
+// level of the program at `root`: those named `main` or among `exports`,
+// and any called from there on. Functions are found by name, so a call
+// from anywhere counts. Returns how many bodies were parsed.
+int
+parse_reachable(struct parser *p, struct lilc_node_t *root, const lilc_sym_t *exports,
+                unsigned int export_count);
+
+void
+parser_free(struct parser *p);
+
+struct lilc_node_t *
+parse_parallel(const char *source, size_t len, char *path, int nthreads, struct arena *arena);
+
+/*
+ * Incremental parsing. A parse session owns a copy of the source text and
+ * the AST built from it. Edits re-lex and re-parse only the top-level
+ * statements they touch, reusing the subtrees of all the others.
+ */
+
+// Replace bytes [start, end) of the text with `len` bytes at `text`
+struct text_edit {
+    size_t start;
+    size_t end;
+    const char *text;
+    size_t len;
+};
+
+// Byte range of a top-level statement, from its first token through
+// its terminating ';'. Reused statements keep the node offsets they were
+// parsed with; `shift` is how far the text has moved since, and needs
+// adding to them.
+struct stmt_span {
+    size_t start;
+    size_t end;
+    ptrdiff_t shift;
+    size_t size;  // Arena bytes taken up by the statement's nodes
+};
+
+typedef kvec_t(struct stmt_span) stmt_spans_t;
+
+struct parse_session {
+    char *path;
+    char *text;
+    size_t len;
+    size_t cap;
+    struct arena arena;        // Holds every node of the tree
+    struct lilc_block_node_t *root;
+    lilc_node_vec_t stmts;     // Backs `root->stmts`
+    stmt_spans_t spans;        // One per statement in `root`
+    size_t garbage;            // Arena bytes taken by replaced statements
+};
+
+struct lilc_node_t *
+parse_session_init(struct parse_session *s, const char *text, size_t len, char *path);
+
+struct lilc_node_t *
+parse_session_edit(struct parse_session *s, const struct text_edit *edits, size_t n);
+
 void
-parser_init(struct parser *parse, struct lexer *l);
+parse_session_free(struct parse_session *s);
 
 #endif
\ No newline at end of file
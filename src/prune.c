@@ -0,0 +1,203 @@
+#include <stdlib.h>
+
+#include "kvec.h"
+
+#include "ast.h"
+#include "intern.h"
+#include "prune.h"
+
+// A function, numbered in the order they're defined, as resolved
+struct func_info {
+    lilc_sym_t name;
+    uint32_t span;                    // Functions it defines, itself included
+    struct lilc_block_node_t *block;  // Statement it could be taken out of,
+    unsigned int index;               // if any
+};
+
+typedef kvec_t(uint32_t) func_list_t;
+
+// A call, from the function numbered `from`, or from the top level
+struct call_edge {
+    uint32_t from;
+    uint32_t to;
+};
+
+// First walk: what functions there are and what calls what
+struct call_graph {
+    struct ast_visitor v;
+    kvec_t(struct func_info) funcs;
+    kvec_t(struct call_edge) calls;
+    func_list_t defining;             // Functions whose bodies are being walked
+    struct lilc_block_node_t *block;  // Where the next function would be
+    unsigned int index;               // defined, if it can be taken out
+};
+
+static enum ast_walk_action
+graph_child(struct ast_visitor *v, struct lilc_node_t *node, unsigned int i) {
+    struct call_graph *g = (struct call_graph *)v;
+    struct lilc_block_node_t *b = (struct lilc_block_node_t *)node;
+    // Its prototype is entered next
+    if (node->type == LILC_NODE_FUNCDEF) return AST_DESCEND;
+    g->block = NULL;
+    if (node->type == LILC_NODE_BLOCK && i + 1 < b->stmt_count && b->stmts[i]->type == LILC_NODE_FUNCDEF) {
+        g->block = b;
+        g->index = i;
+    }
+    return AST_DESCEND;
+}
+
+static enum ast_walk_action
+graph_enter(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct call_graph *g = (struct call_graph *)v;
+    switch (node->type) {
+        case LILC_NODE_PROTO: {
+            struct func_info f = {((struct lilc_proto_node_t *)node)->name, 0, g->block, g->index};
+            kv_push(uint32_t, g->defining, kv_size(g->funcs));
+            kv_push(struct func_info, g->funcs, f);
+            break;
+        }
+        case LILC_NODE_FUNCCALL: {
+            uint32_t to = ((struct lilc_funccall_node_t *)node)->func;
+            if (to == LILC_UNRESOLVED) break;
+            size_t n = kv_size(g->defining);
+            struct call_edge e = {n ? kv_A(g->defining, n - 1) : LILC_UNRESOLVED, to};
+            kv_push(struct call_edge, g->calls, e);
+            break;
+        }
+        default:
+            break;
+    }
+    return AST_DESCEND;
+}
+
+static enum ast_walk_action
+graph_leave(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct call_graph *g = (struct call_graph *)v;
+    if (node->type == LILC_NODE_FUNCDEF) {
+        uint32_t f = kv_pop(g->defining);
+        kv_A(g->funcs, f).span = kv_size(g->funcs) - f;
+    }
+    return AST_DESCEND;
+}
+
+// Second walk: point the calls left at the functions left
+struct renumberer {
+    struct ast_visitor v;
+    const uint32_t *renumber;
+};
+
+static enum ast_walk_action
+renumber_enter(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct renumberer *r = (struct renumberer *)v;
+    if (node->type == LILC_NODE_FUNCCALL) {
+        struct lilc_funccall_node_t *c = (struct lilc_funccall_node_t *)node;
+        if (c->func != LILC_UNRESOLVED) c->func = r->renumber[c->func];
+    }
+    return AST_DESCEND;
+}
+
+// Mark live everything reachable from the functions on `work`
+static void
+mark_live(struct call_graph *g, char *live, func_list_t *work) {
+    // Calls grouped by caller, the top level's last
+    size_t n = kv_size(g->funcs);
+    size_t *first = calloc(n + 2, sizeof(size_t));
+    uint32_t *to = malloc(sizeof(uint32_t) * (kv_size(g->calls) + 1));
+    for (size_t i = 0; i < kv_size(g->calls); i++) {
+        uint32_t from = kv_A(g->calls, i).from;
+        first[(from == LILC_UNRESOLVED ? n : from) + 1]++;
+    }
+    for (size_t f = 0; f <= n; f++) first[f + 1] += first[f];
+    size_t *fill = malloc(sizeof(size_t) * (n + 1));
+    for (size_t f = 0; f <= n; f++) fill[f] = first[f];
+    for (size_t i = 0; i < kv_size(g->calls); i++) {
+        struct call_edge e = kv_A(g->calls, i);
+        to[fill[e.from == LILC_UNRESOLVED ? n : e.from]++] = e.to;
+    }
+
+    for (size_t i = first[n]; i < first[n + 1]; i++) kv_push(uint32_t, *work, to[i]);
+    while (kv_size(*work)) {
+        uint32_t f = kv_pop(*work);
+        if (live[f]) continue;
+        live[f] = 1;
+        for (size_t i = first[f]; i < first[f + 1]; i++) {
+            if (!live[to[i]]) kv_push(uint32_t, *work, to[i]);
+        }
+    }
+
+    free(first);
+    free(to);
+    free(fill);
+}
+
+int
+prune(struct lilc_node_t *root, const lilc_sym_t *exports, unsigned int export_count) {
+    struct call_graph g = {{graph_enter, graph_child, graph_leave}};
+    kv_init(g.funcs);
+    kv_init(g.calls);
+    kv_init(g.defining);
+    ast_walk(root, &g.v);
+    size_t n = kv_size(g.funcs);
+
+    // Roots are called from the top level, or by whatever runs the program
+    lilc_sym_t main_sym = lilc_intern("main", 4);
+    func_list_t work;
+    kv_init(work);
+    for (size_t f = 0; f < n; f++) {
+        lilc_sym_t name = kv_A(g.funcs, f).name;
+        int is_root = name == main_sym;
+        for (unsigned int i = 0; i < export_count && !is_root; i++) is_root = name == exports[i];
+        if (is_root) kv_push(uint32_t, work, f);
+    }
+    char *live = calloc(n + 1, 1);
+    mark_live(&g, live, &work);
+
+    // A definition can only go if all those in it are dead too: functions
+    // defined inside another can be called from outside it
+    size_t *live_before = malloc(sizeof(size_t) * (n + 1));
+    live_before[0] = 0;
+    for (size_t f = 0; f < n; f++) live_before[f + 1] = live_before[f] + live[f];
+
+    uint32_t *renumber = malloc(sizeof(uint32_t) * (n + 1));
+    kvec_t(struct lilc_block_node_t *) blocks;
+    kv_init(blocks);
+    int removed = 0;
+    uint32_t kept = 0;
+    for (size_t f = 0; f < n;) {
+        struct func_info *fi = &kv_A(g.funcs, f);
+        if (fi->block && live_before[f + fi->span] == live_before[f]) {
+            fi->block->stmts[fi->index] = NULL;
+            kv_push(struct lilc_block_node_t *, blocks, fi->block);
+            for (size_t i = f; i < f + fi->span; i++) renumber[i] = LILC_UNRESOLVED;
+            removed += fi->span;
+            f += fi->span;
+        } else {
+            renumber[f++] = kept++;
+        }
+    }
+
+    // Close up the gaps left. A block can be listed more than once.
+    for (size_t i = 0; i < kv_size(blocks); i++) {
+        struct lilc_block_node_t *b = kv_A(blocks, i);
+        unsigned int count = 0;
+        for (unsigned int s = 0; s < b->stmt_count; s++) {
+            if (b->stmts[s]) b->stmts[count++] = b->stmts[s];
+        }
+        b->stmt_count = count;
+    }
+
+    if (removed) {
+        struct renumberer r = {{renumber_enter, NULL, NULL}, renumber};
+        ast_walk(root, &r.v);
+    }
+
+    free(live);
+    free(live_before);
+    free(renumber);
+    kv_destroy(blocks);
+    kv_destroy(work);
+    kv_destroy(g.funcs);
+    kv_destroy(g.calls);
+    kv_destroy(g.defining);
+    return removed;
+}
@@ -0,0 +1,21 @@
+#ifndef LILC_PRUNE_H
+#define LILC_PRUNE_H
+
+#include "ast.h"
+#include "intern.h"
+
+/*
+ * Dead function elimination, run on a tree once it's resolved and before
+ * generating code for it. Functions are live if they're named `main`,
+ * named among `exports`, or called from the program's top level, and so
+ * is anything a live function calls. The definitions of all the others
+ * are taken out of the blocks they're in, and calls renumbered to match.
+ *
+ * A definition that's the last statement of its block is its value, and
+ * is kept. Returns how many functions were taken out, nested ones
+ * included.
+ */
+int
+prune(struct lilc_node_t *root, const lilc_sym_t *exports, unsigned int export_count);
+
+#endif
@@ -0,0 +1,368 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "kvec.h"
+
+#include "arena.h"
+#include "ast.h"
+#include "reassoc.h"
+#include "token.h"
+
+// Expressions bigger than this, once multiplied out, are left alone
+#define POLY_ATOMS 8    // Variables and opaque subexpressions
+#define POLY_TERMS 32
+#define POLY_DEGREE 64  // Of any one atom
+
+// A coefficient times each atom raised to its exponent
+struct term {
+    double coeff;
+    uint8_t exp[POLY_ATOMS];
+};
+
+// What a node reads as: a sum of terms in its atoms. A node that isn't
+// arithmetic, or won't read as a polynomial, is an atom of its own.
+struct poly {
+    struct lilc_node_t *node;  // The node read
+    int arith;                 // Whether it's an operation read through
+    unsigned int ops;          // Operations read through to get here
+    unsigned int atom_count;
+    struct lilc_node_t *atoms[POLY_ATOMS];
+    unsigned int term_count;   // None at all is zero
+    struct term terms[POLY_TERMS];
+};
+
+typedef kvec_t(struct poly) poly_vec_t;
+
+// Nodes are read on the way back up the tree. Each leaves its polynomial
+// on a stack, where its parent picks it up.
+struct reassociator {
+    struct ast_visitor v;
+    struct arena *arena;
+    poly_vec_t done;
+    struct poly scratch;
+};
+
+// Variables name the same value whichever node they're read from.
+// Anything else is only the same as itself.
+static int
+same_atom(struct lilc_node_t *a, struct lilc_node_t *b) {
+    if (a == b) return 1;
+    return a->type == LILC_NODE_VAR && b->type == LILC_NODE_VAR &&
+           ((struct lilc_var_node_t *)a)->name == ((struct lilc_var_node_t *)b)->name;
+}
+
+static void
+poly_const(struct poly *p, struct lilc_node_t *node, double val) {
+    p->node = node;
+    p->arith = 0;
+    p->ops = 0;
+    p->atom_count = 0;
+    p->term_count = 0;
+    if (val != 0) {
+        p->term_count = 1;
+        p->terms[0].coeff = val;
+        memset(p->terms[0].exp, 0, POLY_ATOMS);
+    }
+}
+
+static void
+poly_atom(struct poly *p, struct lilc_node_t *node) {
+    poly_const(p, node, 1);
+    p->atom_count = 1;
+    p->atoms[0] = node;
+    p->terms[0].exp[0] = 1;
+}
+
+// Whether `p` is a constant, and which
+static int
+poly_is_const(const struct poly *p, double *val) {
+    if (p->term_count == 0) {
+        *val = 0;
+        return 1;
+    }
+    if (p->term_count > 1) return 0;
+    for (unsigned int i = 0; i < p->atom_count; i++) {
+        if (p->terms[0].exp[i]) return 0;
+    }
+    *val = p->terms[0].coeff;
+    return 1;
+}
+
+// Add `coeff` times the monomial `exp` to `p`, collecting it with any
+// like term. Returns 0 if there's no room for another term.
+static int
+poly_add_term(struct poly *p, double coeff, const uint8_t *exp) {
+    for (unsigned int i = 0; i < p->term_count; i++) {
+        if (memcmp(p->terms[i].exp, exp, POLY_ATOMS) == 0) {
+            p->terms[i].coeff += coeff;
+            return 1;
+        }
+    }
+    if (p->term_count == POLY_TERMS) return 0;
+    p->terms[p->term_count].coeff = coeff;
+    memcpy(p->terms[p->term_count].exp, exp, POLY_ATOMS);
+    p->term_count++;
+    return 1;
+}
+
+// Where each of `from`'s atoms is in `to`, adding those it lacks.
+// Returns 0 if there's no room for them.
+static int
+poly_map_atoms(struct poly *to, const struct poly *from, unsigned int *map) {
+    for (unsigned int i = 0; i < from->atom_count; i++) {
+        unsigned int j = 0;
+        while (j < to->atom_count && !same_atom(to->atoms[j], from->atoms[i])) j++;
+        if (j == to->atom_count) {
+            if (j == POLY_ATOMS) return 0;
+            to->atoms[to->atom_count++] = from->atoms[i];
+        }
+        map[i] = j;
+    }
+    return 1;
+}
+
+// Drop the terms that cancelled out, and check no atom but a variable
+// is needed more than once, so rebuilding never repeats any work
+static int
+poly_settle(struct poly *p) {
+    unsigned int n = 0;
+    for (unsigned int i = 0; i < p->term_count; i++) {
+        if (p->terms[i].coeff != 0) p->terms[n++] = p->terms[i];
+    }
+    p->term_count = n;
+
+    for (unsigned int a = 0; a < p->atom_count; a++) {
+        if (p->atoms[a]->type == LILC_NODE_VAR) continue;
+        unsigned int uses = 0;
+        for (unsigned int i = 0; i < p->term_count; i++) uses += p->terms[i].exp[a];
+        if (uses > 1) return 0;
+    }
+    return 1;
+}
+
+// `out` = `l` + `sign` * `r`
+static int
+poly_add(struct poly *out, const struct poly *l, const struct poly *r, double sign) {
+    unsigned int map[POLY_ATOMS];
+    *out = *l;
+    if (!poly_map_atoms(out, r, map)) return 0;
+    for (unsigned int i = 0; i < r->term_count; i++) {
+        uint8_t exp[POLY_ATOMS] = {0};
+        for (unsigned int a = 0; a < r->atom_count; a++) exp[map[a]] = r->terms[i].exp[a];
+        if (!poly_add_term(out, sign * r->terms[i].coeff, exp)) return 0;
+    }
+    return poly_settle(out);
+}
+
+// `out` = `l` * `r`, multiplied out
+static int
+poly_mul(struct poly *out, const struct poly *l, const struct poly *r) {
+    unsigned int map[POLY_ATOMS];
+    *out = *l;
+    out->term_count = 0;
+    if (!poly_map_atoms(out, r, map)) return 0;
+    for (unsigned int i = 0; i < l->term_count; i++) {
+        for (unsigned int j = 0; j < r->term_count; j++) {
+            uint8_t exp[POLY_ATOMS];
+            memcpy(exp, l->terms[i].exp, POLY_ATOMS);
+            for (unsigned int a = 0; a < r->atom_count; a++) {
+                unsigned int e = exp[map[a]] + r->terms[j].exp[a];
+                if (e > POLY_DEGREE) return 0;
+                exp[map[a]] = e;
+            }
+            if (!poly_add_term(out, l->terms[i].coeff * r->terms[j].coeff, exp)) return 0;
+        }
+    }
+    return poly_settle(out);
+}
+
+// Read a binary operation from its operands' polynomials into `out`.
+// Returns 0 if it doesn't read as one.
+static int
+poly_bin_op(struct poly *out, struct lilc_bin_op_node_t *n, const struct poly *l, const struct poly *r) {
+    double c;
+    int ok;
+    switch (n->op) {
+        case LILC_TOK_ADD: ok = poly_add(out, l, r, 1); break;
+        case LILC_TOK_SUB: ok = poly_add(out, l, r, -1); break;
+        case LILC_TOK_MUL: ok = poly_mul(out, l, r); break;
+        case LILC_TOK_DIV:
+            // As a product with the reciprocal
+            if (!poly_is_const(r, &c) || c == 0) return 0;
+            ok = poly_add(out, &(struct poly){0}, l, 1 / c);
+            break;
+        default:
+            return 0;
+    }
+    out->node = &n->base;
+    out->arith = 1;
+    out->ops = l->ops + r->ops + 1;
+    return ok;
+}
+
+/*
+ * Rebuilding
+ */
+
+struct builder {
+    struct arena *arena;
+    const struct poly *p;
+    uint32_t offset;    // Given to every new node
+    unsigned int ops;   // Operations built so far
+};
+
+static struct lilc_node_t *
+build_dbl(struct builder *b, double val) {
+    struct lilc_dbl_node_t *n = lilc_dbl_node_new(b->arena, val);
+    n->base.offset = b->offset;
+    return &n->base;
+}
+
+static struct lilc_node_t *
+build_op(struct builder *b, struct lilc_node_t *l, struct lilc_node_t *r, enum tok_type op) {
+    struct lilc_bin_op_node_t *n = lilc_bin_op_node_new(b->arena, l, r, op);
+    n->base.offset = b->offset;
+    b->ops++;
+    return &n->base;
+}
+
+static int
+is_dbl(struct lilc_node_t *n, double val) {
+    return n->type == LILC_NODE_DBL && ((struct lilc_dbl_node_t *)n)->val == val;
+}
+
+static struct lilc_node_t *
+build_mul(struct builder *b, struct lilc_node_t *l, struct lilc_node_t *r) {
+    if (is_dbl(l, 1)) return r;
+    return build_op(b, l, r, LILC_TOK_MUL);
+}
+
+// Take the sign off a product led by a negative constant, built as by
+// `build_sum`. Returns NULL if it isn't one.
+static struct lilc_node_t *
+unnegate(struct builder *b, struct lilc_node_t *n) {
+    // Atoms are still part of the tree they were read from
+    for (unsigned int a = 0; a < b->p->atom_count; a++) {
+        if (n == b->p->atoms[a]) return NULL;
+    }
+    if (n->type == LILC_NODE_DBL) {
+        struct lilc_dbl_node_t *d = (struct lilc_dbl_node_t *)n;
+        if (!(d->val < 0)) return NULL;
+        d->val = -d->val;
+        return n;
+    }
+    struct lilc_bin_op_node_t *op = (struct lilc_bin_op_node_t *)n;
+    if (n->type != LILC_NODE_OP_BIN || op->op != LILC_TOK_MUL) return NULL;
+    struct lilc_node_t *l = unnegate(b, op->left);
+    if (!l) return NULL;
+    if (is_dbl(l, 1)) {
+        b->ops--;
+        return op->right;
+    }
+    op->left = l;
+    return n;
+}
+
+static struct lilc_node_t *
+build_add(struct builder *b, struct lilc_node_t *l, struct lilc_node_t *r) {
+    struct lilc_node_t *neg = unnegate(b, r);
+    if (neg) return build_op(b, l, neg, LILC_TOK_SUB);
+    return build_op(b, l, r, LILC_TOK_ADD);
+}
+
+// Build the sum of `n` terms of the polynomial, in Horner form on the
+// atom of highest degree among them, their coefficients built the same
+// way on the atoms left. The terms are reordered, and their exponents of
+// that atom zeroed.
+static struct lilc_node_t *
+build_sum(struct builder *b, struct term *terms, unsigned int n) {
+    if (n == 0) return build_dbl(b, 0);
+
+    // Highest degree first, then most terms
+    unsigned int x = POLY_ATOMS, best_deg = 0, best_uses = 0;
+    for (unsigned int a = 0; a < b->p->atom_count; a++) {
+        unsigned int deg = 0, uses = 0;
+        for (unsigned int i = 0; i < n; i++) {
+            if (terms[i].exp[a] > deg) deg = terms[i].exp[a];
+            uses += terms[i].exp[a] > 0;
+        }
+        if (deg > best_deg || (deg && deg == best_deg && uses > best_uses)) {
+            x = a;
+            best_deg = deg;
+            best_uses = uses;
+        }
+    }
+    // Like terms are collected, so it's the only one
+    if (x == POLY_ATOMS) return build_dbl(b, terms[0].coeff);
+
+    // Group the terms by their power of x, highest first
+    for (unsigned int i = 1; i < n; i++) {
+        struct term t = terms[i];
+        unsigned int j = i;
+        for (; j > 0 && terms[j - 1].exp[x] < t.exp[x]; j--) terms[j] = terms[j - 1];
+        terms[j] = t;
+    }
+
+    struct lilc_node_t *acc = NULL;
+    unsigned int deg = best_deg;
+    for (unsigned int i = 0; i < n;) {
+        unsigned int d = terms[i].exp[x], j = i;
+        for (; j < n && terms[j].exp[x] == d; j++) terms[j].exp[x] = 0;
+        for (; deg > d; deg--) acc = build_mul(b, acc, b->p->atoms[x]);
+        struct lilc_node_t *coeff = build_sum(b, terms + i, j - i);
+        acc = acc ? build_add(b, acc, coeff) : coeff;
+        i = j;
+    }
+    for (; deg > 0; deg--) acc = build_mul(b, acc, b->p->atoms[x]);
+    return acc;
+}
+
+// What to put in place of the node `p` was read from: its rebuilt form,
+// if that's fewer operations
+static struct lilc_node_t *
+settle(struct reassociator *r, struct poly *p) {
+    if (!p->arith) return p->node;
+    struct builder b = {r->arena, p, p->node->offset, 0};
+    r->scratch = *p;
+    struct lilc_node_t *node = build_sum(&b, r->scratch.terms, r->scratch.term_count);
+    return b.ops < p->ops ? node : p->node;
+}
+
+static enum ast_walk_action
+reassoc_leave(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct reassociator *r = (struct reassociator *)v;
+    unsigned int count = 0;
+    while (ast_child(node, count)) count++;
+    kv_size(r->done) -= count;
+    struct poly *kids = &kv_A(r->done, kv_size(r->done));
+
+    struct poly p;
+    switch (node->type) {
+        case LILC_NODE_DBL:
+            poly_const(&p, node, ((struct lilc_dbl_node_t *)node)->val);
+            break;
+        case LILC_NODE_OP_BIN:
+            if (poly_bin_op(&p, (struct lilc_bin_op_node_t *)node, &kids[0], &kids[1])) break;
+            // fall through
+        default:
+            // Anything its operands read as is final
+            for (unsigned int i = 0; i < count; i++) {
+                ast_set_child(node, i, settle(r, &kids[i]));
+            }
+            poly_atom(&p, node);
+            break;
+    }
+    kv_push(struct poly, r->done, p);
+    return AST_DESCEND;
+}
+
+struct lilc_node_t *
+reassoc(struct lilc_node_t *root, struct arena *a, enum fp_mode fp) {
+    if (fp != LILC_FP_RELAXED) return root;
+    struct reassociator r = {{NULL, NULL, reassoc_leave}, a};
+    kv_init(r.done);
+    ast_walk(root, &r.v);
+    root = settle(&r, &kv_A(r.done, 0));
+    kv_destroy(r.done);
+    return root;
+}
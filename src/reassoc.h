@@ -0,0 +1,36 @@
+#ifndef LILC_REASSOC_H
+#define LILC_REASSOC_H
+
+#include "arena.h"
+#include "ast.h"
+
+// How closely rewrites keep to IEEE arithmetic
+enum fp_mode {
+    LILC_FP_STRICT,   // Every result rounds as written
+    LILC_FP_RELAXED,  // Results may round differently, see reassoc()
+};
+
+/*
+ * Algebraic rewriting. Each arithmetic expression, made of +, - and *,
+ * and of / by constants, is read as a polynomial in the variables and
+ * other subexpressions it's built from. Its like terms are collected and
+ * its constants combined, then it's rebuilt in Horner form, nested on the
+ * variable of highest degree first:
+ *
+ *   a*x*x*x + b*x*x + c*x + d   =>   ((a*x + b)*x + c)*x + d
+ *   2 + y*3 + 4 + y             =>   4*y + 6
+ *
+ * An expression is only replaced if that leaves it fewer operations, and
+ * subexpressions other than variables, calls say, are never duplicated.
+ *
+ * None of this is exact in floating point. Results round differently,
+ * and NaNs, infinities and signed zeros are assumed away: x - x is 0. So
+ * it's only done with `fp` relaxed; strict, the tree is left as it is.
+ *
+ * The tree is changed in place, and new nodes are allocated from `a`.
+ * Returns the new root.
+ */
+struct lilc_node_t *
+reassoc(struct lilc_node_t *root, struct arena *a, enum fp_mode fp);
+
+#endif
@@ -0,0 +1,130 @@
+#include <stdio.h>
+
+#include "kvec.h"
+
+#include "ast.h"
+#include "intern.h"
+#include "lex.h"
+#include "resolve.h"
+#include "symtab.h"
+
+// Functions are global, whatever they're defined in. Variables are
+// scoped, with each function body and block a scope of its own, but a
+// function can only see its own parameters, not those of a function it's
+// defined in: only bindings made since entering it count.
+struct resolver {
+    struct ast_visitor v;
+    struct lexer *lex;
+    int errors;
+    struct symtab funcs;            // Function number, by name
+    kvec_t(unsigned int) arity;     // Parameter count of each function
+    struct symtab vars;             // Parameter slot, by name
+    kvec_t(uint32_t) bodies;        // Where each function being defined
+                                    // started binding in `vars`
+};
+
+// Report an error at `node`, naming `name` in `fmt`
+static void
+report(struct resolver *r, struct lilc_node_t *node, const char *fmt, lilc_sym_t name) {
+    char buf[DIAG_MSG_MAX];
+    snprintf(buf, DIAG_MSG_MAX, fmt, lilc_sym_str(name));
+    lex_report(r->lex, node->offset, buf);
+    r->errors++;
+}
+
+// Number the function and open a scope for its body, with its parameters
+static void
+define(struct resolver *r, struct lilc_proto_node_t *p) {
+    if (symtab_bind(&r->funcs, p->name, kv_size(r->arity)) != 0) {
+        report(r, &p->base, "def: Function '%s' is already defined", p->name);
+    }
+    kv_push(unsigned int, r->arity, p->param_count);
+
+    kv_push(uint32_t, r->bodies, symtab_mark(&r->vars));
+    symtab_push(&r->vars);
+    for (unsigned int i = 0; i < p->param_count; i++) {
+        if (symtab_bind(&r->vars, p->params[i], i) != 0) {
+            report(r, &p->base, "def: Parameter '%s' is repeated", p->params[i]);
+        }
+    }
+}
+
+static void
+resolve_var(struct resolver *r, struct lilc_var_node_t *var) {
+    uint32_t b = symtab_find(&r->vars, var->name);
+    if (b != SYMTAB_NONE && kv_size(r->bodies) && b >= kv_A(r->bodies, kv_size(r->bodies) - 1)) {
+        var->slot = symtab_val(&r->vars, b);
+        return;
+    }
+    var->slot = LILC_UNRESOLVED;
+    report(r, &var->base, "var: Undefined variable '%s'", var->name);
+}
+
+static void
+resolve_call(struct resolver *r, struct lilc_funccall_node_t *c) {
+    uint32_t b = symtab_find(&r->funcs, c->name);
+    c->func = b == SYMTAB_NONE ? LILC_UNRESOLVED : symtab_val(&r->funcs, b);
+    if (c->func == LILC_UNRESOLVED) {
+        report(r, &c->base, "call: Undefined function '%s'", c->name);
+        return;
+    }
+    unsigned int want = kv_A(r->arity, c->func);
+    if (c->arg_count != want) {
+        char buf[DIAG_MSG_MAX];
+        snprintf(buf, DIAG_MSG_MAX, "call: Expected %u arguments to '%s' but saw %u",
+                 want, lilc_sym_str(c->name), c->arg_count);
+        lex_report(r->lex, c->base.offset, buf);
+        r->errors++;
+        c->func = LILC_UNRESOLVED;
+    }
+}
+
+static enum ast_walk_action
+resolve_enter(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct resolver *r = (struct resolver *)v;
+    switch (node->type) {
+        case LILC_NODE_PROTO:
+            // Defined before its body, so it can call itself
+            define(r, (struct lilc_proto_node_t *)node);
+            break;
+        case LILC_NODE_BLOCK:
+            symtab_push(&r->vars);
+            break;
+        case LILC_NODE_VAR:
+            resolve_var(r, (struct lilc_var_node_t *)node);
+            break;
+        case LILC_NODE_FUNCCALL:
+            resolve_call(r, (struct lilc_funccall_node_t *)node);
+            break;
+        default:
+            break;
+    }
+    return AST_DESCEND;
+}
+
+static enum ast_walk_action
+resolve_leave(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct resolver *r = (struct resolver *)v;
+    if (node->type == LILC_NODE_FUNCDEF) {
+        symtab_pop(&r->vars);
+        kv_size(r->bodies)--;
+    } else if (node->type == LILC_NODE_BLOCK) {
+        symtab_pop(&r->vars);
+    }
+    return AST_DESCEND;
+}
+
+int
+resolve(struct lilc_node_t *root, struct lexer *l) {
+    struct resolver r = {{resolve_enter, NULL, resolve_leave}, l, 0};
+    symtab_init(&r.funcs);
+    kv_init(r.arity);
+    symtab_init(&r.vars);
+    kv_init(r.bodies);
+    ast_walk(root, &r.v);
+    symtab_free(&r.funcs);
+    kv_destroy(r.arity);
+    symtab_free(&r.vars);
+    kv_destroy(r.bodies);
+    return r.errors;
+}
@@ -0,0 +1,22 @@
+#ifndef LILC_RESOLVE_H
+#define LILC_RESOLVE_H
+
+#include "ast.h"
+#include "lex.h"
+
+/*
+ * Name resolution, run on a tree once it's parsed and before generating
+ * code for it, which relies on what it finds. Each variable is
+ * pointed at the parameter of the enclosing function it names (`slot`),
+ * and each call at the function it calls (`func`). Functions are numbered
+ * in the order they're defined, which is the order codegen meets them in.
+ * A function can be called from its own body and anywhere after it.
+ *
+ * Undefined names, functions defined twice, repeated parameters and calls
+ * with the wrong number of arguments are reported through `l`, like
+ * errors found while parsing. Returns how many there were.
+ */
+int
+resolve(struct lilc_node_t *root, struct lexer *l);
+
+#endif
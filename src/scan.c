@@ -0,0 +1,196 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "scan.h"
+
+#define SP LILC_CC_SPACE
+#define NL (LILC_CC_SPACE | LILC_CC_NL)
+#define AL LILC_CC_ALPHA
+#define DG LILC_CC_DIGIT
+
+const unsigned char lilc_cclass[256] = {
+    [' '] = SP, ['\t'] = SP, ['\n'] = NL,
+    ['_'] = LILC_CC_UNDER,
+    ['0'] = DG, ['1'] = DG, ['2'] = DG, ['3'] = DG, ['4'] = DG,
+    ['5'] = DG, ['6'] = DG, ['7'] = DG, ['8'] = DG, ['9'] = DG,
+    ['a'] = AL, ['b'] = AL, ['c'] = AL, ['d'] = AL, ['e'] = AL, ['f'] = AL,
+    ['g'] = AL, ['h'] = AL, ['i'] = AL, ['j'] = AL, ['k'] = AL, ['l'] = AL,
+    ['m'] = AL, ['n'] = AL, ['o'] = AL, ['p'] = AL, ['q'] = AL, ['r'] = AL,
+    ['s'] = AL, ['t'] = AL, ['u'] = AL, ['v'] = AL, ['w'] = AL, ['x'] = AL,
+    ['y'] = AL, ['z'] = AL,
+    ['A'] = AL, ['B'] = AL, ['C'] = AL, ['D'] = AL, ['E'] = AL, ['F'] = AL,
+    ['G'] = AL, ['H'] = AL, ['I'] = AL, ['J'] = AL, ['K'] = AL, ['L'] = AL,
+    ['M'] = AL, ['N'] = AL, ['O'] = AL, ['P'] = AL, ['Q'] = AL, ['R'] = AL,
+    ['S'] = AL, ['T'] = AL, ['U'] = AL, ['V'] = AL, ['W'] = AL, ['X'] = AL,
+    ['Y'] = AL, ['Z'] = AL,
+};
+
+#undef SP
+#undef NL
+#undef AL
+#undef DG
+
+/*
+ * Vector primitives. AVX2 and SSE2 are picked at compile time (build with
+ * -mavx2 or -march=native for the wide path); anything else falls back to
+ * the byte-at-a-time loops below, driven by the same class table.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_WIDTH 32
+typedef __m256i vec_t;
+#define vload(p)   _mm256_loadu_si256((const __m256i *)(p))
+#define vset1(c)   _mm256_set1_epi8((char)(c))
+#define veq(a, b)  _mm256_cmpeq_epi8(a, b)
+#define vgt(a, b)  _mm256_cmpgt_epi8(a, b)
+#define vor(a, b)  _mm256_or_si256(a, b)
+#define vadd(a, b) _mm256_add_epi8(a, b)
+#define vmask(v)   ((uint32_t)_mm256_movemask_epi8(v))
+#define LANES      0xffffffffu
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SCAN_WIDTH 16
+typedef __m128i vec_t;
+#define vload(p)   _mm_loadu_si128((const __m128i *)(p))
+#define vset1(c)   _mm_set1_epi8((char)(c))
+#define veq(a, b)  _mm_cmpeq_epi8(a, b)
+#define vgt(a, b)  _mm_cmpgt_epi8(a, b)
+#define vor(a, b)  _mm_or_si128(a, b)
+#define vadd(a, b) _mm_add_epi8(a, b)
+#define vmask(v)   ((uint32_t)_mm_movemask_epi8(v))
+#define LANES      0xffffu
+#endif
+
+#ifdef SCAN_WIDTH
+
+// A full-width load starting at `p` may run past the terminating NUL.
+// That's harmless as long as it stays within the same page, which is
+// all we need to know to avoid faulting on the source buffer's last page.
+#define PAGE_SIZE 4096
+#define PAGE_SAFE(p) (((uintptr_t)(p) & (PAGE_SIZE - 1)) <= PAGE_SIZE - SCAN_WIDTH)
+
+// Such over-reads are deliberate, so keep ASan from flagging them.
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define NO_ASAN __attribute__((no_sanitize_address))
+#endif
+#elif defined(__SANITIZE_ADDRESS__)
+#define NO_ASAN __attribute__((no_sanitize_address))
+#endif
+
+// Lanes whose byte lies in [lo, hi]. SSE2/AVX2 only compare signed bytes,
+// so shift the range down to start at -128 and do a single compare.
+static inline vec_t
+in_range(vec_t v, unsigned char lo, unsigned char hi) {
+    vec_t shifted = vadd(v, vset1(0x80 - lo));
+    return vgt(vset1(-128 + (hi - lo) + 1), shifted);
+}
+
+static inline uint32_t
+ident_mask(vec_t v) {
+    // Setting bit 5 folds upper case onto lower case without folding
+    // anything else into [a-z].
+    vec_t alpha = in_range(vor(v, vset1(0x20)), 'a', 'z');
+    vec_t digit = in_range(v, '0', '9');
+    return vmask(vor(vor(alpha, digit), veq(v, vset1('_'))));
+}
+
+#endif
+
+#ifndef NO_ASAN
+#define NO_ASAN
+#endif
+
+NO_ASAN size_t
+scan_space(const char *s) {
+    const char *p = s;
+    for (;;) {
+#ifdef SCAN_WIDTH
+        if (PAGE_SAFE(p)) {
+            vec_t v = vload(p);
+            uint32_t ws = vmask(vor(vor(veq(v, vset1(' ')), veq(v, vset1('\t'))),
+                                    veq(v, vset1('\n'))));
+            uint32_t stop = ~ws & LANES;
+            if (stop) return (p - s) + __builtin_ctz(stop);
+            p += SCAN_WIDTH;
+            continue;
+        }
+#endif
+        if (!lilc_cc_is(*p, LILC_CC_SPACE)) break;
+        p++;
+    }
+    return p - s;
+}
+
+NO_ASAN size_t
+scan_ident(const char *s) {
+    const char *p = s;
+    for (;;) {
+#ifdef SCAN_WIDTH
+        if (PAGE_SAFE(p)) {
+            uint32_t stop = ~ident_mask(vload(p)) & LANES;
+            if (stop) return (p - s) + __builtin_ctz(stop);
+            p += SCAN_WIDTH;
+            continue;
+        }
+#endif
+        if (!lilc_cc_is(*p, LILC_CC_IDENT)) break;
+        p++;
+    }
+    return p - s;
+}
+
+NO_ASAN size_t
+scan_digits(const char *s) {
+    const char *p = s;
+    for (;;) {
+#ifdef SCAN_WIDTH
+        if (PAGE_SAFE(p)) {
+            uint32_t stop = ~vmask(in_range(vload(p), '0', '9')) & LANES;
+            if (stop) return (p - s) + __builtin_ctz(stop);
+            p += SCAN_WIDTH;
+            continue;
+        }
+#endif
+        if (!lilc_cc_is(*p, LILC_CC_DIGIT)) break;
+        p++;
+    }
+    return p - s;
+}
+
+// Length of the run containing none of '{', '}' or ';'. Used to find
+// statement boundaries without lexing.
+NO_ASAN size_t
+scan_delims(const char *s) {
+    const char *p = s;
+    for (;;) {
+#ifdef SCAN_WIDTH
+        if (PAGE_SAFE(p)) {
+            vec_t v = vload(p);
+            uint32_t stop = vmask(vor(vor(veq(v, vset1('{')), veq(v, vset1('}'))),
+                                      vor(veq(v, vset1(';')), veq(v, vset1('\0')))));
+            if (stop) return (p - s) + __builtin_ctz(stop);
+            p += SCAN_WIDTH;
+            continue;
+        }
+#endif
+        if (*p == '{' || *p == '}' || *p == ';' || *p == '\0') break;
+        p++;
+    }
+    return p - s;
+}
+
+// Offset of the first '\n' in the `len` bytes at `s`, or `len` if there
+// is none. Unlike the scanners above, never reads past `s + len`.
+size_t
+scan_newline(const char *s, size_t len) {
+    size_t i = 0;
+#ifdef SCAN_WIDTH
+    for (; i + SCAN_WIDTH <= len; i += SCAN_WIDTH) {
+        uint32_t nl = vmask(veq(vload(s + i), vset1('\n')));
+        if (nl) return i + __builtin_ctz(nl);
+    }
+#endif
+    while (i < len && s[i] != '\n') i++;
+    return i;
+}
@@ -0,0 +1,40 @@
+#ifndef LILC_SCAN_H
+#define LILC_SCAN_H
+
+#include <stddef.h>
+
+/*
+ * Character classes used by the lexer, in place of the locale-aware
+ * <ctype.h> predicates. Indexed by unsigned byte value.
+ */
+#define LILC_CC_SPACE 0x01  // ' ', '\t', '\n'
+#define LILC_CC_NL    0x02  // '\n'
+#define LILC_CC_ALPHA 0x04  // [A-Za-z]
+#define LILC_CC_DIGIT 0x08  // [0-9]
+#define LILC_CC_UNDER 0x10  // '_'
+#define LILC_CC_IDENT (LILC_CC_ALPHA | LILC_CC_DIGIT | LILC_CC_UNDER)
+
+extern const unsigned char lilc_cclass[256];
+
+#define lilc_cc_is(c, cls) (lilc_cclass[(unsigned char)(c)] & (cls))
+
+/*
+ * Bulk scanners. Each returns the length of the run of matching bytes at
+ * the start of `s`. `s` must be NUL-terminated; NUL never matches.
+ */
+size_t
+scan_space(const char *s);
+
+size_t
+scan_ident(const char *s);
+
+size_t
+scan_digits(const char *s);
+
+size_t
+scan_delims(const char *s);
+
+size_t
+scan_newline(const char *s, size_t len);
+
+#endif
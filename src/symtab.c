@@ -0,0 +1,56 @@
+#include "kvec.h"
+
+#include "symtab.h"
+
+// Names bound before any scope is entered are global
+void
+symtab_init(struct symtab *t) {
+    kv_init(t->heads);
+    kv_init(t->bindings);
+    kv_init(t->scopes);
+}
+
+void
+symtab_free(struct symtab *t) {
+    kv_destroy(t->heads);
+    kv_destroy(t->bindings);
+    kv_destroy(t->scopes);
+}
+
+void
+symtab_push(struct symtab *t) {
+    kv_push(uint32_t, t->scopes, symtab_mark(t));
+}
+
+// Leave the innermost scope, undoing its bindings newest first
+void
+symtab_pop(struct symtab *t) {
+    uint32_t mark = kv_pop(t->scopes);
+    while (kv_size(t->bindings) > mark) {
+        struct binding b = kv_pop(t->bindings);
+        kv_A(t->heads, b.name) = b.shadowed;
+    }
+}
+
+// Bind `name` to `val` in the innermost scope. Returns 0, or -1 without
+// binding it if the scope already has.
+int
+symtab_bind(struct symtab *t, uint32_t name, uint32_t val) {
+    while (kv_size(t->heads) <= name) {
+        kv_push(uint32_t, t->heads, SYMTAB_NONE);
+    }
+    uint32_t head = kv_A(t->heads, name);
+    uint32_t scope = kv_size(t->scopes) ? kv_A(t->scopes, kv_size(t->scopes) - 1) : 0;
+    if (head != SYMTAB_NONE && head >= scope) return -1;
+
+    struct binding b = {name, val, head};
+    kv_A(t->heads, name) = symtab_mark(t);
+    kv_push(struct binding, t->bindings, b);
+    return 0;
+}
+
+// Number of the innermost binding of `name`, or SYMTAB_NONE
+uint32_t
+symtab_find(const struct symtab *t, uint32_t name) {
+    return name < kv_size(t->heads) ? kv_A(t->heads, name) : SYMTAB_NONE;
+}
@@ -0,0 +1,55 @@
+#ifndef LILC_SYMTAB_H
+#define LILC_SYMTAB_H
+
+#include <stdint.h>
+
+#include "kvec.h"
+
+/*
+ * Scoped symbol table. Names are small integers, such as interned symbol
+ * IDs, and each one's bindings are chained from the innermost out, headed
+ * from an array indexed by the name: looking a name up is one array
+ * access. Bindings are kept on a stack in the order they're made, which
+ * doubles as the log for undoing them, so leaving a scope takes time in
+ * proportion to what was bound in it, however big the table is.
+ */
+#define SYMTAB_NONE UINT32_MAX
+
+struct binding {
+    uint32_t name;
+    uint32_t val;
+    uint32_t shadowed;  // Binding of the same name it hides, or SYMTAB_NONE
+};
+
+struct symtab {
+    kvec_t(uint32_t) heads;           // Innermost binding of each name
+    kvec_t(struct binding) bindings;  // Every binding in scope, outermost first
+    kvec_t(uint32_t) scopes;          // Bindings made before each open scope
+};
+
+void
+symtab_init(struct symtab *t);
+
+void
+symtab_free(struct symtab *t);
+
+void
+symtab_push(struct symtab *t);
+
+void
+symtab_pop(struct symtab *t);
+
+int
+symtab_bind(struct symtab *t, uint32_t name, uint32_t val);
+
+uint32_t
+symtab_find(const struct symtab *t, uint32_t name);
+
+// Number of the next binding to be made. Bindings are numbered from 0 in
+// the order they're made, and a scope's all number at least what this
+// was on entering it.
+#define symtab_mark(t) ((uint32_t)kv_size((t)->bindings))
+
+#define symtab_val(t, i) (kv_A((t)->bindings, i).val)
+
+#endif
@@ -21,4 +21,5 @@ char *lilc_token_str[] = {
   [LILC_TOK_CMPLT] = "<",
   [LILC_TOK_IF] = "if",
   [LILC_TOK_ELSE] = "else",
+  [LILC_TOK_AT] = "@",
 };
@@ -1,6 +1,10 @@
 #ifndef LILC_TOKEN_H
 #define LILC_TOKEN_H
 
+#include <stddef.h>
+
+#include "intern.h"
+
 enum tok_type {
     LILC_TOK_ERR,
     LILC_TOK_EOS,
@@ -20,13 +24,16 @@ enum tok_type {
     LILC_TOK_CMPLT,
     LILC_TOK_IF,
     LILC_TOK_ELSE,
+    LILC_TOK_AT,
 };
 
 struct token {
     enum tok_type cls;
+    size_t offset;  // Span of the token's text in the source buffer
+    size_t len;
     union {
       double as_dbl;
-      char *as_str;
+      lilc_sym_t as_sym;
     } val;
 };
 
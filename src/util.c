@@ -2,6 +2,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "util.h"
 
@@ -11,6 +15,12 @@ die(char *file, int line, char *msg) {
     exit(1);
 }
 
+void
+die_at(char *file, int line, int col, char *msg) {
+    fprintf(stderr, "%s:%d:%d - %s\n", file, line, col, msg);
+    exit(1);
+}
+
 #define DIE() (die(__FILE__, __LINE__, strerror(errno)))
 
 // Return the size of a file or -1
@@ -49,3 +59,80 @@ read_file(char *filename) {
     fclose(f);
     return buf;
 }
+
+// Copy everything readable from `fd` into a malloc'd, NUL-terminated
+// buffer. Works on pipes and other streams that can't be sized up front.
+static char *
+read_fd(int fd, size_t *len) {
+    size_t cap = 64 * 1024, n = 0;
+    char *buf = malloc(cap);
+    if (!buf) DIE();
+
+    ssize_t r;
+    while ((r = read(fd, buf + n, cap - n - 1)) != 0) {
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            DIE();
+        }
+        n += r;
+        if (cap - n - 1 == 0) {
+            cap *= 2;
+            if (!(buf = realloc(buf, cap))) DIE();
+        }
+    }
+    buf[n] = '\0';
+    *len = n;
+    return buf;
+}
+
+// Map `len` bytes of a regular file followed by at least one NUL byte.
+// Past EOF, the file's last page is zero-filled by the kernel; if the
+// file ends exactly on a page boundary, an anonymous zero page reserved
+// beneath the mapping supplies the terminator instead.
+static const char *
+map_fd(int fd, size_t len, size_t *map_len) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    *map_len = (len + 1 + page - 1) / page * page;
+
+    char *base = mmap(NULL, *map_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return NULL;
+    if (mmap(base, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, *map_len);
+        return NULL;
+    }
+    madvise(base, len, MADV_SEQUENTIAL);
+    return base;
+}
+
+void
+source_open_fd(struct source_view *v, int fd) {
+    struct stat st;
+    if (fstat(fd, &st)) DIE();
+
+    v->map_len = 0;
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        v->len = st.st_size;
+        if ((v->data = map_fd(fd, v->len, &v->map_len))) return;
+    }
+
+    // Fall back to copying
+    v->data = read_fd(fd, &v->len);
+}
+
+void
+source_open(struct source_view *v, char *path) {
+    int fd;
+    if ((fd = open(path, O_RDONLY)) < 0) DIE();
+    source_open_fd(v, fd);
+    close(fd);  // A mapping stays valid after its descriptor is closed
+}
+
+void
+source_close(struct source_view *v) {
+    if (v->map_len) {
+        munmap((void *)v->data, v->map_len);
+    } else {
+        free((void *)v->data);
+    }
+    v->data = NULL;
+}
@@ -1,10 +1,33 @@
 #ifndef LILC_UTIL_H
 #define LILC_UTIL_H
 
+#include <stddef.h>
+
 void
 die(char *file, int line, char *msg);
 
+void
+die_at(char *file, int line, int col, char *msg);
+
 char *
 read_file(char *filename);
 
+// Read-only, NUL-terminated view of a whole source file that the lexer
+// can scan in place. Regular files are mmap'd; anything else (pipes,
+// ttys, ...) is copied into a heap buffer.
+struct source_view {
+    const char *data;
+    size_t len;       // Length excluding the trailing NUL
+    size_t map_len;   // Size of the mapping, 0 if `data` is heap-allocated
+};
+
+void
+source_open(struct source_view *v, char *path);
+
+void
+source_open_fd(struct source_view *v, int fd);
+
+void
+source_close(struct source_view *v);
+
 #endif
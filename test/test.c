@@ -1,12 +1,27 @@
 #include <assert.h>
+#include <fcntl.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "codegen.h"
+#include "ctfe.h"
+#include "flat.h"
+#include "fold.h"
+#include "inline.h"
+#include "intern.h"
 #include "lex.h"
+#include "memo.h"
+#include "num.h"
 #include "parse.h"
+#include "prune.h"
+#include "reassoc.h"
+#include "resolve.h"
+#include "symtab.h"
 #include "ast.h"
 #include "util.h"
 
@@ -31,6 +46,134 @@ test_lexer(char *src_path, char *want_path) {
     free(want);
 }
 
+// Lex a source through both `source_view` loaders, mmap for the file
+// itself and the copying fallback for the same bytes fed through a pipe.
+static void
+test_source_view(char *src_path, char *want_path) {
+    char *want = read_file(want_path);
+
+    struct source_view mapped, piped;
+    source_open(&mapped, src_path);
+    assert(mapped.map_len > 0);
+    assert(mapped.data[mapped.len] == '\0');
+
+    int fds[2];
+    assert(pipe(fds) == 0);
+    assert(write(fds[1], mapped.data, mapped.len) == mapped.len);
+    close(fds[1]);
+    source_open_fd(&piped, fds[0]);
+    close(fds[0]);
+    assert(piped.map_len == 0);
+    assert(piped.len == mapped.len);
+
+    struct source_view *views[] = {&mapped, &piped};
+    for (int i = 0; i < 2; i++) {
+        struct lexer l;
+        lex_init(&l, views[i]->data, src_path);
+
+        char got[MAX_TOK_STR] = {0};
+        int b = tok_strm_readf(got, &l);
+
+        assert(b <= MAX_TOK_STR);
+        assert(0 == strcmp(want, got));
+    }
+
+    source_close(&mapped);
+    source_close(&piped);
+    free(want);
+}
+
+// Stream a source through a pipe into lexers with windows from
+// `min_window` up to a few times that, so tokens land across refills
+// at every possible split.
+static void
+test_lexer_stream(char *src_path, char *want_path, size_t min_window) {
+    char *src = read_file(src_path);
+    char *want = read_file(want_path);
+
+    for (size_t w = min_window; w < min_window * 4; w++) {
+        int fds[2];
+        assert(pipe(fds) == 0);
+        assert(write(fds[1], src, strlen(src)) == strlen(src));
+        close(fds[1]);
+
+        struct lexer l;
+        lex_init_fd(&l, fds[0], src_path, w);
+
+        char got[MAX_TOK_STR] = {0};
+        int b = tok_strm_readf(got, &l);
+
+        assert(b <= MAX_TOK_STR);
+        assert(0 == strcmp(want, got));
+
+        lex_close(&l);
+        close(fds[0]);
+    }
+
+    free(src);
+    free(want);
+}
+
+// Look up the line and column of every token while lexing through a
+// small window, so lines are indexed as bytes leave it, and check them
+// against a count over the whole text.
+static void
+test_locate(char *src_path, size_t window) {
+    char *src = read_file(src_path);
+    int fds[2];
+    assert(pipe(fds) == 0);
+    assert(write(fds[1], src, strlen(src)) == strlen(src));
+    close(fds[1]);
+
+    struct lexer l;
+    lex_init_fd(&l, fds[0], src_path, window);
+    while (lex_scan(&l) != LILC_TOK_EOS) {
+        int line = 1, col = 1;
+        for (size_t i = 0; i < l.tok.offset; i++) {
+            if (src[i] == '\n') {
+                line++;
+                col = 1;
+            } else {
+                col++;
+            }
+        }
+        struct src_pos pos = lex_locate(&l, l.tok.offset);
+        assert(pos.line == line && pos.col == col);
+    }
+
+    lex_close(&l);
+    close(fds[0]);
+    free(src);
+}
+
+// Convert `count` random literals, checking each is bit-for-bit what
+// `strtod` gives. Mantissas and exponents are drawn from ranges either
+// side of the fast path's limits.
+static void
+test_strtod(int count) {
+    char lit[64];
+    srand(2);
+    for (int i = 0; i < count; i++) {
+        int n = 0;
+        int int_digits = rand() % 12, frac_digits = rand() % 12;
+        if (rand() % 8 == 0) int_digits += 15;
+        for (int j = 0; j < int_digits || j == 0; j++) lit[n++] = '0' + rand() % 10;
+        if (frac_digits) {
+            lit[n++] = '.';
+            for (int j = 0; j < frac_digits; j++) lit[n++] = '0' + rand() % 10;
+        }
+        if (rand() % 2) {
+            n += sprintf(lit + n, "%c%s%d", "eE"[rand() % 2],
+                         (char *[]){"", "+", "-"}[rand() % 3], rand() % 60);
+        }
+        lit[n] = '\0';
+
+        double got = lilc_strtod(lit, n);
+        double want = strtod(lit, NULL);
+        assert(0 == memcmp(&got, &want, sizeof(double)));
+    }
+}
+
 #define MAX_NODES 512  // Max length of formatted AST
 
 static void
@@ -41,7 +184,9 @@ test_parser(char *src_path, char *want_path) {
     struct lexer l;
     struct parser p;
     lex_init(&l, src, src_path);
-    parser_init(&p, &l);
+    struct arena a;
+    arena_init(&a);
+    parser_init(&p, &l, &a);
 
     struct lilc_node_t *node;
     node = parse(&p);
@@ -53,10 +198,1083 @@ test_parser(char *src_path, char *want_path) {
     assert(b < MAX_NODES);
     assert(0 == strcmp(want, got));
 
+    // The flat form of the tree reads the same
+    struct flat_ast f;
+    flat_ast_init(&f);
+    flat_ast_build(&f, node);
+    memset(got, 0, MAX_NODES);
+    b = flat_ast_readf(got, 0, 0, &f, 0);
+    assert(b < MAX_NODES);
+    assert(0 == strcmp(want, got));
+
+    flat_ast_free(&f);
+    parser_free(&p);
+
+    // So does the tree parsed while lexing on another thread
+    lex_close(&l);
+    lex_init(&l, src, src_path);
+    parser_init(&p, &l, &a);
+    p.pipelined = 1;
+    node = parse(&p);
+    memset(got, 0, MAX_NODES);
+    b = ast_readf(got, 0, 0, node);
+    assert(b < MAX_NODES);
+    assert(0 == strcmp(want, got));
+
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+    free(src);
+    free(want);
+}
+
+#define MAX_DIAG_STR 1024  // Max length of formatted diagnostics
+
+// Parse a source with several syntax errors in one pass, checking both
+// the errors reported and the tree recovered from around them.
+static void
+test_parse_errors(char *src_path, char *want_diag_path, char *want_ast_path) {
+    char *src = read_file(src_path);
+    char *want_diag = read_file(want_diag_path);
+    char *want_ast = read_file(want_ast_path);
+
+    // Sequentially, then pipelined
+    for (int pipelined = 0; pipelined < 2; pipelined++) {
+        struct lexer l;
+        struct parser p;
+        lex_init(&l, src, src_path);
+        struct arena a;
+        arena_init(&a);
+        parser_init(&p, &l, &a);
+        p.pipelined = pipelined;
+
+        struct lilc_node_t *node = parse_collect(&p);
+
+        char got[MAX_DIAG_STR] = {0};
+        int b = 0;
+        for (size_t i = 0; i < kv_size(p.diags); i++) {
+            struct lilc_diag *d = &kv_A(p.diags, i);
+            b += snprintf(got + b, MAX_DIAG_STR - b, "%d:%d - %s\n", d->pos.line, d->pos.col, d->msg);
+        }
+        assert(b < MAX_DIAG_STR);
+        assert(0 == strcmp(want_diag, got));
+
+        memset(got, 0, MAX_DIAG_STR);
+        b = ast_readf(got, 0, 0, node);
+        assert(b < MAX_DIAG_STR);
+        assert(0 == strcmp(want_ast, got));
+
+        parser_free(&p);
+        lex_close(&l);
+        arena_free(&a);
+    }
+    free(src);
+    free(want_diag);
+    free(want_ast);
+}
+
+// Intern enough names to fill several of the table's chunks, then check
+// each reads back as it went in, and is found again as the same symbol
+static void
+test_intern(int count) {
+    lilc_sym_t *syms = malloc(sizeof(lilc_sym_t) * count);
+    unsigned int before = lilc_sym_count();
+    char name[32];
+    for (int i = 0; i < count; i++) {
+        int n = sprintf(name, "interned_%d", i);
+        syms[i] = lilc_intern(name, n);
+    }
+    assert(lilc_sym_count() == before + count);
+
+    for (int i = 0; i < count; i++) {
+        int n = sprintf(name, "interned_%d", i);
+        assert(lilc_sym_len(syms[i]) == n);
+        assert(0 == strcmp(lilc_sym_str(syms[i]), name));
+        assert(lilc_intern(name, n) == syms[i]);
+    }
+    assert(lilc_sym_count() == before + count);
+    free(syms);
+}
+
+// Bind and shadow names through nested scopes, then leave them
+static void
+test_symtab(void) {
+    struct symtab t;
+    symtab_init(&t);
+    assert(symtab_bind(&t, 3, 30) == 0);
+    assert(symtab_bind(&t, 3, 31) == -1);  // Already bound in this scope
+    assert(symtab_find(&t, 7) == SYMTAB_NONE);
+
+    symtab_push(&t);
+    uint32_t mark = symtab_mark(&t);
+    assert(symtab_bind(&t, 3, 32) == 0);
+    assert(symtab_bind(&t, 1000, 1) == 0);
+    symtab_push(&t);
+    assert(symtab_bind(&t, 3, 33) == 0);
+    assert(symtab_val(&t, symtab_find(&t, 3)) == 33);
+    symtab_pop(&t);
+    assert(symtab_val(&t, symtab_find(&t, 3)) == 32);
+    assert(symtab_find(&t, 3) >= mark);
+    symtab_pop(&t);
+
+    assert(symtab_val(&t, symtab_find(&t, 3)) == 30);
+    assert(symtab_find(&t, 3) < mark);
+    assert(symtab_find(&t, 1000) == SYMTAB_NONE);
+    symtab_free(&t);
+}
+
+// Resolve names in a source with several mistakes in naming, checking
+// they're all reported
+static void
+test_resolve(char *src_path, char *want_diag_path) {
+    char *src = read_file(src_path);
+    char *want_diag = read_file(want_diag_path);
+
+    struct lexer l;
+    struct parser p;
+    lex_init(&l, src, src_path);
+    struct arena a;
+    arena_init(&a);
+    parser_init(&p, &l, &a);
+
+    struct lilc_node_t *node = parse(&p);
+    int errors = resolve(node, &l);
+    assert(errors == kv_size(p.diags));
+
+    char got[MAX_DIAG_STR] = {0};
+    int b = 0;
+    for (size_t i = 0; i < kv_size(p.diags); i++) {
+        struct lilc_diag *d = &kv_A(p.diags, i);
+        b += snprintf(got + b, MAX_DIAG_STR - b, "%d:%d - %s\n", d->pos.line, d->pos.col, d->msg);
+    }
+    assert(b < MAX_DIAG_STR);
+    assert(0 == strcmp(want_diag, got));
+
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+    free(src);
+    free(want_diag);
+}
+
+#define MAX_INCR_AST (64 * 1024)
+
+// Append the source offsets of `node` and everything under it, plus `shift`
+static int
+node_offsets(struct lilc_node_t *node, ptrdiff_t shift, size_t *out, int n) {
+    out[n++] = node->offset + shift;
+    switch (node->type) {
+        case LILC_NODE_BLOCK: {
+            struct lilc_block_node_t *b = (struct lilc_block_node_t *)node;
+            for (int i = 0; i < b->stmt_count; i++) {
+                n = node_offsets(b->stmts[i], shift, out, n);
+            }
+            break;
+        }
+        case LILC_NODE_OP_BIN: {
+            struct lilc_bin_op_node_t *b = (struct lilc_bin_op_node_t *)node;
+            n = node_offsets(b->left, shift, out, n);
+            n = node_offsets(b->right, shift, out, n);
+            break;
+        }
+        case LILC_NODE_FUNCDEF: {
+            struct lilc_funcdef_node_t *f = (struct lilc_funcdef_node_t *)node;
+            n = node_offsets((struct lilc_node_t *)f->proto, shift, out, n);
+            n = node_offsets(f->body, shift, out, n);
+            break;
+        }
+        case LILC_NODE_FUNCCALL: {
+            struct lilc_funccall_node_t *c = (struct lilc_funccall_node_t *)node;
+            for (int i = 0; i < c->arg_count; i++) {
+                n = node_offsets(c->args[i], shift, out, n);
+            }
+            break;
+        }
+        case LILC_NODE_IF: {
+            struct lilc_if_node_t *f = (struct lilc_if_node_t *)node;
+            n = node_offsets(f->cond, shift, out, n);
+            n = node_offsets((struct lilc_node_t *)f->then_block, shift, out, n);
+            if (f->else_block) {
+                n = node_offsets((struct lilc_node_t *)f->else_block, shift, out, n);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return n;
+}
+
+// Pick a random edit to the session's text that keeps it a valid program:
+// retyping a number or identifier, adding whitespace, or adding or
+// removing whole statements at the top level or inside a function body.
+static void
+random_edit(struct parse_session *s, struct text_edit *e, char *text) {
+    static char *ids[] = {"a", "foo", "bar", "x1", "arg2"};
+    static char *stmts[] = {
+        "\ndef h(a, b) { a * b + 1; };",
+        "\n(1 + 2) < 3;",
+        "\ndef g() { if (1) { 2; } else { 3; }; };",
+    };
+
+    // Token spans, by class
+    size_t nums[1024], idents[1024], curls[1024], lens[1024];
+    int n_nums = 0, n_ids = 0, n_curls = 0;
+    struct lexer l;
+    lex_init(&l, s->text, s->path);
+    while (lex_scan(&l) != LILC_TOK_EOS) {
+        if (lex_is(&l, LILC_TOK_DBL)) nums[n_nums++] = l.tok.offset;
+        if (lex_is(&l, LILC_TOK_LCURL)) curls[n_curls++] = l.tok.offset;
+        if (lex_is(&l, LILC_TOK_ID)) {
+            lens[n_ids] = l.tok.len;
+            idents[n_ids++] = l.tok.offset;
+        }
+    }
+
+    // Pick a kind of edit there's something to apply to
+    int kind;
+    do {
+        kind = rand() % 6;
+    } while ((kind == 0 && !n_nums) || (kind == 1 && !n_ids) ||
+             (kind == 2 && !n_ids) || (kind == 4 && kv_size(s->spans) < 2) ||
+             (kind == 5 && !n_curls));
+
+    size_t at;
+    e->text = text;
+    switch (kind) {
+        case 0:  // Retype a number
+            at = nums[rand() % n_nums];
+            e->start = at;
+            e->end = at + strspn(s->text + at, "0123456789");
+            e->len = sprintf(text, "%d", rand() % 1000);
+            break;
+        case 1: {  // Rename an identifier
+            int i = rand() % n_ids;
+            e->start = idents[i];
+            e->end = idents[i] + lens[i];
+            e->len = sprintf(text, "%s", ids[rand() % 5]);
+            break;
+        }
+        case 2:  // Whitespace before a token
+            at = idents[rand() % n_ids];
+            e->start = e->end = at;
+            e->len = sprintf(text, "%s", rand() % 2 ? "\n  " : "\t");
+            break;
+        case 3: {  // New top-level statement
+            int i = rand() % (kv_size(s->spans) + 1);
+            e->start = e->end = i ? kv_A(s->spans, i - 1).end : 0;
+            e->len = sprintf(text, "%s", stmts[rand() % 3]);
+            break;
+        }
+        case 4: {  // Remove a top-level statement
+            struct stmt_span span = kv_A(s->spans, rand() % kv_size(s->spans));
+            e->start = span.start;
+            e->end = span.end;
+            e->len = 0;
+            break;
+        }
+        default:  // New statement at the start of a block
+            at = curls[rand() % n_curls] + 1;
+            e->start = e->end = at;
+            e->len = sprintf(text, " %d * arg1;", rand() % 10);
+            break;
+    }
+}
+
+// Apply randomized edits through a parse session, checking after each
+// that the incrementally updated tree matches a from-scratch parse, node
+// offsets included.
+static void
+test_parse_incremental(char *src_path, int rounds) {
+    char *src = read_file(src_path);
+    char *got = malloc(MAX_INCR_AST);
+    char *want = malloc(MAX_INCR_AST);
+    size_t *got_offs = malloc(sizeof(size_t) * MAX_INCR_AST);
+    size_t *want_offs = malloc(sizeof(size_t) * MAX_INCR_AST);
+
+    struct parse_session s;
+    parse_session_init(&s, src, strlen(src), src_path);
+
+    srand(1);
+    for (int r = 0; r < rounds; r++) {
+        // Every so often, batch a second edit onto the first
+        struct text_edit edits[2];
+        char text[2][64];
+        random_edit(&s, &edits[0], text[0]);
+        edits[1] = (struct text_edit){0, 0, "\n", 1};
+        struct lilc_node_t *node = parse_session_edit(&s, edits, 1 + (r % 5 == 0));
+
+        struct lexer l;
+        struct parser p;
+        lex_init(&l, s.text, src_path);
+        struct arena a;
+        arena_init(&a);
+        parser_init(&p, &l, &a);
+
+        int b = ast_readf(got, 0, 0, node);
+        assert(b < MAX_INCR_AST);
+        struct lilc_block_node_t *fresh = (struct lilc_block_node_t *)parse(&p);
+        b = ast_readf(want, 0, 0, (struct lilc_node_t *)fresh);
+        assert(b < MAX_INCR_AST);
+        assert(0 == strcmp(want, got));
+
+        int n_got = 0, n_want = 0;
+        for (int i = 0; i < kv_size(s.spans); i++) {
+            n_got = node_offsets(s.root->stmts[i], kv_A(s.spans, i).shift,
+                                 got_offs, n_got);
+            n_want = node_offsets(fresh->stmts[i], 0, want_offs, n_want);
+        }
+        assert(n_got == n_want);
+        assert(0 == memcmp(got_offs, want_offs, sizeof(size_t) * n_got));
+
+        parser_free(&p);
+        arena_free(&a);
+    }
+
+    parse_session_free(&s);
+    free(src);
+    free(got);
+    free(want);
+    free(got_offs);
+    free(want_offs);
+}
+
+// Parse `copies` copies of a program on `nthreads` threads, and pipelined,
+// checking the trees against a sequential parse, then that a lex error in
+// the last copy is reported at the right line and column.
+static void
+test_parse_parallel(char *src_path, int copies, int nthreads) {
+    char *one = read_file(src_path);
+    size_t n = strlen(one);
+    int one_lines = 0;
+    for (size_t i = 0; i < n; i++) one_lines += one[i] == '\n';
+
+    char *src = malloc(n * copies + 1);
+    for (int c = 0; c < copies; c++) memcpy(src + n * c, one, n);
+    src[n * copies] = '\0';
+
+    struct lexer l;
+    struct parser p;
+    lex_init(&l, src, src_path);
+    struct arena a;
+    arena_init(&a);
+    parser_init(&p, &l, &a);
+
+    size_t size = n * copies * 8;
+    char *want = malloc(size);
+    char *got = malloc(size);
+    int b = ast_readf(want, 0, 0, parse(&p));
+    assert(b < size);
+    b = ast_readf(got, 0, 0, parse_parallel(src, n * copies, src_path, nthreads, &a));
+    assert(b < size);
+    assert(0 == strcmp(want, got));
+    parser_free(&p);
+    lex_close(&l);
+
+    lex_init(&l, src, src_path);
+    parser_init(&p, &l, &a);
+    p.pipelined = 1;
+    memset(got, 0, size);
+    b = ast_readf(got, 0, 0, parse(&p));
+    assert(b < size);
+    assert(0 == strcmp(want, got));
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+
+    // Break the first token of the last copy
+    src[n * (copies - 1)] = '$';
+    int fds[2];
+    assert(pipe(fds) == 0);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], 2);
+        parse_parallel(src, n * copies, src_path, nthreads, &a);
+        exit(0);
+    }
+    close(fds[1]);
+    char msg[256] = {0}, prefix[256];
+    assert(read(fds[0], msg, sizeof(msg) - 1) > 0);
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 1);
+    int col = 1;
+    while (col <= n * (copies - 1) && src[n * (copies - 1) - col] != '\n') col++;
+    sprintf(prefix, "%s:%d:%d - ", src_path, one_lines * (copies - 1) + 1, col);
+    assert(0 == strncmp(msg, prefix, strlen(prefix)));
+
+    free(one);
+    free(src);
+    free(want);
+    free(got);
+}
+
+// Number of constant, variable and binary operation nodes reached from
+// `node`, counting shared ones each time they're reached
+static int
+count_pure(struct lilc_node_t *node) {
+    switch (node->type) {
+        case LILC_NODE_DBL:
+        case LILC_NODE_VAR:
+            return 1;
+        case LILC_NODE_OP_BIN: {
+            struct lilc_bin_op_node_t *op = (struct lilc_bin_op_node_t *)node;
+            return 1 + count_pure(op->left) + count_pure(op->right);
+        }
+        case LILC_NODE_BLOCK: {
+            struct lilc_block_node_t *b = (struct lilc_block_node_t *)node;
+            int n = 0;
+            for (int i = 0; i < b->stmt_count; i++) n += count_pure(b->stmts[i]);
+            return n;
+        }
+        case LILC_NODE_FUNCDEF:
+            return count_pure(((struct lilc_funcdef_node_t *)node)->body);
+        case LILC_NODE_FUNCCALL: {
+            struct lilc_funccall_node_t *c = (struct lilc_funccall_node_t *)node;
+            int n = 0;
+            for (int i = 0; i < c->arg_count; i++) n += count_pure(c->args[i]);
+            return n;
+        }
+        case LILC_NODE_IF: {
+            struct lilc_if_node_t *in = (struct lilc_if_node_t *)node;
+            int n = count_pure(in->cond) + count_pure((struct lilc_node_t *)in->then_block);
+            if (in->else_block) n += count_pure((struct lilc_node_t *)in->else_block);
+            return n;
+        }
+        default:
+            return 0;
+    }
+}
+
+// Parse with and without hash-consing: the trees read the same, the
+// shared one is built from fewer nodes, and both run to the same result,
+// with shared values only reused where they're in scope.
+static void
+test_hash_cons(char *src_path, char *want_path) {
+    char *src = read_file(src_path);
+    char *want = read_file(want_path);
+
+    struct lexer l, l_cons;
+    struct parser p, p_cons;
+    struct arena a;
+    struct node_table t;
+    arena_init(&a);
+    node_table_init(&t, &a);
+    lex_init(&l, src, src_path);
+    lex_init(&l_cons, src, src_path);
+    parser_init(&p, &l, &a);
+    parser_init(&p_cons, &l_cons, &a);
+    p_cons.cons = &t;
+
+    struct lilc_node_t *plain = parse(&p);
+    struct lilc_node_t *shared = parse(&p_cons);
+    assert(resolve(plain, &l) == 0);
+    assert(resolve(shared, &l_cons) == 0);
+
+    char *got = malloc(MAX_INCR_AST), *got_cons = malloc(MAX_INCR_AST);
+    assert(ast_readf(got, 0, 0, plain) < MAX_INCR_AST);
+    assert(ast_readf(got_cons, 0, 0, shared) < MAX_INCR_AST);
+    assert(0 == strcmp(got, got_cons));
+    assert(count_pure(shared) == count_pure(plain));
+    assert(t.count * 2 < count_pure(shared));
+
+    double d_want = strtod(want, NULL);
+    assert(fabs(lilc_eval(plain) - d_want) < 0.000001);
+    assert(fabs(lilc_eval(shared) - d_want) < 0.000001);
+
+    free(got);
+    free(got_cons);
+    node_table_free(&t);
+    parser_free(&p);
+    parser_free(&p_cons);
+    lex_close(&l);
+    lex_close(&l_cons);
+    arena_free(&a);
+    free(src);
+    free(want);
+}
+
+struct node_counter {
+    struct ast_visitor v;
+    size_t count;
+    size_t depth;
+    size_t max_depth;
+};
+
+static enum ast_walk_action
+count_enter(struct ast_visitor *v, struct lilc_node_t *node) {
+    struct node_counter *c = (struct node_counter *)v;
+    c->count++;
+    if (++c->depth > c->max_depth) c->max_depth = c->depth;
+    return AST_DESCEND;
+}
+
+static enum ast_walk_action
+count_leave(struct ast_visitor *v, struct lilc_node_t *node) {
+    ((struct node_counter *)v)->depth--;
+    return AST_DESCEND;
+}
+
+// Trees far deeper than the C stack could take if walked recursively:
+// a `deep`-long run of additions, which the parser handles in a loop,
+// and if/elses nested by hand, each walked, flattened and taken down to
+// IR. Trees `run` deep are run too. Nesting beyond the parser's limit is
+// an error, not a crash.
+static void
+test_deep_trees(size_t deep, size_t run) {
+    // 1 + 1 + ... + 1;
+    char *src = malloc(deep * 4 + 64);
+    size_t n = sprintf(src, "1");
+    for (size_t i = 0; i < deep; i++) n += sprintf(src + n, " + 1");
+    n += sprintf(src + n, ";");
+
+    struct lexer l;
+    struct parser p;
+    struct arena a;
+    arena_init(&a);
+    lex_init(&l, src, "deep");
+    parser_init(&p, &l, &a);
+    struct lilc_node_t *root = parse(&p);
+
+    struct node_counter c = {{count_enter, NULL, count_leave}};
+    assert(ast_walk(root, &c.v) == 0);
+    assert(c.max_depth > deep);
+
+    struct flat_ast f;
+    flat_ast_init(&f);
+    flat_ast_build(&f, root);
+    assert(kv_size(f.kinds) == c.count);
+    lilc_emit_ir(root, "/dev/null");
+    lilc_emit_ir_flat(&f, "/dev/null");
+    flat_ast_free(&f);
+    parser_free(&p);
+    lex_close(&l);
+
+    // Running code goes through LLVM's JIT, which slows down sharply on
+    // very long functions, so only a shallower tree is run.
+    n = sprintf(src, "def f(x) { x");
+    for (size_t i = 0; i < run; i++) n += sprintf(src + n, " + 1");
+    n += sprintf(src + n, "; };\ndef main() { f(1); };");
+    lex_init(&l, src, "deep");
+    parser_init(&p, &l, &a);
+    root = parse(&p);
+    assert(resolve(root, &l) == 0);
+    flat_ast_init(&f);
+    flat_ast_build(&f, root);
+    assert(lilc_eval_flat(&f) == run + 1);
+    assert(lilc_eval(root) == run + 1);
+    flat_ast_free(&f);
+    parser_free(&p);
+    lex_close(&l);
+
+    // Evaluated at compile time instead, it can be as long as the rest
+    n = sprintf(src, "def f(x) { x");
+    for (size_t i = 0; i < deep; i++) n += sprintf(src + n, " + 1");
+    n += sprintf(src + n, "; };\ndef main() { f(1); };");
+    lex_init(&l, src, "deep");
+    parser_init(&p, &l, &a);
+    root = parse(&p);
+    assert(resolve(root, &l) == 0);
+    assert(ctfe(root, &a, deep * 4, LILC_CTFE_DEPTH, NULL, NULL) == 1);
+    struct lilc_funcdef_node_t *main_def = (struct lilc_funcdef_node_t *)((struct lilc_block_node_t *)root)->stmts[1];
+    struct lilc_node_t *ret = ((struct lilc_block_node_t *)main_def->body)->stmts[0];
+    assert(ret->type == LILC_NODE_DBL && ((struct lilc_dbl_node_t *)ret)->val == deep + 1);
+    parser_free(&p);
+    lex_close(&l);
+
+    // if (0) { 0; } else { if (0) ... { 1; } }
+    struct lilc_node_t *zero = (struct lilc_node_t *)lilc_dbl_node_new(&a, 0);
+    struct lilc_node_t *body = (struct lilc_node_t *)lilc_dbl_node_new(&a, 1);
+    struct lilc_node_t *shallow = NULL;
+    for (size_t i = 0; i < deep / 10; i++) {
+        struct lilc_if_node_t *in = lilc_if_node_new(&a, zero, lilc_block_node_new(&a, &zero, 1));
+        in->else_block = lilc_block_node_new(&a, &body, 1);
+        body = (struct lilc_node_t *)in;
+        if (i + 1 == run) shallow = body;
+    }
+    root = (struct lilc_node_t *)lilc_block_node_new(&a, &body, 1);
+    flat_ast_init(&f);
+    flat_ast_build(&f, root);
+    lilc_emit_ir(root, "/dev/null");
+    lilc_emit_ir_flat(&f, "/dev/null");
+    flat_ast_free(&f);
+
+    // def main() { <the first `run` ifs> };
+    struct lilc_proto_node_t *proto = lilc_proto_node_new(&a, lilc_intern("main", 4), NULL, 0);
+    struct lilc_node_t *def = (struct lilc_node_t *)lilc_funcdef_node_new(&a, proto, shallow);
+    root = (struct lilc_node_t *)lilc_block_node_new(&a, &def, 1);
+    flat_ast_init(&f);
+    flat_ast_build(&f, root);
+    assert(lilc_eval(root) == 1);
+    assert(lilc_eval_flat(&f) == 1);
+    flat_ast_free(&f);
+
+    // Parentheses nested `deep` deep
+    n = 0;
+    for (size_t i = 0; i < deep; i++) src[n++] = '(';
+    src[n++] = '1';
+    for (size_t i = 0; i < deep; i++) src[n++] = ')';
+    strcpy(src + n, "; 2;");
+    lex_init(&l, src, "deep");
+    parser_init(&p, &l, &a);
+    root = parse_collect(&p);
+    assert(kv_size(p.diags) == 1);
+    assert(0 == strcmp(kv_A(p.diags, 0).msg, "expression: Nested too deeply"));
+    assert(((struct lilc_block_node_t *)root)->stmt_count == 1);
+    parser_free(&p);
+    lex_close(&l);
+
+    arena_free(&a);
+    free(src);
+}
+
+// Fold constants in a program, checking what's left of the tree, and
+// that it runs to the same result as before
+static void
+test_fold(char *src_path, char *want_ast_path, char *want_path) {
+    char *src = read_file(src_path);
+    char *want_ast = read_file(want_ast_path);
+    char *want = read_file(want_path);
+
+    struct lexer l;
+    struct parser p;
+    lex_init(&l, src, src_path);
+    struct arena a;
+    arena_init(&a);
+    parser_init(&p, &l, &a);
+    struct lilc_node_t *node = parse(&p);
+    assert(resolve(node, &l) == 0);
+
+    double d_want = strtod(want, NULL);
+    assert(fabs(lilc_eval(node) - d_want) < 0.000001);
+
+    node = fold(node, &a);
+    char got[MAX_DIAG_STR] = {0};
+    int b = ast_readf(got, 0, 0, node);
+    assert(b < MAX_DIAG_STR);
+    assert(0 == strcmp(want_ast, got));
+    assert(fabs(lilc_eval(node) - d_want) < 0.000001);
+
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+    free(src);
+    free(want_ast);
+    free(want);
+}
+
+#define MAX_AST_STR 4096  // Max length of a whole formatted program
+
+// Rewrite a program's arithmetic with relaxed floating point, checking
+// what the tree comes out as, and that it runs to nearly the same result.
+// Strict, it must be left alone.
+static void
+test_reassoc(char *src_path, char *want_ast_path, char *want_path) {
+    char *src = read_file(src_path);
+    char *want_ast = read_file(want_ast_path);
+    char *want = read_file(want_path);
+
+    struct lexer l;
+    struct parser p;
+    lex_init(&l, src, src_path);
+    struct arena a;
+    arena_init(&a);
+    parser_init(&p, &l, &a);
+    struct lilc_node_t *node = parse(&p);
+    assert(resolve(node, &l) == 0);
+
+    double d_want = strtod(want, NULL);
+    assert(fabs(lilc_eval(node) - d_want) < 0.000001);
+
+    char before[MAX_AST_STR] = {0}, got[MAX_AST_STR] = {0};
+    ast_readf(before, 0, 0, node);
+    assert(reassoc(node, &a, LILC_FP_STRICT) == node);
+    ast_readf(got, 0, 0, node);
+    assert(0 == strcmp(before, got));
+
+    node = reassoc(node, &a, LILC_FP_RELAXED);
+    memset(got, 0, sizeof(got));
+    int b = ast_readf(got, 0, 0, node);
+    assert(b < MAX_AST_STR);
+    assert(0 == strcmp(want_ast, got));
+    assert(fabs(lilc_eval(node) - d_want) < 0.000001);
+
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
     free(src);
+    free(want_ast);
     free(want);
 }
 
+// Inline the small functions of a program, checking which calls were
+// inlined, what the tree comes out as, and that it runs the same. With a
+// threshold of nothing, nothing is.
+static void
+test_inline(char *src_path, unsigned int threshold, char *want_diag_path, char *want_ast_path,
+            char *want_path) {
+    char *src = read_file(src_path);
+    char *want_diag = read_file(want_diag_path);
+    char *want_ast = read_file(want_ast_path);
+    char *want = read_file(want_path);
+
+    struct lexer l;
+    struct parser p;
+    lex_init(&l, src, src_path);
+    struct arena a;
+    arena_init(&a);
+    parser_init(&p, &l, &a);
+    struct lilc_node_t *node = parse(&p);
+    assert(resolve(node, &l) == 0);
+
+    double d_want = strtod(want, NULL);
+    assert(fabs(lilc_eval(node) - d_want) < 0.000001);
+    assert(inline_calls(node, &a, 0, &l, NULL) == 0);
+
+    lilc_diags_t notes;
+    kv_init(notes);
+    int inlined = inline_calls(node, &a, threshold, &l, &notes);
+    assert(inlined == kv_size(notes));
+
+    char got[MAX_AST_STR] = {0};
+    int b = 0;
+    for (size_t i = 0; i < kv_size(notes); i++) {
+        struct lilc_diag *d = &kv_A(notes, i);
+        b += snprintf(got + b, MAX_AST_STR - b, "%d:%d - %s\n", d->pos.line, d->pos.col, d->msg);
+    }
+    assert(0 == strcmp(want_diag, got));
+
+    memset(got, 0, sizeof(got));
+    b = ast_readf(got, 0, 0, node);
+    assert(b < MAX_AST_STR);
+    assert(0 == strcmp(want_ast, got));
+    assert(fabs(lilc_eval(node) - d_want) < 0.000001);
+
+    kv_destroy(notes);
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+    free(src);
+    free(want_diag);
+    free(want_ast);
+    free(want);
+}
+
+// Take the dead functions out of a program, first keeping one exported,
+// then not, checking what's left and, given `want_path`, that it runs the
+// same. Codegen can't yet define functions inside others, so programs
+// that do aren't run.
+static void
+test_prune(char *src_path, char *export, int want_removed, char *want_ast_path, char *want_path) {
+    char *src = read_file(src_path);
+    char *want_ast = read_file(want_ast_path);
+
+    struct lexer l;
+    struct parser p;
+    lex_init(&l, src, src_path);
+    struct arena a;
+    arena_init(&a);
+    parser_init(&p, &l, &a);
+    struct lilc_node_t *node = parse(&p);
+    assert(resolve(node, &l) == 0);
+
+    lilc_sym_t exports[] = {lilc_intern(export, strlen(export))};
+    assert(prune(node, exports, 1) == want_removed);
+    assert(prune(node, exports, 1) == 0);
+    assert(prune(node, NULL, 0) == 1);
+
+    char got[MAX_AST_STR] = {0};
+    int b = ast_readf(got, 0, 0, node);
+    assert(b < MAX_AST_STR);
+    assert(0 == strcmp(want_ast, got));
+
+    if (want_path) {
+        char *want = read_file(want_path);
+        assert(fabs(lilc_eval(node) - strtod(want, NULL)) < 0.000001);
+        free(want);
+    }
+
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+    free(src);
+    free(want_ast);
+}
+
+#define AST_CACHE "ast_cache.bin"
+
+// Parse a program lazily, then only the bodies reachable in it, and
+// check that once the rest are pruned it's the same as parsed in full.
+// Given `want_path`, check it runs to that too, before pruning as well,
+// with the bodies never parsed left out, as a tree and flattened.
+static void
+test_lazy(char *src_path, int want_parsed, char *want_path) {
+    char *src = read_file(src_path);
+    char want_ast[MAX_AST_STR] = {0}, got[MAX_AST_STR] = {0};
+    struct lilc_node_t *nodes[2];
+    for (int lazy = 0; lazy < 2; lazy++) {
+        struct lexer l;
+        struct parser p;
+        struct arena a;
+        lex_init(&l, src, src_path);
+        arena_init(&a);
+        parser_init(&p, &l, &a);
+        p.lazy = lazy;
+        nodes[lazy] = parse(&p);
+        if (lazy) assert(parse_reachable(&p, nodes[lazy], NULL, 0) == want_parsed);
+        assert(resolve(nodes[lazy], &l) == 0);
+        if (lazy && want_path) {
+            char *want = read_file(want_path);
+            struct flat_ast f;
+            flat_ast_init(&f);
+            flat_ast_build(&f, nodes[lazy]);
+            assert(fabs(lilc_eval(nodes[lazy]) - strtod(want, NULL)) < 0.000001);
+            assert(fabs(lilc_eval_flat(&f) - strtod(want, NULL)) < 0.000001);
+            flat_ast_free(&f);
+            free(want);
+        }
+        prune(nodes[lazy], NULL, 0);
+        int b = ast_readf(lazy ? got : want_ast, 0, 0, nodes[lazy]);
+        assert(b < MAX_AST_STR);
+        if (want_path) {
+            char *want = read_file(want_path);
+            assert(fabs(lilc_eval(nodes[lazy]) - strtod(want, NULL)) < 0.000001);
+            free(want);
+        }
+        parser_free(&p);
+        lex_close(&l);
+        arena_free(&a);
+    }
+    assert(0 == strcmp(want_ast, got));
+
+    // Bodies never parsed can't have errors reported in them, and the
+    // functions are only declared
+    char *bad = "def bad(x) { x + ; }; def main() { 1; };";
+    struct lexer l;
+    struct parser p;
+    struct arena a;
+    lex_init(&l, bad, "bad");
+    arena_init(&a);
+    parser_init(&p, &l, &a);
+    p.lazy = 1;
+    struct lilc_node_t *node = parse(&p);
+    assert(parse_reachable(&p, node, NULL, 0) == 1);
+    assert(kv_size(p.diags) == 0);
+    assert(resolve(node, &l) == 0);
+    assert(lilc_eval(node) == 1);
+
+    // Flattened, and through a cache file, the same
+    struct flat_ast f;
+    flat_ast_init(&f);
+    flat_ast_build(&f, node);
+    assert(lilc_eval_flat(&f) == 1);
+    assert(flat_ast_write(&f, 0, AST_CACHE) == 0);
+    flat_ast_free(&f);
+    assert(flat_ast_load(&f, AST_CACHE, 0));
+    assert(lilc_eval_flat(&f) == 1);
+    flat_ast_free(&f);
+    unlink(AST_CACHE);
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+    free(src);
+}
+
+// Evaluate the constant calls of a program at compile time, then take out
+// the functions left uncalled, checking which calls went, what's left,
+// and that it runs the same. With no steps to take, nothing goes.
+static void
+test_ctfe(char *src_path, int want_replaced, char *want_diag_path, char *want_ast_path,
+          char *want_path) {
+    char *src = read_file(src_path);
+    char *want_diag = read_file(want_diag_path);
+    char *want_ast = read_file(want_ast_path);
+    char *want = read_file(want_path);
+
+    struct lexer l;
+    struct parser p;
+    lex_init(&l, src, src_path);
+    struct arena a;
+    arena_init(&a);
+    parser_init(&p, &l, &a);
+    struct lilc_node_t *node = parse(&p);
+    assert(resolve(node, &l) == 0);
+
+    double d_want = strtod(want, NULL);
+    assert(fabs(lilc_eval(node) - d_want) < 0.000001);
+    assert(ctfe(node, &a, 0, LILC_CTFE_DEPTH, &l, NULL) == 0);
+
+    lilc_diags_t notes;
+    kv_init(notes);
+    assert(ctfe(node, &a, LILC_CTFE_STEPS, LILC_CTFE_DEPTH, &l, &notes) == want_replaced);
+    assert(ctfe(node, &a, LILC_CTFE_STEPS, LILC_CTFE_DEPTH, &l, NULL) == 0);
+
+    char got[MAX_AST_STR] = {0};
+    int b = 0;
+    for (size_t i = 0; i < kv_size(notes); i++) {
+        struct lilc_diag *d = &kv_A(notes, i);
+        b += snprintf(got + b, MAX_AST_STR - b, "%d:%d - %s\n", d->pos.line, d->pos.col, d->msg);
+    }
+    assert(0 == strcmp(want_diag, got));
+
+    prune(node, NULL, 0);
+    memset(got, 0, sizeof(got));
+    b = ast_readf(got, 0, 0, node);
+    assert(b < MAX_AST_STR);
+    assert(0 == strcmp(want_ast, got));
+    assert(fabs(lilc_eval(node) - d_want) < 0.000001);
+
+    kv_destroy(notes);
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+    free(src);
+    free(want_diag);
+    free(want_ast);
+    free(want);
+}
+
+// Memoize a program's functions in `mode`, checking which are, that it
+// runs the same, flattened too, and what their caches did meanwhile
+static void
+test_memo(char *src_path, enum memo_mode mode, int want_marked, char *want_ast_path,
+          char *want_stats_path, char *want_path) {
+    char *src = read_file(src_path);
+    char *want_ast = read_file(want_ast_path);
+    char *want_stats = read_file(want_stats_path);
+    char *want = read_file(want_path);
+
+    struct lexer l;
+    struct parser p;
+    lex_init(&l, src, src_path);
+    struct arena a;
+    arena_init(&a);
+    parser_init(&p, &l, &a);
+    struct lilc_node_t *node = parse(&p);
+    assert(resolve(node, &l) == 0);
+    assert(memoize(node, mode) == want_marked);
+
+    char got[MAX_AST_STR] = {0};
+    int b = ast_readf(got, 0, 0, node);
+    assert(b < MAX_AST_STR);
+    assert(0 == strcmp(want_ast, got));
+
+    memo_stats_t stats;
+    kv_init(stats);
+    double d_want = strtod(want, NULL);
+    assert(fabs(lilc_eval_stats(node, &stats) - d_want) < 0.000001);
+    assert(kv_size(stats) == want_marked);
+    char *dump;
+    size_t dump_len;
+    FILE *f = open_memstream(&dump, &dump_len);
+    memo_stats_dump(f, &stats);
+    fclose(f);
+    assert(0 == strcmp(want_stats, dump));
+
+    struct flat_ast flat;
+    flat_ast_init(&flat);
+    flat_ast_build(&flat, node);
+    memset(got, 0, sizeof(got));
+    b = flat_ast_readf(got, 0, 0, &flat, 0);
+    assert(0 == strcmp(want_ast, got));
+    assert(fabs(lilc_eval_flat(&flat) - d_want) < 0.000001);
+    flat_ast_free(&flat);
+
+    free(dump);
+    kv_destroy(stats);
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+
+    // A function is only known to be pure once its body's been parsed,
+    // and so are those calling it
+    char *lazy = "@memo def f(n) { n; }; @memo def main() { f(1); };";
+    lex_init(&l, lazy, "lazy");
+    arena_init(&a);
+    parser_init(&p, &l, &a);
+    p.lazy = 1;
+    struct lilc_block_node_t *root = (struct lilc_block_node_t *)parse(&p);
+    parse_body(&p, (struct lilc_funcdef_node_t *)root->stmts[1]);
+    assert(resolve(&root->base, &l) == 0);
+    assert(memoize(&root->base, LILC_MEMO_AUTO) == 0);
+    parser_free(&p);
+    lex_close(&l);
+    arena_free(&a);
+
+    free(src);
+    free(want_ast);
+    free(want_stats);
+    free(want);
+}
+
+// Parse through an AST cache file, then load the tree back from it and
+// check it reads and runs the same. Stale and damaged files are misses.
+static void
+test_ast_cache(char *src_path, char *want_ast_path, char *want_result_path) {
+    char *src = read_file(src_path);
+    char *want_ast = read_file(want_ast_path);
+    char *want_result = read_file(want_result_path);
+    size_t len = strlen(src);
+    unlink(AST_CACHE);
+
+    struct flat_ast f;
+    flat_ast_init(&f);
+    assert(flat_ast_cached(&f, src, len, src_path, AST_CACHE) == 0);
+    assert(!f.map);
+    flat_ast_free(&f);
+
+    assert(flat_ast_cached(&f, src, len, src_path, AST_CACHE) == 1);
+    assert(f.map);
+    char got[MAX_NODES] = {0};
+    int b = flat_ast_readf(got, 0, 0, &f, 0);
+    assert(b < MAX_NODES);
+    assert(0 == strcmp(want_ast, got));
+    assert(fabs(lilc_eval_flat(&f) - strtod(want_result, NULL)) < 0.000001);
+
+    // Where the arrays sit in the file, counting back from its end
+    struct stat st;
+    assert(stat(AST_CACHE, &st) == 0);
+    size_t nodes = kv_size(f.kinds), names = kv_size(f.names), chars = kv_size(f.chars);
+    off_t ends_at = st.st_size - chars - nodes - names * 4 - nodes * 8 - nodes * 4;
+    off_t payloads_at = ends_at + nodes * 4;
+    off_t names_at = payloads_at + nodes * 8;
+    flat_idx_t named = 0;
+    while (flat_kind(&f, named) != LILC_NODE_VAR && flat_kind(&f, named) != LILC_NODE_PROTO
+           && flat_kind(&f, named) != LILC_NODE_FUNCCALL) named++;
+    flat_ast_free(&f);
+
+    // Damage one entry at a time: a subtree ending before it starts, a
+    // name past the string table's index, and a name past its end
+    uint64_t hash = flat_source_hash(src, len);
+    struct {
+        off_t at;
+        uint32_t val;
+    } damage[] = {{ends_at, 0}, {payloads_at + named * 4, names}, {names_at, chars}};
+    for (int i = 0; i < 3; i++) {
+        int fd = open(AST_CACHE, O_RDWR);
+        uint32_t was;
+        assert(pread(fd, &was, 4, damage[i].at) == 4);
+        assert(pwrite(fd, &damage[i].val, 4, damage[i].at) == 4);
+        assert(!flat_ast_load(&f, AST_CACHE, hash));
+        assert(!f.map && kv_size(f.kinds) == 0);
+        assert(pwrite(fd, &was, 4, damage[i].at) == 4);
+        close(fd);
+    }
+    assert(flat_ast_load(&f, AST_CACHE, hash));
+    flat_ast_free(&f);
+
+    assert(!flat_ast_load(&f, AST_CACHE, flat_source_hash(src, len - 1)));
+    assert(truncate(AST_CACHE, st.st_size - 1) == 0);
+    assert(!flat_ast_load(&f, AST_CACHE, hash));
+    assert(!f.map && kv_size(f.kinds) == 0);
+
+    unlink(AST_CACHE);
+    free(src);
+    free(want_ast);
+    free(want_result);
+}
+
 static void
 test_codegen(char *src_path, char *want_path) {
     char *src = read_file(src_path);
@@ -65,10 +1283,13 @@ test_codegen(char *src_path, char *want_path) {
     struct lexer l;
     struct parser p;
     lex_init(&l, src, src_path);
-    parser_init(&p, &l);
+    struct arena a;
+    arena_init(&a);
+    parser_init(&p, &l, &a);
 
     struct lilc_node_t *node;
     node = parse(&p);
+    assert(resolve(node, &l) == 0);
 
     double got = lilc_eval(node);
     double d_want = strtod(want, NULL);
@@ -77,6 +1298,14 @@ test_codegen(char *src_path, char *want_path) {
     double e = 0.000001;
     assert(fabs(got - d_want) < e);
 
+    struct flat_ast f;
+    flat_ast_init(&f);
+    flat_ast_build(&f, node);
+    assert(fabs(lilc_eval_flat(&f) - d_want) < e);
+
+    flat_ast_free(&f);
+    parser_free(&p);
+    arena_free(&a);
     free(src);
     free(want);
 }
@@ -87,12 +1316,28 @@ main() {
     test_lexer("src_examples/arith_basic.lilc", "lexer/arith_basic.tok");
     test_lexer("src_examples/arith_parens.lilc", "lexer/arith_parens.tok");
     test_lexer("src_examples/func_basic.lilc", "lexer/func_basic.tok");
+    test_lexer("src_examples/lex_long_runs.lilc", "lexer/lex_long_runs.tok");
+    test_lexer("src_examples/float_literals.lilc", "lexer/float_literals.tok");
+    test_source_view("src_examples/func_basic.lilc", "lexer/func_basic.tok");
+    test_lexer_stream("src_examples/func_basic.lilc", "lexer/func_basic.tok", 5);
+    test_lexer_stream("src_examples/lex_long_runs.lilc", "lexer/lex_long_runs.tok", 80);
+    test_lexer_stream("src_examples/float_literals.lilc", "lexer/float_literals.tok", 16);
+    test_locate("src_examples/lex_long_runs.lilc", 80);
+    test_locate("src_examples/incremental.lilc", 16);
+    test_strtod(100000);
 
     // Parser
     test_parser("src_examples/arith_basic.lilc", "parser/arith_basic.ast");
     test_parser("src_examples/arith_parens.lilc", "parser/arith_parens.ast");
     test_parser("src_examples/func_basic.lilc", "parser/func_basic.ast");
     test_parser("src_examples/if_else.lilc", "parser/if_else.ast");
+    test_parse_errors("src_examples/parse_errors.lilc", "parser/parse_errors.diag",
+                      "parser/parse_errors.ast");
+    test_intern(20000);
+    test_symtab();
+    test_resolve("src_examples/name_errors.lilc", "parser/name_errors.diag");
+    test_parse_incremental("src_examples/incremental.lilc", 500);
+    test_parse_parallel("src_examples/incremental.lilc", 2000, 4);
 
     // Codegen
     test_codegen("src_examples/arith_basic.lilc", "codegen/arith_basic.result");
@@ -100,6 +1345,27 @@ main() {
     test_codegen("src_examples/func_no_params.lilc", "codegen/func_no_params.result");
     test_codegen("src_examples/cmp_basic.lilc", "codegen/cmp_basic.result");
     test_codegen("src_examples/if_else.lilc", "codegen/if_else.result");
+    test_codegen("src_examples/float_literals.lilc", "codegen/float_literals.result");
+    test_deep_trees(1000000, 1000);
+    test_fold("src_examples/fold.lilc", "parser/fold.ast", "codegen/fold.result");
+    test_reassoc("src_examples/reassoc.lilc", "parser/reassoc.ast", "codegen/reassoc.result");
+    test_inline("src_examples/inline.lilc", 12, "parser/inline.diag", "parser/inline.ast", "codegen/inline.result");
+    test_prune("src_examples/prune.lilc", "exported", 2, "parser/prune.ast", "codegen/prune.result");
+    test_prune("src_examples/prune_nested.lilc", "exported", 3, "parser/prune_nested.ast", NULL);
+    test_lazy("src_examples/prune.lilc", 3, "codegen/prune.result");
+    test_lazy("src_examples/prune_nested.lilc", 3, NULL);
+    test_ctfe("src_examples/func_basic.lilc", 1, "parser/func_basic_ctfe.diag",
+              "parser/func_basic_ctfe.ast", "codegen/func_basic.result");
+    test_ctfe("src_examples/ctfe.lilc", 5, "parser/ctfe.diag", "parser/ctfe.ast", "codegen/ctfe.result");
+    test_ctfe("src_examples/ctfe_main.lilc", 5, "parser/ctfe_main.diag", "parser/ctfe_main.ast",
+              "codegen/ctfe_main.result");
+    test_memo("src_examples/memo.lilc", LILC_MEMO_ANNOTATED, 2, "parser/memo.ast",
+              "codegen/memo.stats", "codegen/memo.result");
+    test_memo("src_examples/memo.lilc", LILC_MEMO_AUTO, 3, "parser/memo_auto.ast",
+              "codegen/memo_auto.stats", "codegen/memo.result");
+    test_hash_cons("src_examples/shared_exprs.lilc", "codegen/shared_exprs.result");
+    test_ast_cache("src_examples/func_basic.lilc", "parser/func_basic.ast",
+                   "codegen/func_basic.result");
 
     return 0;
 }